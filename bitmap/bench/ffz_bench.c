@@ -0,0 +1,95 @@
+// Pulls in the source like the tester does so every kernel can be timed, not just the one ffz picked
+#include "../include/bitmap.h"
+#include "../src/bitmap.c"
+
+#include <stdio.h>
+#include <time.h>
+
+// Same size as the block_store FBM
+#define BENCH_BITS 65536
+#define BENCH_ALLOCS 20000
+
+// What ffz was before the kernels showed up
+static size_t scan_bits(const uint8_t *const data, const size_t byte_count, const uint8_t fill) {
+    const size_t bit_count = byte_count << 3;
+    for (size_t bit = 0; bit < bit_count; ++bit) {
+        if (((data[bit >> 3] >> (bit & 0x07)) & 0x01) != (fill & 0x01)) {
+            return bit;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static size_t scan_bytes(const uint8_t *const data, const size_t byte_count, const uint8_t fill) {
+    return scan_bytes_from(data, byte_count, fill, 0);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// One allocation is ffz + set. Reset afterwards so every round sees the same fill level.
+static double time_alloc(bitmap_t *const bitmap, const scan_kernel_t kernel) {
+    volatile size_t sink = 0;
+    const double start = now_ns();
+    for (int i = 0; i < BENCH_ALLOCS; ++i) {
+        size_t bit = kernel(bitmap->data, bitmap->byte_count, 0xFF);
+        bitmap_set(bitmap, bit);
+        bitmap_reset(bitmap, bit);
+        sink += bit;
+    }
+    (void) sink;
+    return (now_ns() - start) / BENCH_ALLOCS;
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        scan_kernel_t kernel;
+    } kernels[] = {{"bit loop", scan_bits},
+                   {"byte", scan_bytes},
+                   {"word64", scan_words},
+#ifdef BITMAP_X86_KERNELS
+                   {"sse2", scan_sse2},
+                   {"avx2", scan_avx2},
+#endif
+                   {"ffz (dispatched)", NULL}};
+
+    // Allocations pack from the front, so a "full" map is a prefix of ones
+    const double fills[] = {0.0, 0.5, 0.99};
+
+    bitmap_t *bitmap = bitmap_create(BENCH_BITS);
+    if (!bitmap) {
+        return 1;
+    }
+#ifdef BITMAP_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+
+    printf("%-18s %12s %12s %12s\n", "kernel", "empty", "half", "99%");
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+#ifdef BITMAP_X86_KERNELS
+        if (kernels[k].kernel == scan_avx2 && !__builtin_cpu_supports("avx2")) {
+            continue;
+        }
+#endif
+        printf("%-18s", kernels[k].name);
+        for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); ++f) {
+            bitmap_format(bitmap, 0x00);
+            const size_t used = (size_t)(BENCH_BITS * fills[f]);
+            for (size_t bit = 0; bit < used; ++bit) {
+                bitmap_set(bitmap, bit);
+            }
+            if (!kernels[k].kernel) {
+                scan_kernel(bitmap->data, bitmap->byte_count, 0xFF);  // resolve it before timing
+            }
+            printf(" %9.1f ns", time_alloc(bitmap, kernels[k].kernel ? kernels[k].kernel : scan_kernel));
+        }
+        printf("\n");
+    }
+
+    bitmap_destroy(bitmap);
+    return 0;
+}
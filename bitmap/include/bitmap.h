@@ -40,6 +40,24 @@ void bitmap_reset(bitmap_t *const bitmap, const size_t bit);
 ///
 bool bitmap_test(const bitmap_t *const bitmap, const size_t bit);
 
+///
+/// Sets all bits in the range [start, end)
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to set
+/// \param end One past the last bit to set
+///
+void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t end);
+
+///
+/// Clears all bits in the range [start, end)
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to clear
+/// \param end One past the last bit to clear
+///
+void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t end);
+
 ///
 /// Flips bit in bitmap
 /// \param bitmap The bitmap
@@ -67,12 +85,103 @@ size_t bitmap_ffs(const bitmap_t *const bitmap);
 ///
 size_t bitmap_ffz(const bitmap_t *const bitmap);
 
+///
+/// Find first set in the range [start, end)
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to consider
+/// \param end One past the last bit to consider
+/// \return The first one bit address in the range, SIZE_MAX on error/not found
+///
+size_t bitmap_ffs_range(const bitmap_t *const bitmap, const size_t start, const size_t end);
+
+///
+/// Find first zero in the range [start, end)
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to consider
+/// \param end One past the last bit to consider
+/// \return The first zero bit address in the range, SIZE_MAX on error/not found
+///
+size_t bitmap_ffz_range(const bitmap_t *const bitmap, const size_t start, const size_t end);
+
+///
+/// Count bits set in the range [start, end)
+///  end is clamped to the size of the bitmap
+/// \param bitmap the bitmap
+/// \param start The first bit to count
+/// \param end One past the last bit to count
+/// \return the number of bits in the range that are set
+///
+size_t bitmap_total_set_range(const bitmap_t *const bitmap, const size_t start, const size_t end);
+
 ///
 /// Count all bits set
 /// \param bitmap the bitmap
 /// \return the total number of bits that are set in the bitmap
 ///
 size_t bitmap_total_set(const bitmap_t *const bitmap);
+///
+/// Sets requested bit in bitmap as one atomic step
+///  The atomic functions can run alongside each other from any number of threads,
+///  but not alongside the plain ones changing the same bits
+/// \param bitmap The bitmap
+/// \param bit The bit to set
+/// \return State of the bit before it was set
+///
+bool bitmap_test_and_set_atomic(bitmap_t *const bitmap, const size_t bit);
+
+///
+/// Clears requested bit in bitmap as one atomic step
+/// \param bitmap The bitmap
+/// \param bit The bit to clear
+/// \return State of the bit before it was cleared
+///
+bool bitmap_test_and_reset_atomic(bitmap_t *const bitmap, const size_t bit);
+
+///
+/// Finds the first zero in the range [start, end) and sets it, atomically
+///  Two threads never get the same bit
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to consider
+/// \param end One past the last bit to consider
+/// \return The bit that was set, SIZE_MAX on error/not found
+///
+size_t bitmap_ffz_claim_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+
+///
+/// Finds the first one in the range [start, end) and clears it, atomically
+///  Two threads never get the same bit
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to consider
+/// \param end One past the last bit to consider
+/// \return The bit that was cleared, SIZE_MAX on error/not found
+///
+size_t bitmap_ffs_reset_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+
+///
+/// Sets bits from start up to end for as long as they are zero, atomically
+///  Stops at the first bit that is already set, bits before it are left set
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to set
+/// \param end One past the last bit to set
+/// \return One past the last bit set (the set bit it stopped at, or end), SIZE_MAX on error
+///
+size_t bitmap_claim_range_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+
+///
+/// Clears all bits in the range [start, end), atomically
+///  end is clamped to the size of the bitmap
+/// \param bitmap The bitmap
+/// \param start The first bit to clear
+/// \param end One past the last bit to clear
+/// \return The number of bits in the range that were set
+///
+size_t bitmap_reset_range_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+
 ///
 /// For each loop for all set bits
 ///  (Arguments passed to func are saved across calls)
@@ -1,5 +1,10 @@
 #include "bitmap.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITMAP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 // Just the one for now. Indicates we're an overlay and should not free
 // (also, make sure that ALL is as wide as ll of the flags)
 typedef enum { NONE = 0x00, OVERLAY = 0x01, ALL = 0xFF } BITMAP_FLAGS;
@@ -58,6 +63,130 @@ static const uint8_t bit_totals[256] = {B6(0), B6(1), B6(1), B6(2)};
 // A place to generalize the creation process and setup
 bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags);
 
+// Scan kernels for ffs/ffz
+// Each one returns the address of the first bit that differs from fill (0x00 for ffs, 0xFF for ffz)
+// or SIZE_MAX if every byte matches. They do not know about bit_count, so the caller has to
+// throw out hits in the padding bits of the last byte.
+typedef size_t (*scan_kernel_t)(const uint8_t *const data, const size_t byte_count, const uint8_t fill);
+
+// Bit address of the first differing bit in a byte we already know differs
+static inline size_t scan_hit(const uint8_t *const data, const size_t byte, const uint8_t fill) {
+    return (byte << 3) + (size_t) __builtin_ctz((unsigned) (data[byte] ^ fill));
+}
+
+// The original bit-at-a-time loop did the same thing, just 8x slower. This is the portable fallback.
+static size_t scan_bytes_from(const uint8_t *const data, const size_t byte_count, const uint8_t fill, size_t byte) {
+    for (; byte < byte_count; ++byte) {
+        if (data[byte] != fill) {
+            return scan_hit(data, byte, fill);
+        }
+    }
+    return SIZE_MAX;
+}
+
+// 64 bits per compare. memcpy so we don't care about alignment (overlays can be anywhere)
+static size_t scan_words_from(const uint8_t *const data, const size_t byte_count, const uint8_t fill, size_t byte) {
+    const uint64_t pattern = fill ? UINT64_MAX : 0;
+    for (; byte + sizeof(uint64_t) <= byte_count; byte += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + byte, sizeof(uint64_t));
+        if (word != pattern) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            // Byte order matches bit order, so the whole word can be counted at once
+            return (byte << 3) + (size_t) __builtin_ctzll(word ^ pattern);
+#else
+            return scan_bytes_from(data, byte + sizeof(uint64_t), fill, byte);
+#endif
+        }
+    }
+    return scan_bytes_from(data, byte_count, fill, byte);
+}
+
+static size_t scan_words(const uint8_t *const data, const size_t byte_count, const uint8_t fill) {
+    return scan_words_from(data, byte_count, fill, 0);
+}
+
+#ifdef BITMAP_X86_KERNELS
+
+// movemask gives one bit per byte that matched the fill, so the first zero in it is our byte
+__attribute__((target("sse2"))) static size_t scan_sse2(const uint8_t *const data, const size_t byte_count,
+                                                         const uint8_t fill) {
+    const __m128i pattern = _mm_set1_epi8((char) fill);
+    size_t byte = 0;
+    for (; byte + sizeof(__m128i) <= byte_count; byte += sizeof(__m128i)) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *) (data + byte));
+        const unsigned matched = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern));
+        if (matched != 0xFFFFu) {
+            return scan_hit(data, byte + (size_t) __builtin_ctz(~matched), fill);
+        }
+    }
+    return scan_words_from(data, byte_count, fill, byte);
+}
+
+__attribute__((target("avx2"))) static size_t scan_avx2(const uint8_t *const data, const size_t byte_count,
+                                                         const uint8_t fill) {
+    const __m256i pattern = _mm256_set1_epi8((char) fill);
+    size_t byte = 0;
+    for (; byte + sizeof(__m256i) <= byte_count; byte += sizeof(__m256i)) {
+        const __m256i chunk = _mm256_loadu_si256((const __m256i *) (data + byte));
+        const unsigned matched = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern));
+        if (matched != 0xFFFFFFFFu) {
+            return scan_hit(data, byte + (size_t) __builtin_ctz(~matched), fill);
+        }
+    }
+    return scan_words_from(data, byte_count, fill, byte);
+}
+
+#endif
+
+// First call picks the best kernel the CPU supports and swaps itself out.
+// Racing threads will all pick the same thing, so nobody cares who wins.
+static size_t scan_resolve(const uint8_t *const data, const size_t byte_count, const uint8_t fill);
+
+static scan_kernel_t scan_kernel = scan_resolve;
+
+static scan_kernel_t scan_select(void) {
+#ifdef BITMAP_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return scan_sse2;
+    }
+#endif
+    return scan_words;
+}
+
+static size_t scan_resolve(const uint8_t *const data, const size_t byte_count, const uint8_t fill) {
+    scan_kernel = scan_select();
+    return scan_kernel(data, byte_count, fill);
+}
+
+// Kernels only work on whole bytes, so the leading partial byte gets masked by hand
+// and anything the kernel finds at or past end gets thrown out.
+static size_t scan_range(const bitmap_t *const bitmap, const size_t start, size_t end, const uint8_t fill) {
+    if (end > bitmap->bit_count) {
+        end = bitmap->bit_count;
+    }
+    if (start >= end) {
+        return SIZE_MAX;
+    }
+    const size_t first_byte = start >> 3;
+    const size_t end_byte = (end + 7) >> 3;
+    size_t result;
+    const uint8_t lead = (uint8_t)((bitmap->data[first_byte] ^ fill) & (0xFF << (start & 0x07)));
+    if (lead) {
+        result = (first_byte << 3) + (size_t) __builtin_ctz(lead);
+    } else {
+        result = scan_kernel(bitmap->data + first_byte + 1, end_byte - first_byte - 1, fill);
+        if (result != SIZE_MAX) {
+            result += (first_byte + 1) << 3;
+        }
+    }
+    return (result < end ? result : SIZE_MAX);
+}
+
 void bitmap_set(bitmap_t *const bitmap, const size_t bit) {
     bitmap->data[bit >> 3] |= mask[bit & 0x07];
 }
@@ -70,6 +199,36 @@ bool bitmap_test(const bitmap_t *const bitmap, const size_t bit) {
     return bitmap->data[bit >> 3] & mask[bit & 0x07];
 }
 
+// Ragged edges bit by bit, whole bytes in one memset
+static void fill_range(bitmap_t *const bitmap, size_t start, size_t end, const bool value) {
+    if (end > bitmap->bit_count) {
+        end = bitmap->bit_count;
+    }
+    for (; start < end && (start & 0x07); ++start) {
+        value ? bitmap_set(bitmap, start) : bitmap_reset(bitmap, start);
+    }
+    if (start + 8 <= end) {
+        const size_t bytes = (end - start) >> 3;
+        memset(bitmap->data + (start >> 3), value ? 0xFF : 0x00, bytes);
+        start += bytes << 3;
+    }
+    for (; start < end; ++start) {
+        value ? bitmap_set(bitmap, start) : bitmap_reset(bitmap, start);
+    }
+}
+
+void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t end) {
+    if (bitmap) {
+        fill_range(bitmap, start, end, true);
+    }
+}
+
+void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t end) {
+    if (bitmap) {
+        fill_range(bitmap, start, end, false);
+    }
+}
+
 void bitmap_flip(bitmap_t *const bitmap, const size_t bit) {
     bitmap->data[bit >> 3] ^= mask[bit & 0x07];
 }
@@ -82,24 +241,55 @@ void bitmap_invert(bitmap_t *const bitmap) {
 
 size_t bitmap_ffs(const bitmap_t *const bitmap) {
     if (bitmap) {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && !bitmap_test(bitmap, result); ++result) {
-        }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
+        size_t result = scan_kernel(bitmap->data, bitmap->byte_count, 0x00);
+        return (result < bitmap->bit_count ? result : SIZE_MAX);
     }
     return SIZE_MAX;
 }
 
 size_t bitmap_ffz(const bitmap_t *const bitmap) {
     if (bitmap) {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && bitmap_test(bitmap, result); ++result) {
-        }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
+        // Hits past bit_count are just the padding in the last byte
+        size_t result = scan_kernel(bitmap->data, bitmap->byte_count, 0xFF);
+        return (result < bitmap->bit_count ? result : SIZE_MAX);
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_ffs_range(const bitmap_t *const bitmap, const size_t start, const size_t end) {
+    if (bitmap) {
+        return scan_range(bitmap, start, end, 0x00);
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_ffz_range(const bitmap_t *const bitmap, const size_t start, const size_t end) {
+    if (bitmap) {
+        return scan_range(bitmap, start, end, 0xFF);
     }
     return SIZE_MAX;
 }
 
+size_t bitmap_total_set_range(const bitmap_t *const bitmap, size_t start, size_t end) {
+    size_t total = 0;
+    if (bitmap) {
+        if (end > bitmap->bit_count) {
+            end = bitmap->bit_count;
+        }
+        // Ragged edges bit by bit, whole bytes from the table
+        for (; start < end && (start & 0x07); ++start) {
+            total += bitmap_test(bitmap, start);
+        }
+        for (; start + 8 <= end; start += 8) {
+            total += bit_totals[bitmap->data[start >> 3]];
+        }
+        for (; start < end; ++start) {
+            total += bitmap_test(bitmap, start);
+        }
+    }
+    return total;
+}
+
 size_t bitmap_total_set(const bitmap_t *const bitmap) {
     size_t total = 0;
     if (bitmap) {
@@ -119,6 +309,161 @@ size_t bitmap_total_set(const bitmap_t *const bitmap) {
     return total;
 }
 
+// The atomic functions work on the aligned 64-bit word a bit lives in when that whole word is inside the bitmap,
+// and on the bit's byte otherwise. Either way a given bit is always touched through the same width.
+// Words only line up with bit order on little endian, so everything else gets bytes.
+typedef struct {
+    uint64_t *word;  // NULL when it's a byte
+    uint8_t *byte;
+    size_t base;     // address of bit 0 of the unit
+    size_t width;
+} atomic_unit_t;
+
+static atomic_unit_t unit_for(const bitmap_t *const bitmap, const size_t bit) {
+    atomic_unit_t unit = {NULL, bitmap->data + (bit >> 3), bit & ~(size_t) 0x07, 8};
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const size_t lead = (uintptr_t) unit.byte & 0x07;  // bytes ahead of it in its word
+    if (lead <= bit >> 3 && (bit >> 3) - lead + sizeof(uint64_t) <= bitmap->byte_count) {
+        unit.word = (uint64_t *) (unit.byte - lead);
+        unit.base = ((bit >> 3) - lead) << 3;
+        unit.width = 64;
+    }
+#endif
+    return unit;
+}
+
+// Bits [from, end) of the unit, from has to be in it
+static uint64_t unit_mask(const atomic_unit_t *const unit, const size_t from, const size_t end) {
+    const size_t high = end - unit->base < unit->width ? end - unit->base : unit->width;
+    return (high == 64 ? UINT64_MAX : ((uint64_t) 1 << high) - 1) & ~(((uint64_t) 1 << (from - unit->base)) - 1);
+}
+
+static uint64_t unit_load(const atomic_unit_t *const unit) {
+    return unit->word ? __atomic_load_n(unit->word, __ATOMIC_RELAXED) : __atomic_load_n(unit->byte, __ATOMIC_RELAXED);
+}
+
+// On failure seen gets what was really there
+static bool unit_cas(const atomic_unit_t *const unit, uint64_t *const seen, const uint64_t value) {
+    if (unit->word) {
+        return __atomic_compare_exchange_n(unit->word, seen, value, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    uint8_t seen_byte = (uint8_t) *seen;
+    const bool swapped =
+        __atomic_compare_exchange_n(unit->byte, &seen_byte, (uint8_t) value, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    *seen = seen_byte;
+    return swapped;
+}
+
+static uint64_t unit_fetch_or(const atomic_unit_t *const unit, const uint64_t bits) {
+    return unit->word ? __atomic_fetch_or(unit->word, bits, __ATOMIC_ACQ_REL)
+                      : __atomic_fetch_or(unit->byte, (uint8_t) bits, __ATOMIC_ACQ_REL);
+}
+
+static uint64_t unit_fetch_and(const atomic_unit_t *const unit, const uint64_t bits) {
+    return unit->word ? __atomic_fetch_and(unit->word, bits, __ATOMIC_ACQ_REL)
+                      : __atomic_fetch_and(unit->byte, (uint8_t) bits, __ATOMIC_ACQ_REL);
+}
+
+bool bitmap_test_and_set_atomic(bitmap_t *const bitmap, const size_t bit) {
+    const atomic_unit_t unit = unit_for(bitmap, bit);
+    const uint64_t bit_mask = (uint64_t) 1 << (bit - unit.base);
+    return unit_fetch_or(&unit, bit_mask) & bit_mask;
+}
+
+bool bitmap_test_and_reset_atomic(bitmap_t *const bitmap, const size_t bit) {
+    const atomic_unit_t unit = unit_for(bitmap, bit);
+    const uint64_t bit_mask = (uint64_t) 1 << (bit - unit.base);
+    return unit_fetch_and(&unit, ~bit_mask) & bit_mask;
+}
+
+size_t bitmap_ffz_claim_atomic(bitmap_t *const bitmap, const size_t start, size_t end) {
+    if (bitmap) {
+        if (end > bitmap->bit_count) {
+            end = bitmap->bit_count;
+        }
+        for (size_t bit = start; bit < end;) {
+            const atomic_unit_t unit = unit_for(bitmap, bit);
+            const uint64_t range = unit_mask(&unit, bit, end);
+            uint64_t seen = unit_load(&unit);
+            // Lowest zero we can see, if someone beats us to it the CAS says what changed and we go again
+            for (uint64_t free = ~seen & range; free; free = ~seen & range) {
+                const uint64_t claim = free & (~free + 1);
+                if (unit_cas(&unit, &seen, seen | claim)) {
+                    return unit.base + (size_t) __builtin_ctzll(claim);
+                }
+            }
+            bit = unit.base + unit.width;
+        }
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_ffs_reset_atomic(bitmap_t *const bitmap, const size_t start, size_t end) {
+    if (bitmap) {
+        if (end > bitmap->bit_count) {
+            end = bitmap->bit_count;
+        }
+        for (size_t bit = start; bit < end;) {
+            const atomic_unit_t unit = unit_for(bitmap, bit);
+            const uint64_t range = unit_mask(&unit, bit, end);
+            uint64_t seen = unit_load(&unit);
+            // Same as claiming a zero, just the other way up
+            for (uint64_t set = seen & range; set; set = seen & range) {
+                const uint64_t take = set & (~set + 1);
+                if (unit_cas(&unit, &seen, seen & ~take)) {
+                    return unit.base + (size_t) __builtin_ctzll(take);
+                }
+            }
+            bit = unit.base + unit.width;
+        }
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_claim_range_atomic(bitmap_t *const bitmap, const size_t start, size_t end) {
+    if (bitmap) {
+        if (end > bitmap->bit_count) {
+            end = bitmap->bit_count;
+        }
+        for (size_t bit = start; bit < end;) {
+            const atomic_unit_t unit = unit_for(bitmap, bit);
+            const uint64_t range = unit_mask(&unit, bit, end);
+            uint64_t seen = unit_load(&unit);
+            for (;;) {
+                // Everything in range below the first bit that's already set
+                const uint64_t taken = seen & range;
+                const uint64_t stop = taken & (~taken + 1);
+                const uint64_t claim = stop ? range & (stop - 1) : range;
+                if (claim == 0 || unit_cas(&unit, &seen, seen | claim)) {
+                    if (stop) {
+                        return unit.base + (size_t) __builtin_ctzll(stop);
+                    }
+                    break;
+                }
+            }
+            bit = unit.base + unit.width;
+        }
+        return end > start ? end : start;
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_reset_range_atomic(bitmap_t *const bitmap, const size_t start, size_t end) {
+    size_t total = 0;
+    if (bitmap) {
+        if (end > bitmap->bit_count) {
+            end = bitmap->bit_count;
+        }
+        for (size_t bit = start; bit < end;) {
+            const atomic_unit_t unit = unit_for(bitmap, bit);
+            const uint64_t range = unit_mask(&unit, bit, end);
+            total += (size_t) __builtin_popcountll(unit_fetch_and(&unit, ~range) & range);
+            bit = unit.base + unit.width;
+        }
+    }
+    return total;
+}
+
 void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *), void *arg) {
     if (bitmap && func) {
         for (size_t idx = 0; idx < bitmap->bit_count; ++idx) {
@@ -2,6 +2,7 @@
 #include "../src/bitmap.c"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -93,6 +94,36 @@
     32. Normal, all bits set
     33. Normal, with weird bit count
     34. Fail, NULL
+
+    ffs/ffz scan kernels
+    35. Every kernel agrees with a bit-at-a-time scan, any hit position, any length
+    36. Padding bits in the last byte are never reported
+
+    size_t bitmap_ffz_range(const bitmap_t *const bitmap, const size_t start, const size_t end);
+    size_t bitmap_total_set_range(const bitmap_t *const bitmap, const size_t start, const size_t end);
+    37. Normal, every start/end against a bit-at-a-time scan
+    38. Empty range
+    39. End past the bitmap
+    40. Fail, NULL
+
+    size_t bitmap_ffs_range(const bitmap_t *const bitmap, const size_t start, const size_t end);
+    void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t end);
+    void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t end);
+    41. Normal, every start/end against a bit-at-a-time scan
+    42. Set/reset every start/end, nothing outside the range changes
+    43. Fail, NULL
+
+    bool bitmap_test_and_set_atomic(bitmap_t *const bitmap, const size_t bit);
+    bool bitmap_test_and_reset_atomic(bitmap_t *const bitmap, const size_t bit);
+    size_t bitmap_ffz_claim_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+    size_t bitmap_ffs_reset_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+    size_t bitmap_claim_range_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+    size_t bitmap_reset_range_atomic(bitmap_t *const bitmap, const size_t start, const size_t end);
+    44. Test and set/reset every bit, byte-only tails and overlays that don't start on a word
+    45. Claims match ffz + set, resets match ffs + reset, every start/end
+    46. Claim range stops at the first set bit, reset range counts what it cleared
+    47. Threads claiming the same bitmap never get the same bit
+    48. Fail, NULL
 */
 
 bool memcmp_fixed(const uint8_t *const data, uint8_t fixed_value, size_t nbytes) {
@@ -121,6 +152,10 @@ void bitmap_test_b();
 
 void bitmap_test_c();
 
+void bitmap_test_d();
+
+void bitmap_test_e();
+
 int main() {
     // EVERYTHING ELSE
     bitmap_test_a();
@@ -131,6 +166,12 @@ int main() {
     // OVERLAY INVERT TOTAL_SET
     bitmap_test_c();
 
+    // FFS/FFZ KERNELS
+    bitmap_test_d();
+
+    // ATOMICS
+    bitmap_test_e();
+
     // Done. GO TEAM!
 
     puts("TESTS PASSED");
@@ -626,3 +667,278 @@ void bitmap_test_c() {
     assert(bitmap_a);
     assert(bitmap_total_set(bitmap_a) == 35);
 }
+
+// The slow way, which is what ffs/ffz used to be
+size_t reference_scan(const bitmap_t *const bitmap, bool value) {
+    for (size_t i = 0; i < bitmap->bit_count; ++i) {
+        if (bitmap_test(bitmap, i) == value) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+// Count set bits if counting, otherwise find the first zero
+size_t reference_range(const bitmap_t *const bitmap, size_t start, size_t end, bool counting) {
+    size_t total = 0;
+    for (; start < end; ++start) {
+        if (bitmap_test(bitmap, start)) {
+            ++total;
+        } else if (!counting) {
+            return start;
+        }
+    }
+    return counting ? total : SIZE_MAX;
+}
+
+size_t scan_bytes(const uint8_t *const data, const size_t byte_count, const uint8_t fill) {
+    return scan_bytes_from(data, byte_count, fill, 0);
+}
+
+void bitmap_test_d() {
+    scan_kernel_t kernels[4] = {scan_bytes, scan_words, NULL, NULL};
+#ifdef BITMAP_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[2] = scan_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[3] = scan_avx2;
+    }
+#endif
+    // Big enough to go through every kernel's wide loop and its tail
+    const size_t test_bit_count = 1029;
+    bitmap_t *bitmap_a = bitmap_create(test_bit_count);
+    assert(bitmap_a);
+
+    // 35
+    for (size_t hit = 0; hit < test_bit_count; ++hit) {
+        bitmap_format(bitmap_a, 0xFF);
+        bitmap_reset(bitmap_a, hit);
+        for (int k = 0; k < 4; ++k) {
+            if (kernels[k]) {
+                assert(kernels[k](bitmap_a->data, bitmap_a->byte_count, 0xFF) == hit);
+            }
+        }
+        assert(bitmap_ffz(bitmap_a) == reference_scan(bitmap_a, false));
+
+        bitmap_invert(bitmap_a);
+        for (int k = 0; k < 4; ++k) {
+            if (kernels[k]) {
+                assert(kernels[k](bitmap_a->data, bitmap_a->byte_count, 0x00) == hit);
+            }
+        }
+        assert(bitmap_ffs(bitmap_a) == reference_scan(bitmap_a, true));
+    }
+
+    // Shorter maps so the wide loops get skipped entirely sometimes
+    srand(0xB17);
+    for (size_t bits = 1; bits < 300; ++bits) {
+        bitmap_t *bitmap_b = bitmap_create(bits);
+        assert(bitmap_b);
+        bitmap_format(bitmap_b, 0xFF);
+        for (size_t i = 0; i < bits; ++i) {
+            if (rand() % 64 == 0) {
+                bitmap_reset(bitmap_b, i);
+            }
+        }
+        // 36
+        // Clear the padding so the kernels can see a zero out there, ffz still shouldn't report it
+        bitmap_b->data[bitmap_b->byte_count - 1] &= mask_down_inclusive[(bits - 1) & 0x07];
+        for (int k = 0; k < 4; ++k) {
+            if (kernels[k]) {
+                assert(kernels[k](bitmap_b->data, bitmap_b->byte_count, 0xFF) == reference_scan(bitmap_b, false) ||
+                       (reference_scan(bitmap_b, false) == SIZE_MAX &&
+                        kernels[k](bitmap_b->data, bitmap_b->byte_count, 0xFF) >= bits));
+            }
+        }
+        assert(bitmap_ffz(bitmap_b) == reference_scan(bitmap_b, false));
+        assert(bitmap_ffs(bitmap_b) == reference_scan(bitmap_b, true));
+        bitmap_destroy(bitmap_b);
+    }
+
+    // 37
+    bitmap_t *bitmap_c = bitmap_create(200);
+    assert(bitmap_c);
+    for (size_t i = 0; i < 200; ++i) {
+        if (rand() % 3) {
+            bitmap_set(bitmap_c, i);
+        }
+    }
+    for (size_t start = 0; start < 200; ++start) {
+        for (size_t end = start + 1; end <= 200; ++end) {
+            assert(bitmap_ffz_range(bitmap_c, start, end) == reference_range(bitmap_c, start, end, false));
+            assert(bitmap_total_set_range(bitmap_c, start, end) == reference_range(bitmap_c, start, end, true));
+        }
+    }
+    // 41
+    // first set in the original is first zero in the inverse
+    bitmap_t *bitmap_d = bitmap_import(200, bitmap_c->data);
+    assert(bitmap_d);
+    bitmap_invert(bitmap_d);
+    for (size_t start = 0; start < 200; ++start) {
+        for (size_t end = start + 1; end <= 200; ++end) {
+            assert(bitmap_ffs_range(bitmap_c, start, end) == reference_range(bitmap_d, start, end, false));
+        }
+    }
+    bitmap_destroy(bitmap_d);
+    // 38
+    assert(bitmap_ffz_range(bitmap_c, 50, 50) == SIZE_MAX);
+    assert(bitmap_total_set_range(bitmap_c, 50, 50) == 0);
+    // 39
+    assert(bitmap_ffz_range(bitmap_c, 0, SIZE_MAX) == bitmap_ffz(bitmap_c));
+    assert(bitmap_total_set_range(bitmap_c, 0, SIZE_MAX) == bitmap_total_set(bitmap_c));
+    // 40
+    assert(bitmap_ffz_range(NULL, 0, 10) == SIZE_MAX);
+    assert(bitmap_total_set_range(NULL, 0, 10) == 0);
+
+    // 42
+    for (size_t start = 0; start < 200; start += 3) {
+        for (size_t end = start; end <= 200; end += 5) {
+            bitmap_format(bitmap_c, 0x00);
+            bitmap_set_range(bitmap_c, start, end);
+            assert(bitmap_total_set(bitmap_c) == end - start);
+            assert(bitmap_total_set_range(bitmap_c, start, end) == end - start);
+
+            bitmap_format(bitmap_c, 0xFF);
+            bitmap_reset_range(bitmap_c, start, end);
+            assert(bitmap_total_set(bitmap_c) == 200 - (end - start));
+            assert(bitmap_total_set_range(bitmap_c, start, end) == 0);
+        }
+    }
+    // 43
+    bitmap_set_range(NULL, 0, 10);
+    bitmap_reset_range(NULL, 0, 10);
+    assert(bitmap_ffs_range(NULL, 0, 10) == SIZE_MAX);
+    bitmap_destroy(bitmap_c);
+
+    bitmap_destroy(bitmap_a);
+}
+
+#define CLAIM_THREADS 4
+#define CLAIM_BITS 100003
+
+// Claims bits until there are none left, counting each one in claimed
+static void *claim_worker(void *arg) {
+    bitmap_t *const bitmap = ((void **) arg)[0];
+    uint8_t *const claimed = ((void **) arg)[1];
+    for (size_t bit; (bit = bitmap_ffz_claim_atomic(bitmap, 0, SIZE_MAX)) != SIZE_MAX;) {
+        __atomic_fetch_add(&claimed[bit], 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+void bitmap_test_e() {
+    // 44
+    // One byte in, so the front and back both fall back to bytes
+    uint8_t backing[40] = {0};
+    bitmap_t *bitmap_a = bitmap_overlay(300, backing + 1);
+    assert(bitmap_a);
+    for (size_t bit = 0; bit < 300; ++bit) {
+        assert(!bitmap_test_and_set_atomic(bitmap_a, bit));
+        assert(bitmap_test(bitmap_a, bit));
+        assert(bitmap_test_and_set_atomic(bitmap_a, bit));
+        assert(bitmap_total_set(bitmap_a) == bit + 1);
+    }
+    for (size_t bit = 0; bit < 300; ++bit) {
+        assert(bitmap_test_and_reset_atomic(bitmap_a, bit));
+        assert(!bitmap_test(bitmap_a, bit));
+        assert(!bitmap_test_and_reset_atomic(bitmap_a, bit));
+    }
+    assert(backing[0] == 0 && backing[39] == 0);
+
+    // 45
+    srand(0xA70);
+    bitmap_t *bitmap_b = bitmap_create(200);
+    bitmap_t *bitmap_c = bitmap_create(200);
+    assert(bitmap_b && bitmap_c);
+    for (size_t i = 0; i < 200; ++i) {
+        if (rand() % 3) {
+            bitmap_set(bitmap_b, i);
+        }
+    }
+    for (size_t start = 0; start < 200; ++start) {
+        for (size_t end = start; end <= 201; ++end) {
+            memcpy(bitmap_c->data, bitmap_b->data, bitmap_b->byte_count);
+            const size_t expect = bitmap_ffz_range(bitmap_c, start, end);
+            assert(bitmap_ffz_claim_atomic(bitmap_c, start, end) == expect);
+            if (expect != SIZE_MAX) {
+                assert(bitmap_test(bitmap_c, expect));
+                assert(bitmap_total_set(bitmap_c) == bitmap_total_set(bitmap_b) + 1);
+            }
+        }
+    }
+    // Claims come out in order and run out at the end
+    bitmap_format(bitmap_c, 0x00);
+    for (size_t bit = 0; bit < 200; ++bit) {
+        assert(bitmap_ffz_claim_atomic(bitmap_c, 0, 200) == bit);
+    }
+    assert(bitmap_ffz_claim_atomic(bitmap_c, 0, 200) == SIZE_MAX);
+    for (size_t start = 0; start < 200; ++start) {
+        for (size_t end = start; end <= 201; ++end) {
+            memcpy(bitmap_c->data, bitmap_b->data, bitmap_b->byte_count);
+            const size_t expect = bitmap_ffs_range(bitmap_c, start, end);
+            assert(bitmap_ffs_reset_atomic(bitmap_c, start, end) == expect);
+            if (expect != SIZE_MAX) {
+                assert(!bitmap_test(bitmap_c, expect));
+                assert(bitmap_total_set(bitmap_c) == bitmap_total_set(bitmap_b) - 1);
+            }
+        }
+    }
+    // Resets come out in order too
+    bitmap_format(bitmap_c, 0xFF);
+    for (size_t bit = 0; bit < 200; ++bit) {
+        assert(bitmap_ffs_reset_atomic(bitmap_c, 0, 200) == bit);
+    }
+    assert(bitmap_ffs_reset_atomic(bitmap_c, 0, 200) == SIZE_MAX);
+
+    // 46
+    for (size_t start = 0; start < 200; start += 3) {
+        for (size_t end = start; end <= 200; end += 7) {
+            memcpy(bitmap_c->data, bitmap_b->data, bitmap_b->byte_count);
+            size_t stop = bitmap_ffs_range(bitmap_b, start, end);
+            stop = stop == SIZE_MAX ? end : stop;
+            assert(bitmap_claim_range_atomic(bitmap_c, start, end) == stop);
+            assert(bitmap_total_set_range(bitmap_c, start, stop) == stop - start);
+            assert(bitmap_total_set(bitmap_c) == bitmap_total_set(bitmap_b) + (stop - start));
+
+            memcpy(bitmap_c->data, bitmap_b->data, bitmap_b->byte_count);
+            assert(bitmap_reset_range_atomic(bitmap_c, start, end) == bitmap_total_set_range(bitmap_b, start, end));
+            assert(bitmap_total_set_range(bitmap_c, start, end) == 0);
+            assert(bitmap_total_set(bitmap_c) ==
+                   bitmap_total_set(bitmap_b) - bitmap_total_set_range(bitmap_b, start, end));
+        }
+    }
+    bitmap_format(bitmap_c, 0x00);
+    assert(bitmap_claim_range_atomic(bitmap_c, 10, SIZE_MAX) == 200);
+    assert(bitmap_reset_range_atomic(bitmap_c, 0, SIZE_MAX) == 190);
+
+    // 47
+    bitmap_t *bitmap_d = bitmap_create(CLAIM_BITS);
+    uint8_t *claimed = (uint8_t *) calloc(CLAIM_BITS, 1);
+    assert(bitmap_d && claimed);
+    void *args[2] = {bitmap_d, claimed};
+    pthread_t threads[CLAIM_THREADS];
+    int started = 0;
+    for (int t = 0; t < CLAIM_THREADS; ++t) {
+        started += pthread_create(&threads[t], NULL, claim_worker, args) == 0;
+    }
+    assert(started == CLAIM_THREADS);
+    for (int t = 0; t < started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    assert(memcmp_fixed(claimed, 1, CLAIM_BITS));
+    assert(bitmap_total_set(bitmap_d) == CLAIM_BITS);
+    free(claimed);
+    bitmap_destroy(bitmap_d);
+
+    // 48
+    assert(bitmap_ffz_claim_atomic(NULL, 0, 10) == SIZE_MAX);
+    assert(bitmap_ffs_reset_atomic(NULL, 0, 10) == SIZE_MAX);
+    assert(bitmap_claim_range_atomic(NULL, 0, 10) == SIZE_MAX);
+    assert(bitmap_reset_range_atomic(NULL, 0, 10) == 0);
+
+    bitmap_destroy(bitmap_c);
+    bitmap_destroy(bitmap_b);
+    bitmap_destroy(bitmap_a);
+}
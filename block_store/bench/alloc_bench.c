@@ -0,0 +1,115 @@
+#include "block_store.h"
+
+#include <bitmap.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Same shape as the real thing
+#define BENCH_BLOCKS 65536
+#define BENCH_RESERVED 16
+
+// Files are allocated one block at a time like fs_write does
+// Every block handed out is logged so files can be released again
+typedef struct {
+    unsigned blocks[BENCH_BLOCKS];
+    size_t block_count;
+    size_t file_start[BENCH_BLOCKS];
+    size_t file_count;
+} ledger_t;
+
+// The old way: ffz from bit 0 every time
+static bitmap_t *first_fit_fbm;
+
+static unsigned first_fit_allocate(void) {
+    size_t block = bitmap_ffz(first_fit_fbm);
+    if (block == SIZE_MAX) {
+        return 0;
+    }
+    bitmap_set(first_fit_fbm, block);
+    return block;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    double seconds;
+    size_t allocations;
+    size_t contiguous;  // allocations that were previous + 1 within the same file
+} phase_t;
+
+// Fill file-by-file until the device runs dry
+static phase_t fill(block_store_t *const bs, ledger_t *const ledger, unsigned seed) {
+    phase_t phase = {0, 0, 0};
+    srand(seed);
+    ledger->block_count = ledger->file_count = 0;
+    const double start = now_sec();
+    for (bool full = false; !full;) {
+        const unsigned want = 1 + rand() % 64;
+        ledger->file_start[ledger->file_count++] = ledger->block_count;
+        for (unsigned got = 0; got < want; ++got) {
+            unsigned block = bs ? block_store_allocate(bs) : first_fit_allocate();
+            if (!block) {
+                full = true;
+                break;
+            }
+            phase.contiguous += (got && block == ledger->blocks[ledger->block_count - 1] + 1);
+            ledger->blocks[ledger->block_count++] = block;
+            ++phase.allocations;
+        }
+    }
+    phase.seconds = now_sec() - start;
+    return phase;
+}
+
+// Delete every other file, leaving file-sized holes all over the device
+static void punch(block_store_t *const bs, const ledger_t *const ledger) {
+    for (size_t file = 0; file < ledger->file_count; file += 2) {
+        size_t end = file + 1 < ledger->file_count ? ledger->file_start[file + 1] : ledger->block_count;
+        for (size_t i = ledger->file_start[file]; i < end; ++i) {
+            if (bs) {
+                block_store_release(bs, ledger->blocks[i]);
+            } else {
+                bitmap_reset(first_fit_fbm, ledger->blocks[i]);
+            }
+        }
+    }
+}
+
+static void report(const char *const name, const phase_t phase) {
+    printf("%-26s %8zu allocs %12.0f allocs/sec %6.1f%% contiguous\n", name, phase.allocations,
+           phase.allocations / phase.seconds, phase.allocations ? 100.0 * phase.contiguous / phase.allocations : 0.0);
+}
+
+int main(void) {
+    static ledger_t ledger;
+
+    block_store_t *bs = block_store_create("alloc_bench.bs");
+    first_fit_fbm = bitmap_create(BENCH_BLOCKS);
+    if (!bs || !first_fit_fbm) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    for (unsigned i = 0; i < BENCH_RESERVED; ++i) {
+        bitmap_set(first_fit_fbm, i);
+    }
+
+    report("first-fit, empty -> full", fill(NULL, &ledger, 42));
+    punch(NULL, &ledger);
+    report("first-fit, refill holes", fill(NULL, &ledger, 7));
+
+    report("next-fit, empty -> full", fill(bs, &ledger, 42));
+    punch(bs, &ledger);
+    report("next-fit, refill holes", fill(bs, &ledger, 7));
+
+    bitmap_destroy(first_fit_fbm);
+    block_store_close(bs);
+    remove("alloc_bench.bs");
+    return 0;
+}
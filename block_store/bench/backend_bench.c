@@ -0,0 +1,117 @@
+#include "block_store.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 256 MB of 512 byte blocks, sequential access moves 1 MB at a time
+#define BENCH_BLOCKS (512 * 1024)
+#define BENCH_BLOCK_SIZE 512
+#define RUN_BLOCKS 2048
+#define RUN_BYTES (RUN_BLOCKS * BENCH_BLOCK_SIZE)
+#define RANDOM_OPS 200000
+// Small enough to stay in the pread cache
+#define HOT_BLOCKS 2048
+
+typedef enum { RANDOM_READ, HOT_READ, RANDOM_WRITE, STREAM_READ, STREAM_WRITE, WORKLOADS } workload_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift, rand() is slow enough to show up next to a 512 byte memcpy
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// MB/s for one workload, negative if anything failed
+static double run(block_store_t *bs, const workload_t workload, uint8_t *buffer, unsigned *ids) {
+    const unsigned first = block_store_get_data_start(bs);
+    const unsigned span = BENCH_BLOCKS - first;
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    size_t moved = 0;
+    const double start = now_sec();
+    if (workload == STREAM_READ || workload == STREAM_WRITE) {
+        struct iovec iov = {buffer, RUN_BYTES};
+        for (unsigned block = first; block + RUN_BLOCKS <= BENCH_BLOCKS; block += RUN_BLOCKS) {
+            for (unsigned b = 0; b < RUN_BLOCKS; ++b) {
+                ids[b] = block + b;
+            }
+            const size_t done = workload == STREAM_READ ? block_store_readv(bs, ids, RUN_BLOCKS, &iov, 1)
+                                                        : block_store_writev(bs, ids, RUN_BLOCKS, &iov, 1);
+            if (done != RUN_BLOCKS) {
+                return -1;
+            }
+            moved += RUN_BYTES;
+        }
+    } else {
+        for (int op = 0; op < RANDOM_OPS; ++op) {
+            const unsigned block = first + next_random(&state) % (workload == HOT_READ ? HOT_BLOCKS : span);
+            const bool done = workload == RANDOM_WRITE ? block_store_write(bs, block, buffer)
+                                                       : block_store_read(bs, block, buffer);
+            if (!done) {
+                return -1;
+            }
+            moved += BENCH_BLOCK_SIZE;
+        }
+    }
+    return moved / 1e6 / (now_sec() - start);
+}
+
+int main(void) {
+    const char *image = "backend_bench.bs";
+    uint8_t *buffer = malloc(RUN_BYTES);
+    unsigned *ids = malloc(sizeof(unsigned) * RUN_BLOCKS);
+    if (!buffer || !ids) {
+        return 1;
+    }
+    for (size_t i = 0; i < RUN_BYTES; ++i) {
+        buffer[i] = (uint8_t)(i * 31);
+    }
+    block_store_t *bs = block_store_create_geometry(image, BENCH_BLOCK_SIZE, BENCH_BLOCKS);
+    // Fill it once, so neither backend is reading holes
+    if (!bs || run(bs, STREAM_WRITE, buffer, ids) < 0 || !block_store_sync(bs)) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    block_store_close(bs);
+
+    const char *backends[] = {"mmap", "pread"};
+    const char *workloads[WORKLOADS] = {"random 512", "hot 512", "rand write", "seq 1M read", "seq 1M write"};
+    printf("%-8s", "MB/s");
+    for (int w = 0; w < WORKLOADS; ++w) {
+        printf(" %12s", workloads[w]);
+    }
+    printf("\n");
+    for (int b = 0; b < 2; ++b) {
+        bs = block_store_open_backend(image, (block_store_backend_t) b, 0);
+        if (!bs) {
+            fprintf(stderr, "%s open failed\n", backends[b]);
+            return 1;
+        }
+        printf("%-8s", backends[b]);
+        for (int w = 0; w < WORKLOADS; ++w) {
+            const double rate = run(bs, (workload_t) w, buffer, ids);
+            if (rate < 0) {
+                fprintf(stderr, "\n%s %s failed\n", backends[b], workloads[w]);
+                return 1;
+            }
+            printf(" %12.1f", rate);
+        }
+        printf("\n");
+        block_store_close(bs);
+    }
+
+    free(ids);
+    free(buffer);
+    remove(image);
+    return 0;
+}
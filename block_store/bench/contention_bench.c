@@ -0,0 +1,100 @@
+#include "block_store.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Same shape as the real thing
+#define BENCH_BLOCKS 65536
+#define MAX_THREADS 32
+// Each thread holds a file's worth of blocks at a time, then gives them all back
+#define HELD 64
+#define ROUNDS 2000
+
+// What allocation looked like with one lock around the FBM, for comparison
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    block_store_t *bs;
+    bool locked;
+    size_t failed;
+} worker_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *work(void *arg) {
+    worker_t *worker = arg;
+    unsigned held[HELD];
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < HELD; ++i) {
+            if (worker->locked) {
+                pthread_mutex_lock(&big_lock);
+            }
+            held[i] = block_store_allocate(worker->bs);
+            if (worker->locked) {
+                pthread_mutex_unlock(&big_lock);
+            }
+            worker->failed += !held[i];
+        }
+        for (int i = 0; i < HELD; ++i) {
+            if (worker->locked) {
+                pthread_mutex_lock(&big_lock);
+            }
+            block_store_release(worker->bs, held[i]);
+            if (worker->locked) {
+                pthread_mutex_unlock(&big_lock);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Millions of allocate + release pairs per second across all the threads
+static double run(block_store_t *const bs, const int threads, const bool locked) {
+    pthread_t ids[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    const double start = now_sec();
+    for (int t = 0; t < threads; ++t) {
+        workers[t] = (worker_t){bs, locked, 0};
+        pthread_create(&ids[t], NULL, work, &workers[t]);
+    }
+    size_t failed = 0;
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        failed += workers[t].failed;
+    }
+    const double elapsed = now_sec() - start;
+    return failed ? -1 : (double) threads * ROUNDS * HELD / 1e6 / elapsed;
+}
+
+int main(void) {
+    block_store_t *bs = block_store_create("contention_bench.bs");
+    if (!bs) {
+        return 1;
+    }
+    // Half full, so the scans have something to skip
+    for (unsigned block = 16; block < BENCH_BLOCKS / 2; ++block) {
+        block_store_request(bs, block);
+    }
+
+    printf("%8s %14s %14s\n", "threads", "mutex Mops/s", "atomic Mops/s");
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        const double locked = run(bs, threads, true);
+        const double atomic = run(bs, threads, false);
+        if (locked < 0 || atomic < 0) {
+            fprintf(stderr, "%d threads ran out of blocks\n", threads);
+            return 1;
+        }
+        printf("%8d %14.2f %14.2f\n", threads, locked, atomic);
+    }
+
+    block_store_close(bs);
+    remove("contention_bench.bs");
+    return 0;
+}
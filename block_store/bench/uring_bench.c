@@ -0,0 +1,205 @@
+#include "block_store.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// fio style jobs on a local image that's dropped from the page cache before each one,
+// so reads actually go to the disk like they would for an image bigger than memory
+#define BENCH_BLOCK_SIZE 4096
+#define BENCH_BLOCKS (128 * 1024)
+#define MAX_DEPTH 64
+#define MAX_JOB_BLOCKS 32
+#define TIME_LIMIT 2.0
+
+typedef struct {
+    const char *name;
+    bool write;
+    bool sequential;
+    size_t blocks;  // per request
+    unsigned depth;
+    size_t ops;
+} job_t;
+
+typedef enum { ENGINE_SYNC, ENGINE_QUEUE, ENGINE_URING, ENGINES } engine_t;
+
+// One per request buffer, the callback gets it back
+typedef struct slot slot_t;
+typedef struct {
+    slot_t *free[MAX_DEPTH];
+    unsigned free_count;
+    size_t completed;
+    size_t failed;
+    double latency;
+} stats_t;
+
+struct slot {
+    stats_t *stats;
+    uint8_t *buffer;
+    double start;
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void evict(const char *image) {
+    int fd = open(image, O_RDONLY);
+    if (fd != -1) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void on_done(void *arg, bool ok) {
+    slot_t *slot = arg;
+    slot->stats->completed += 1;
+    slot->stats->failed += !ok;
+    slot->stats->latency += now_sec() - slot->start;
+    slot->stats->free[slot->stats->free_count++] = slot;
+}
+
+// Where the next request goes, first is the first data block
+static unsigned next_block(const job_t *job, unsigned first, uint64_t *state, size_t issued) {
+    const size_t span = (BENCH_BLOCKS - first) / job->blocks;
+    const size_t request = job->sequential ? issued % span : next_random(state) % span;
+    return first + request * job->blocks;
+}
+
+// Runs a job to completion or the time limit, false if any request failed
+static bool run(block_store_t *bs, const job_t *job, const engine_t engine, uint8_t *buffers, stats_t *stats,
+                double *elapsed) {
+    const unsigned first = block_store_get_data_start(bs);
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    slot_t slots[MAX_DEPTH];
+    memset(stats, 0, sizeof(*stats));
+    const unsigned depth = engine == ENGINE_SYNC ? 1 : job->depth;
+    for (unsigned s = 0; s < depth; ++s) {
+        slots[s].stats = stats;
+        slots[s].buffer = buffers + s * MAX_JOB_BLOCKS * BENCH_BLOCK_SIZE;
+        stats->free[stats->free_count++] = &slots[s];
+    }
+
+    size_t issued = 0;
+    const double start = now_sec();
+    while (issued < job->ops && now_sec() - start < TIME_LIMIT) {
+        if (engine == ENGINE_SYNC) {
+            unsigned ids[MAX_JOB_BLOCKS];
+            const unsigned block = next_block(job, first, &state, issued++);
+            for (size_t b = 0; b < job->blocks; ++b) {
+                ids[b] = block + b;
+            }
+            struct iovec iov = {slots[0].buffer, job->blocks * BENCH_BLOCK_SIZE};
+            const double started = now_sec();
+            const size_t done = job->write ? block_store_writev(bs, ids, job->blocks, &iov, 1)
+                                           : block_store_readv(bs, ids, job->blocks, &iov, 1);
+            stats->completed += 1;
+            stats->failed += done != job->blocks;
+            stats->latency += now_sec() - started;
+            continue;
+        }
+        // Keep the queue full, then wait for anything to come back
+        while (stats->free_count && issued < job->ops) {
+            slot_t *slot = stats->free[--stats->free_count];
+            const unsigned block = next_block(job, first, &state, issued++);
+            slot->start = now_sec();
+            const bool queued =
+                job->write ? block_store_write_async(bs, block, job->blocks, slot->buffer, on_done, slot)
+                           : block_store_read_async(bs, block, job->blocks, slot->buffer, on_done, slot);
+            if (!queued) {
+                return false;
+            }
+        }
+        block_store_wait(bs, 1);
+    }
+    block_store_wait(bs, SIZE_MAX);
+    *elapsed = now_sec() - start;
+    return stats->failed == 0;
+}
+
+int main(void) {
+    const char *image = "uring_bench.bs";
+    uint8_t *buffers = malloc((size_t) MAX_DEPTH * MAX_JOB_BLOCKS * BENCH_BLOCK_SIZE);
+    if (!buffers) {
+        return 1;
+    }
+    memset(buffers, 0xA5, (size_t) MAX_DEPTH * MAX_JOB_BLOCKS * BENCH_BLOCK_SIZE);
+
+    // Written out for real, reading holes doesn't touch the disk
+    block_store_t *bs = block_store_create_geometry(image, BENCH_BLOCK_SIZE, BENCH_BLOCKS);
+    if (!bs || !block_store_set_queue_depth(bs, MAX_DEPTH)) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    for (unsigned block = block_store_get_data_start(bs); block + MAX_JOB_BLOCKS <= BENCH_BLOCKS;
+         block += MAX_JOB_BLOCKS) {
+        if (!block_store_write_async(bs, block, MAX_JOB_BLOCKS, buffers, NULL, NULL)) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+    }
+    block_store_wait(bs, SIZE_MAX);
+    if (!block_store_sync(bs)) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    block_store_close(bs);
+
+    const job_t jobs[] = {
+        {"randread", false, false, 1, 1, 20000},   {"randread", false, false, 1, 32, 50000},
+        {"randread", false, false, 16, 16, 10000}, {"read", false, true, 32, 8, 4000},
+        {"randwrite", true, false, 1, 32, 50000},
+    };
+    const char *engines[ENGINES] = {"sync", "queue", "io_uring"};
+
+    printf("image %d MB, %d byte blocks, pread backend, page cache dropped before each job\n",
+           BENCH_BLOCKS / 1024 * BENCH_BLOCK_SIZE / 1024, BENCH_BLOCK_SIZE);
+    printf("%-10s %6s %8s %-9s %10s %10s %12s\n", "job", "bs", "iodepth", "engine", "IOPS", "MiB/s", "lat avg us");
+    for (size_t j = 0; j < sizeof(jobs) / sizeof(jobs[0]); ++j) {
+        for (int e = 0; e < ENGINES; ++e) {
+            // The queue without io_uring is the fallback, requests run one at a time at block_store_wait
+            if (e == ENGINE_QUEUE) {
+                setenv("BLOCK_STORE_NO_URING", "1", 1);
+            } else {
+                unsetenv("BLOCK_STORE_NO_URING");
+            }
+            bs = block_store_open_backend(image, BLOCK_STORE_BACKEND_PREAD, 0);
+            if (!bs || (e != ENGINE_SYNC && !block_store_set_queue_depth(bs, jobs[j].depth))) {
+                fprintf(stderr, "open failed\n");
+                return 1;
+            }
+            const char *engine = e == ENGINE_URING && !block_store_queue_uses_uring(bs) ? "fallback" : engines[e];
+            evict(image);
+            stats_t stats;
+            double elapsed = 0;
+            if (!run(bs, &jobs[j], (engine_t) e, buffers, &stats, &elapsed)) {
+                fprintf(stderr, "%s %s failed\n", jobs[j].name, engine);
+                return 1;
+            }
+            block_store_close(bs);
+            printf("%-10s %5zuk %8u %-9s %10.0f %10.1f %12.1f\n", jobs[j].name,
+                   jobs[j].blocks * BENCH_BLOCK_SIZE / 1024, e == ENGINE_SYNC ? 1 : jobs[j].depth, engine,
+                   stats.completed / elapsed, stats.completed * jobs[j].blocks * BENCH_BLOCK_SIZE / elapsed / 1048576,
+                   stats.latency / stats.completed * 1e6);
+        }
+    }
+
+    free(buffers);
+    remove(image);
+    return 0;
+}
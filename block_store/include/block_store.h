@@ -5,12 +5,36 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
 
 // Back store object
 // It's an opaque object whose implementation is up to you
 // (and implementation DOES NOT go here)
 typedef struct block_store block_store_t;
 
+// Bytes of the file header left for whoever uses the block_store (a file system superblock, say)
+#define BLOCK_STORE_USER_AREA_SIZE 1024
+
+// Hints for how the mapping is going to be used, or them together
+// SEQUENTIAL and RANDOM can't both be given, leaving both out leaves read ahead up to the kernel
+typedef enum {
+    BLOCK_STORE_ADVISE_NORMAL = 0x0,
+    BLOCK_STORE_ADVISE_SEQUENTIAL = 0x1,  // data blocks are streamed, read far ahead and drop pages soon after
+    BLOCK_STORE_ADVISE_RANDOM = 0x2,      // data blocks are touched here and there, fault in only what's used
+    BLOCK_STORE_ADVISE_PREFETCH = 0x4,    // start reading the header and free block map in right away
+    BLOCK_STORE_ADVISE_HUGEPAGE = 0x8     // back the data blocks with transparent huge pages where the kernel can
+} block_store_advice_t;
+
+// How the file is read and written
+typedef enum {
+    BLOCK_STORE_BACKEND_MMAP = 0,  // the whole file is mapped, blocks are copied in and out of the mapping
+    BLOCK_STORE_BACKEND_PREAD = 1  // pread and pwrite on the file, through a cache of recently used blocks
+} block_store_backend_t;
+
+// Called once an async request is done, ok says whether all of it was read or written
+typedef void (*block_store_callback_t)(void *arg, bool ok);
+
 ///
 /// Creates a new block_store file at the specified location
 ///  and returns a block_store object linked to it
@@ -19,6 +43,18 @@ typedef struct block_store block_store_t;
 ///
 block_store_t *block_store_create(const char *const fname);
 
+///
+/// Creates a new block_store file with the given geometry at the specified location
+///  and returns a block_store object linked to it
+///  The free block map takes up as many blocks at the front of the device as it needs
+/// \param fname the file to create
+/// \param block_size bytes per block, a power of two from 512 to 65536
+/// \param block_count number of blocks, up to 2^32, including the ones the free block map uses
+/// \return a pointer to the new object, NULL on error
+///
+block_store_t *block_store_create_geometry(const char *const fname, const size_t block_size,
+                                           const size_t block_count);
+
 ///
 /// Opens the specified block_store file
 ///  and returns a block_store object linked to it
@@ -27,19 +63,117 @@ block_store_t *block_store_create(const char *const fname);
 ///
 block_store_t *block_store_open(const char *const fname);
 
+///
+/// Opens the specified block_store file with access hints for its mapping
+///  The kernel is free to ignore the hints themselves, that doesn't fail the open
+/// \param fname the file to open
+/// \param advice block_store_advice_t flags
+/// \return a pointer to the new object, NULL on error
+///
+block_store_t *block_store_open_advised(const char *const fname, const unsigned advice);
+
+///
+/// Opens the specified block_store file on the given backend
+///  BLOCK_STORE_BACKEND_PREAD keeps only the header and free block map in memory and maps nothing,
+///  so its address space cost doesn't grow with the file. Writes go straight through to the file,
+///  and whole block reads and writes are cached. It has no pointers to hand out, see block_store_get_ptr
+///  block_store_create and the other opens use BLOCK_STORE_BACKEND_MMAP
+/// \param fname the file to open
+/// \param backend which backend to use
+/// \param cache_blocks blocks the pread backend caches, 0 for the default (4096), ignored by mmap
+/// \return a pointer to the new object, NULL on error
+///
+block_store_t *block_store_open_backend(const char *const fname, const block_store_backend_t backend,
+                                        const size_t cache_blocks);
+
+///
+/// Replaces the access hints a block_store's mapping has
+///  The pread backend passes the access pattern to the page cache under the file, and can't take HUGEPAGE
+/// \param bs the block_store to advise
+/// \param advice block_store_advice_t flags
+/// \return bool indicating the kernel took every hint, false on error
+///
+bool block_store_advise(block_store_t *const bs, const unsigned advice);
+
+///
+/// Starts reading a run of blocks in ahead of use, without waiting for it
+///  Meant for whatever the user of the block_store will read through next (an inode table, say)
+/// \param bs the block_store to read into
+/// \param start first block to read in, the free block map's blocks count
+/// \param count number of blocks to read in
+/// \return bool indicating success
+///
+bool block_store_prefetch(block_store_t *const bs, const size_t start, const size_t count);
+
 ///
 /// Closes and frees a block_store object
+///  With the pread backend the header and free block map only live in memory between syncs, they're written back
+///  here but a failure can't be reported. Call block_store_sync and check it before closing, or every allocation
+///  and release since the last sync can be lost without a word. Block data was already written through
 /// \param bs block_store to close
 ///
 void block_store_close(block_store_t *const bs);
 
+///
+/// Gets the size of the blocks in the block_store
+/// \param bs the block_store to inspect
+/// \return bytes per block, 0 on error
+///
+size_t block_store_get_block_size(const block_store_t *const bs);
+
+///
+/// Gets the total number of blocks in the block_store
+/// \param bs the block_store to inspect
+/// \return number of blocks, 0 on error
+///
+size_t block_store_get_block_count(const block_store_t *const bs);
+
+///
+/// Gets the first block id past the free block map, the lowest one that can be allocated
+/// \param bs the block_store to inspect
+/// \return first data block id, 0 on error
+///
+size_t block_store_get_data_start(const block_store_t *const bs);
+
+///
+/// Gets the number of blocks in use, the free block map's own blocks included
+/// \param bs the block_store to inspect
+/// \return number of allocated blocks, 0 on error
+///
+size_t block_store_get_used_blocks(const block_store_t *const bs);
+
+///
+/// Gets the user area of the file header, BLOCK_STORE_USER_AREA_SIZE bytes saved with the file
+///  Files from before the header existed don't have one
+/// \param bs the block_store to look into
+/// \return pointer to the user area, NULL on error or if the file has no header
+///
+void *block_store_get_user_area(block_store_t *const bs);
+
 ///
 /// Allocates a block of storage in the block_store
+///  Allocation is next-fit: it continues after the previously allocated block,
+///  so back-to-back allocations hand out consecutive ids when they're free
+///  Safe to call from several threads at once, along with the other allocate/request/release calls
+///  Each thread keeps its own place, starting in its own part of the device (the first thread at the front)
 /// \param bs the block_store to allocate from
 /// \return id of the allocated block, 0 on error
 ///
 unsigned block_store_allocate(block_store_t *const bs);
 
+///
+/// Allocates a contiguous run of blocks in the block_store
+///  The run is at least min and at most want blocks long, searched next-fit like block_store_allocate
+/// \param bs the block_store to allocate from
+/// \param want the number of blocks desired
+/// \param min the shortest run that is acceptable (1 <= min <= want)
+/// \param start set to the first block id of the run
+/// \param count set to the length of the run
+/// \return bool indicating allocation success
+///
+bool block_store_allocate_extent(block_store_t *const bs, const unsigned want, const unsigned min,
+                                 unsigned *const start, unsigned *const count);
+
 ///
 /// Requests the allocation of a specified block id
 /// \param bs block_store to allocate from
@@ -55,6 +189,15 @@ bool block_store_request(block_store_t *const bs, const unsigned block_id);
 ///
 void block_store_release(block_store_t *const bs, const unsigned block_id);
 
+///
+/// Releases a run of blocks so they may be used later
+///  The whole run must be inside the data blocks, or nothing is released
+/// \param bs block_store object
+/// \param start first block to release
+/// \param count number of blocks to release
+///
+void block_store_release_range(block_store_t *const bs, const unsigned start, const unsigned count);
+
 ///
 /// Reads data from the specified block to the given data buffer
 /// \param bs the object to read from
@@ -73,6 +216,160 @@ bool block_store_read(block_store_t *const bs, const unsigned block_id, void *co
 ///
 bool block_store_write(block_store_t *const bs, const unsigned block_id, const void *const src);
 
+///
+/// Reads a list of blocks into a list of buffers
+///  Blocks are laid end to end across the buffers in order, like readv(2)
+///  Runs of consecutive block ids are copied in one go
+///  Stops early at the first bad block id, or when the buffers can't hold another whole block
+/// \param bs the object to read from
+/// \param block_ids the blocks to read, in order
+/// \param block_count the number of block ids
+/// \param iov the buffers to write to
+/// \param iovcnt the number of buffers
+/// \return number of blocks read
+///
+size_t block_store_readv(block_store_t *const bs, const unsigned *const block_ids, const size_t block_count,
+                         const struct iovec *const iov, const int iovcnt);
+
+///
+/// Writes a list of buffers out to a list of blocks
+///  The buffers are treated as one stream, cut into blocks in order, like writev(2)
+///  Runs of consecutive block ids are copied in one go
+///  Stops early at the first bad block id, or when the buffers don't hold another whole block
+/// \param bs the object to write to
+/// \param block_ids the blocks to write, in order
+/// \param block_count the number of block ids
+/// \param iov the buffers to read from
+/// \param iovcnt the number of buffers
+/// \return number of blocks written
+///
+size_t block_store_writev(block_store_t *const bs, const unsigned *const block_ids, const size_t block_count,
+                          const struct iovec *const iov, const int iovcnt);
+
+///
+/// Flushes a run of blocks out to the file, returning once they're on disk
+///  Writes land in a shared mapping or the page cache, which the kernel writes back whenever it likes,
+///  this is for when that isn't good enough
+///  A run starting at block 0 takes the file header (and user area) along with it
+///  Every block in the run goes, written to or not, and none of them count as dirty afterwards
+/// \param bs the object to flush
+/// \param start first block to flush, the free block map's blocks count
+/// \param count number of blocks to flush
+/// \return bool indicating success
+///
+bool block_store_flush(block_store_t *const bs, const size_t start, const size_t count);
+
+///
+/// Flushes every block written since it was last synced or flushed, returning once they're on disk
+///  Blocks are tracked as block_store_write, block_store_writev and block_store_get_ptr_mut hand them out,
+///  and only the pages under them are written back, neighbouring ones together
+///  The file header and free block map always go along
+/// \param bs the object to sync
+/// \return bool indicating success
+///
+bool block_store_sync(block_store_t *const bs);
+
+///
+/// Flushes the blocks in a run that were written since they were last synced or flushed
+///  Same as block_store_sync, but nothing outside the run: the free block map's blocks only go if they're in it,
+///  and the file header only with block 0
+/// \param bs the object to sync
+/// \param start first block to sync
+/// \param count number of blocks to sync
+/// \return bool indicating success
+///
+bool block_store_sync_range(block_store_t *const bs, const size_t start, const size_t count);
+
+///
+/// Gets a read-only pointer straight into the specified block
+///  No copy is made; the pointer stays valid until the block_store is closed
+///  and covers exactly one block, reading past it is undefined
+/// \param bs the object to look into
+/// \param block_id the block to point at
+/// \return pointer to the block's data, NULL on error or if the backend doesn't keep blocks in memory (pread)
+///
+const void *block_store_get_ptr(const block_store_t *const bs, const unsigned block_id);
+
+///
+/// Gets a writable pointer straight into the specified block
+///  Same rules as block_store_get_ptr, writes through it land in the block directly
+///  The block is marked written when the pointer is handed out, so writes through it should be done before it's next synced
+/// \param bs the object to look into
+/// \param block_id the block to point at
+/// \return pointer to the block's data, NULL on error
+///
+void *block_store_get_ptr_mut(block_store_t *const bs, const unsigned block_id);
+
+///
+/// Sets up a queue for async reads and writes, depth of them can be outstanding at once
+///  Requests go to the kernel through io_uring, as many as are queued in one submission.
+///  Where io_uring isn't available (an old kernel, a sandbox that blocks it, or BLOCK_STORE_NO_URING
+///  set in the environment) the queue still works, block_store_wait just runs the requests itself
+///  Requests still queued on an old queue are waited for first. Works with either backend
+/// \param bs the block_store to queue requests on
+/// \param depth most requests outstanding at once, up to 4096, 0 to take the queue down
+/// \return bool indicating success
+///
+bool block_store_set_queue_depth(block_store_t *const bs, const unsigned depth);
+
+///
+/// Gets the depth of a block_store's async queue
+/// \param bs the block_store to inspect
+/// \return the queue depth, 0 if there's no queue or on error
+///
+unsigned block_store_get_queue_depth(const block_store_t *const bs);
+
+///
+/// Finds out whether a block_store's async queue goes through io_uring or runs requests synchronously
+/// \param bs the block_store to inspect
+/// \return bool indicating io_uring is in use, false on error
+///
+bool block_store_queue_uses_uring(block_store_t *const bs);
+
+///
+/// Queues a read of a run of blocks into a buffer
+///  Nothing goes to the kernel until block_store_wait, unless the queue is full, in which case
+///  this waits for a request to finish first (and runs its callback) to make room
+///  dst belongs to the request until its callback has run, and requests aren't ordered with respect to each other
+///  or to synchronous calls on the same blocks
+/// \param bs the object to read from
+/// \param block_id the first block to read
+/// \param count the number of blocks to read
+/// \param dst the buffer to read into, count blocks long
+/// \param done called when the read is done, from whichever thread reaps it, can be NULL
+///  Callbacks run with the queue locked and must not queue or wait on this block_store themselves
+/// \param arg passed to done
+/// \return bool indicating the read was queued, false on error or without a queue
+///
+bool block_store_read_async(block_store_t *const bs, const unsigned block_id, const size_t count, void *const dst,
+                            const block_store_callback_t done, void *const arg);
+
+///
+/// Queues a write of a buffer out to a run of blocks
+///  Same as block_store_read_async, the other way. The blocks count as written once the callback runs
+/// \param bs the object to write to
+/// \param block_id the first block to write
+/// \param count the number of blocks to write
+/// \param src the buffer to write, count blocks long
+/// \param done called when the write is done, can be NULL
+/// \param arg passed to done
+/// \return bool indicating the write was queued, false on error or without a queue
+///
+bool block_store_write_async(block_store_t *const bs, const unsigned block_id, const size_t count,
+                             const void *const src, const block_store_callback_t done, void *const arg);
+
+///
+/// Submits every queued request and waits for at least min of them to finish, running their callbacks
+///  Safe to call from several threads, any request can be reaped by any of them.
+///  It doesn't wait for more than is outstanding, so SIZE_MAX waits for everything and 0 just submits
+///  If io_uring fails outright, every outstanding request is finished (the unsubmitted ones synchronously)
+///  before this returns, and the queue runs requests synchronously from then on
+/// \param bs the block_store whose queue to wait on
+/// \param min requests to wait for
+/// \return number of requests finished, fewer than min only if nothing's left outstanding
+///
+size_t block_store_wait(block_store_t *const bs, const size_t min);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,34 +1,199 @@
+// MADV_HUGEPAGE and madvise are Linux's, not POSIX, the rest of the hints go through posix_madvise
+#define _DEFAULT_SOURCE
+
 #include "block_store.h"
 
 #include <bitmap.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+// io_uring goes through the raw syscalls, so all it takes is the kernel's header
+// Without it the async queue runs its requests synchronously, same as it does when the kernel says no
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_URING 1
+// linux/fs.h comes along and has its own idea of a block size
+#undef BLOCK_SIZE
+#endif
+#endif
+
+// Geometry block_store_create uses, and the only one headerless files can have
 #define BLOCK_COUNT 65536
 #define BLOCK_SIZE 512
-#define FBM_BLOCK_COUNT 16
-#define BYTE_TOTAL ((BLOCK_COUNT) * (BLOCK_SIZE))
-#define DATA_BLOCK_BYTE_TOTAL ((65536 - (FBM_BLOCK_COUNT)) * (BLOCK_SIZE))
-#define FBM_BYTE_TOTAL ((BLOCK_SIZE) * (FBM_BLOCK_COUNT))
-#define DATA_BLOCK_START (FBM_BLOCK_COUNT)
+#define LEGACY_BYTE_TOTAL ((size_t)(BLOCK_COUNT) * (BLOCK_SIZE))
+
+#define MIN_BLOCK_SIZE 512
+#define MAX_BLOCK_SIZE 65536
+#define MAX_BLOCK_COUNT ((size_t) 1 << 32)
+
+// Files start with a page of header, so the blocks after it stay page aligned in the mapping
+#define HEADER_SIZE 4096
+#define HEADER_MAGIC 0x3153424Bu  // "KBS1"
+#define USER_AREA_OFFSET (HEADER_SIZE - BLOCK_STORE_USER_AREA_SIZE)
+
+// Allocation summary granularity. One 512 byte FBM block's worth of bits.
+#define CHUNK_BITS 4096
+
+// Threads get their own next-fit cursor, each starting in its own part of the device,
+// so concurrent allocations aren't all fighting over the same FBM word
+#define ALLOC_REGIONS 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint64_t block_count;
+} header_t;
+
+// Where the blocks live. mmap maps the whole file and copies in and out of the mapping,
+// pread keeps just the header and FBM in memory and goes to the file for the rest, through a block cache
+// Either way the header and FBM are in front, which is all the code outside the backends touches directly
+typedef struct {
+    bool (*open)(block_store_t *bs, bool init, size_t cache_blocks);  // sets up front
+    void (*close)(block_store_t *bs);
+    // Moves length bytes between buffer and the data blocks, offset counts from the start of block 0
+    bool (*copy)(block_store_t *bs, size_t offset, uint8_t *buffer, size_t length, bool to_blocks);
+    uint8_t *(*pointer)(const block_store_t *bs, size_t block);  // NULL if blocks aren't kept in memory
+    bool (*flush)(block_store_t *bs, size_t start, size_t end);  // every block in [start, end)
+    bool (*sync)(block_store_t *bs, size_t start, size_t end);   // FBM blocks and dirty data blocks in [start, end)
+    bool (*advise)(block_store_t *bs, unsigned advice);          // the access pattern and huge pages, not prefetch
+    bool (*prefetch)(block_store_t *bs, size_t start, size_t end);
+} backend_t;
+
+// pread's block cache is set associative: a block can only go in set block % set count,
+// taking the way in it that went longest without being used
+#define CACHE_WAYS 8
+#define DEFAULT_CACHE_BLOCKS 4096
+#define EMPTY_WAY SIZE_MAX
+
+typedef struct {
+    pthread_mutex_t lock;  // one per set, threads working in different sets don't wait on each other
+    uint64_t clock;
+    size_t blocks[CACHE_WAYS];  // EMPTY_WAY when there's nothing in it
+    uint64_t used[CACHE_WAYS];  // clock at the way's last use, 0 for empty ones so they go first
+} cache_set_t;
 
+// Most requests block_store_set_queue_depth lets be queued at once
+#define MAX_QUEUE_DEPTH 4096
+
+// An async request, from block_store_read_async or block_store_write_async until its callback has run
+typedef struct {
+    struct iovec iov;  // the caller's buffer, io_uring reads and writes it with READV/WRITEV
+    size_t block;
+    size_t count;
+    block_store_callback_t done;
+    void *arg;
+    bool write;
+    bool queued;  // no io_uring, waiting for block_store_wait to run it
+} request_t;
+
+// The parts of an io_uring the kernel shares with us
+typedef struct {
+    int fd;  // -1 when there's no ring, and requests run synchronously
+#ifdef HAVE_URING
+    uint8_t *sq_ring;
+    uint8_t *cq_ring;  // the same mapping as sq_ring on kernels that allow it
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+#endif
+} ring_t;
 
 struct block_store {
     int fd;
+    const backend_t *backend;
     bitmap_t *fbm;
-    uint8_t *data_blocks;
+    uint8_t *front;       // header and FBM blocks
+    size_t header_size;   // 0 for headerless files
+    size_t file_size;
+    uint8_t *user_area;   // NULL for headerless files
+    size_t block_size;
+    size_t block_count;
+    size_t data_start;  // first block after the FBM
+    size_t page_size;
+    unsigned advice;
+    // Blocks written since they were last synced, set after the write lands so a sync running
+    // alongside it either catches the data or leaves the bit for the next one
+    bitmap_t *dirty;
+    // Next-fit: allocation picks up where the last one left off
+    // so it doesn't rescan the full front of the device every time
+    // One per region, a thread only ever uses its own (see thread_region)
+    size_t cursors[ALLOC_REGIONS];
+    // Free blocks in each chunk, so full chunks get skipped without touching the FBM
+    size_t chunk_count;
+    uint16_t *chunk_free;
+    // Allocation and release are lock-free: FBM bits are claimed with the bitmap's atomic functions,
+    // and the chunk counts and cursors are only touched atomically. They can lag the FBM for a moment, that's fine,
+    // the FBM has the final say. Block data isn't covered, callers keep two threads off the same block themselves
+
+    // mmap only, the whole file. front is the start of it
+    uint8_t *mapping;
+
+    // pread only. front is a copy of the file's, read in at open and written back at sync, flush and close
+    // Writes go straight through to the file, so a cached block is never newer than the file's,
+    // and cached has a bit for each block in the cache so writes that skip it can find the copies they made stale
+    size_t cache_sets;
+    cache_set_t *sets;
+    uint8_t *cache_data;  // CACHE_WAYS blocks per set
+    bitmap_t *cached;
+
+    // Async requests, once block_store_set_queue_depth has set a queue up. Everything past queue_depth
+    // is behind async_lock, and callbacks run under it, which is why they can't queue more requests
+    pthread_mutex_t async_lock;
+    unsigned queue_depth;  // 0 without a queue, read atomically so it can be checked without the lock
+    request_t *requests;   // queue_depth of them
+    unsigned *free_requests;  // indexes of unused requests, free_count of them
+    unsigned free_count;
+    unsigned unsubmitted;  // queued, the kernel hasn't been told yet
+    unsigned in_flight;    // submitted, not reaped yet
+    ring_t ring;
 };
 
-int create_file(const char *const fname) {
+// Which cursor the calling thread uses. Threads are numbered as they first allocate,
+// so a program that only ever allocates from one thread gets region 0 and plain next-fit
+static __thread size_t thread_slot;  // region + 1, 0 until the thread's first allocation
+static size_t next_slot;
+
+static size_t thread_region(void) {
+    if (!thread_slot) {
+        thread_slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % ALLOC_REGIONS + 1;
+    }
+    return thread_slot - 1;
+}
+
+// Blocks the FBM itself takes up at the front of the device
+static size_t fbm_blocks(const size_t block_size, const size_t block_count) {
+    return ((block_count + 7) / 8 + block_size - 1) / block_size;
+}
+
+static bool valid_geometry(const size_t block_size, const size_t block_count) {
+    return block_size >= MIN_BLOCK_SIZE && block_size <= MAX_BLOCK_SIZE && (block_size & (block_size - 1)) == 0 &&
+           block_count <= MAX_BLOCK_COUNT && block_count > fbm_blocks(block_size, block_count);
+}
+
+int create_file(const char *const fname, const size_t byte_total) {
     if (fname) {
         int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
         if (fd != -1) {
-            if (ftruncate(fd, BYTE_TOTAL) != -1) {
+            if (ftruncate(fd, byte_total) != -1) {
                 return fd;
             }
             close(fd);
@@ -36,13 +201,31 @@ int create_file(const char *const fname) {
     }
     return -1;
 }
-int check_file(const char *const fname) {
+
+// Opens an existing file and works out its geometry, from the header or from the size of a headerless one
+int check_file(const char *const fname, size_t *const block_size, size_t *const block_count,
+               size_t *const header_size) {
     if (fname) {
         int fd = open(fname, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
         if (fd != -1) {
             struct stat file_info;
-            if (fstat(fd, &file_info) != -1 && file_info.st_size == BYTE_TOTAL) {
-                return fd;
+            header_t header;
+            if (fstat(fd, &file_info) != -1) {
+                const size_t size = file_info.st_size;
+                if (pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) && header.magic == HEADER_MAGIC &&
+                    valid_geometry(header.block_size, header.block_count) &&
+                    size == HEADER_SIZE + header.block_size * header.block_count) {
+                    *block_size = header.block_size;
+                    *block_count = header.block_count;
+                    *header_size = HEADER_SIZE;
+                    return fd;
+                }
+                if (size == LEGACY_BYTE_TOTAL) {
+                    *block_size = BLOCK_SIZE;
+                    *block_count = BLOCK_COUNT;
+                    *header_size = 0;
+                    return fd;
+                }
             }
             close(fd);
         }
@@ -51,33 +234,402 @@ int check_file(const char *const fname) {
 }
 
 
-block_store_t *block_store_init(const bool init, const char *const fname) {
-    if (fname) {
-        block_store_t *bs = (block_store_t *) malloc(sizeof(block_store_t));
+// Write first, then the bit, see block_store_t
+static void mark_dirty(block_store_t *const bs, const size_t start, const size_t count) {
+    for (size_t block = start; block < start + count; ++block) {
+        bitmap_test_and_set_atomic(bs->dirty, block);
+    }
+}
+
+static size_t front_size(const block_store_t *const bs) {
+    return bs->header_size + bs->data_start * bs->block_size;
+}
+
+// The mmap backend
+
+static uint8_t *mmap_pointer(const block_store_t *const bs, const size_t block) {
+    return bs->mapping + bs->header_size + bs->block_size * block;
+}
+
+// The piece of the mapping under blocks [start, end), a run starting at block 0 takes the header along
+// msync and madvise want a page aligned start, the mapping is, so it's rounded down to the page the run starts in
+static void block_pages(const block_store_t *const bs, const size_t start, const size_t end, uint8_t **const from,
+                        size_t *const length) {
+    size_t first = start ? bs->header_size + start * bs->block_size : 0;
+    const size_t last = bs->header_size + end * bs->block_size;
+    first -= first % bs->page_size;
+    *from = bs->mapping + first;
+    *length = last - first;
+}
+
+// msyncs the pages under blocks [start, end)
+static bool sync_pages(block_store_t *const bs, const size_t start, const size_t end) {
+    uint8_t *from;
+    size_t length;
+    block_pages(bs, start, end, &from, &length);
+    return msync(from, length, MS_SYNC) == 0;
+}
+
+// The dirty blocks in [start, end), a run at a time. Runs that share a page, or sit in neighbouring pages,
+// go out in the same msync, since a page is the least msync can write anyway
+// Bits are cleared before their msync, a failed one puts them back
+static bool sync_dirty(block_store_t *const bs, const size_t start, const size_t end) {
+    const size_t page_blocks = bs->page_size > bs->block_size ? bs->page_size / bs->block_size : 1;
+    size_t run_start = SIZE_MAX, run_end = 0;
+    for (size_t block = start;; ++block) {
+        block = bitmap_ffs_reset_atomic(bs->dirty, block, end);
+        if (run_start != SIZE_MAX && (block == SIZE_MAX || block / page_blocks > (run_end - 1) / page_blocks + 1)) {
+            if (!sync_pages(bs, run_start, run_end)) {
+                mark_dirty(bs, run_start, run_end - run_start);
+                return false;
+            }
+            run_start = SIZE_MAX;
+        }
+        if (block == SIZE_MAX) {
+            return true;
+        }
+        run_start = run_start == SIZE_MAX ? block : run_start;
+        run_end = block + 1;
+    }
+}
+
+static bool mmap_open(block_store_t *const bs, const bool init, const size_t cache_blocks) {
+    (void) init;
+    (void) cache_blocks;
+    bs->mapping = (uint8_t *) mmap(NULL, bs->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, bs->fd, 0);
+    if (bs->mapping == (uint8_t *) MAP_FAILED) {
+        return false;
+    }
+    bs->front = bs->mapping;
+    return true;
+}
+
+static void mmap_close(block_store_t *const bs) {
+    munmap(bs->mapping, bs->file_size);
+}
+
+static bool mmap_copy(block_store_t *const bs, const size_t offset, uint8_t *const buffer, const size_t length,
+                      const bool to_blocks) {
+    uint8_t *const block_data = mmap_pointer(bs, 0) + offset;
+    if (to_blocks) {
+        memcpy(block_data, buffer, length);
+    } else {
+        memcpy(buffer, block_data, length);
+    }
+    return true;
+}
+
+static bool mmap_flush(block_store_t *const bs, const size_t start, const size_t end) {
+    return sync_pages(bs, start, end);
+}
+
+// The FBM isn't tracked, its blocks always go
+static bool mmap_sync(block_store_t *const bs, const size_t start, const size_t end) {
+    const size_t data = start > bs->data_start ? start : bs->data_start;
+    return (start >= bs->data_start || sync_pages(bs, start, end < bs->data_start ? end : bs->data_start)) &&
+           sync_dirty(bs, data, end);
+}
+
+static bool mmap_advise(block_store_t *const bs, const unsigned advice) {
+    // The data blocks get the access pattern and huge pages, the FBM is scanned in ways that fit neither.
+    // Data starts on the first page that's all data, a page shared with the end of the FBM stays as it was
+    size_t first = front_size(bs);
+    first += (bs->page_size - first % bs->page_size) % bs->page_size;
+    bool taken = true;
+    if (first < bs->file_size) {
+        uint8_t *const data = bs->mapping + first;
+        const size_t length = bs->file_size - first;
+        const int pattern_advice = advice & BLOCK_STORE_ADVISE_SEQUENTIAL ? POSIX_MADV_SEQUENTIAL
+                                   : advice & BLOCK_STORE_ADVISE_RANDOM   ? POSIX_MADV_RANDOM
+                                                                          : POSIX_MADV_NORMAL;
+        taken = posix_madvise(data, length, pattern_advice) == 0;
+#ifdef MADV_HUGEPAGE
+        if (advice & BLOCK_STORE_ADVISE_HUGEPAGE) {
+            taken = madvise(data, length, MADV_HUGEPAGE) == 0 && taken;
+        } else if (bs->advice & BLOCK_STORE_ADVISE_HUGEPAGE) {
+            taken = madvise(data, length, MADV_NOHUGEPAGE) == 0 && taken;
+        }
+#else
+        taken = taken && !(advice & BLOCK_STORE_ADVISE_HUGEPAGE);
+#endif
+    }
+    return taken;
+}
+
+static bool mmap_prefetch(block_store_t *const bs, const size_t start, const size_t end) {
+    uint8_t *from;
+    size_t length;
+    block_pages(bs, start, end, &from, &length);
+    return posix_madvise(from, length, POSIX_MADV_WILLNEED) == 0;
+}
+
+static const backend_t mmap_backend = {
+    mmap_open, mmap_close, mmap_copy, mmap_pointer, mmap_flush, mmap_sync, mmap_advise, mmap_prefetch,
+};
+
+// The pread backend
+
+// pread and pwrite can stop short, this keeps at it until everything's moved
+static bool file_io(const int fd, uint8_t *buffer, size_t length, off_t offset, const bool to_file) {
+    while (length) {
+        const ssize_t moved = to_file ? pwrite(fd, buffer, length, offset) : pread(fd, buffer, length, offset);
+        if (moved <= 0) {
+            if (moved == -1 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += moved;
+        length -= moved;
+        offset += moved;
+    }
+    return true;
+}
+
+// Writes the front blocks in [start, end) back to the file, the header along with block 0
+static bool store_front(block_store_t *const bs, const size_t start, const size_t end) {
+    const size_t first = start ? bs->header_size + start * bs->block_size : 0;
+    return file_io(bs->fd, bs->front + first, bs->header_size + end * bs->block_size - first, first, true);
+}
+
+static uint8_t *cache_way(const block_store_t *const bs, const size_t set, const size_t way) {
+    return bs->cache_data + (set * CACHE_WAYS + way) * bs->block_size;
+}
+
+static void cache_empty(block_store_t *const bs, cache_set_t *const set, const size_t way) {
+    bitmap_test_and_reset_atomic(bs->cached, set->blocks[way]);
+    set->blocks[way] = EMPTY_WAY;
+    set->used[way] = 0;
+}
+
+// A whole block through the cache. Reads fill it on a miss, writes go to the file and then the cache,
+// on the bet that what was just written gets read back
+// The set stays locked through the file I/O, so nobody else sees a way that's only half there
+static bool cache_copy(block_store_t *const bs, const size_t block, uint8_t *const buffer, const bool to_blocks) {
+    const size_t set_index = block % bs->cache_sets;
+    cache_set_t *const set = &bs->sets[set_index];
+    pthread_mutex_lock(&set->lock);
+    size_t way = 0, victim = 0;
+    for (; way < CACHE_WAYS && set->blocks[way] != block; ++way) {
+        victim = set->used[way] < set->used[victim] ? way : victim;
+    }
+    const bool hit = way < CACHE_WAYS;
+    if (!hit) {
+        way = victim;
+        if (set->blocks[way] != EMPTY_WAY) {
+            cache_empty(bs, set, way);
+        }
+    }
+    uint8_t *const cached = cache_way(bs, set_index, way);
+    const off_t at = bs->header_size + block * bs->block_size;
+    bool moved = true;
+    if (to_blocks) {
+        moved = file_io(bs->fd, buffer, bs->block_size, at, true);
+        if (moved) {
+            memcpy(cached, buffer, bs->block_size);
+        }
+    } else {
+        moved = hit || file_io(bs->fd, cached, bs->block_size, at, false);
+        if (moved) {
+            memcpy(buffer, cached, bs->block_size);
+        }
+    }
+    if (moved) {
+        if (!hit) {
+            set->blocks[way] = block;
+            bitmap_test_and_set_atomic(bs->cached, block);
+        }
+        set->used[way] = ++set->clock;
+    } else if (hit) {
+        // A failed write leaves the block in the file anyone's guess, the copy can't be trusted over it
+        cache_empty(bs, set, way);
+    }
+    pthread_mutex_unlock(&set->lock);
+    return moved;
+}
+
+// Takes any copies of blocks [start, end) out of the cache, after a write that went around it
+static void drop_stale(block_store_t *const bs, size_t start, const size_t end) {
+    for (; (start = bitmap_ffs_reset_atomic(bs->cached, start, end)) != SIZE_MAX; ++start) {
+        cache_set_t *const set = &bs->sets[start % bs->cache_sets];
+        pthread_mutex_lock(&set->lock);
+        for (size_t way = 0; way < CACHE_WAYS; ++way) {
+            if (set->blocks[way] == start) {
+                set->blocks[way] = EMPTY_WAY;
+                set->used[way] = 0;
+            }
+        }
+        pthread_mutex_unlock(&set->lock);
+    }
+}
+
+static bool pread_open(block_store_t *const bs, const bool init, const size_t cache_blocks) {
+    const size_t blocks = cache_blocks ? cache_blocks : DEFAULT_CACHE_BLOCKS;
+    bs->cache_sets = (blocks + CACHE_WAYS - 1) / CACHE_WAYS;
+    if (bs->cache_sets > SIZE_MAX / CACHE_WAYS / bs->block_size) {
+        return false;
+    }
+    // A new file is all zeros, there's nothing to read in
+    bs->front = (uint8_t *) calloc(1, front_size(bs));
+    bs->sets = (cache_set_t *) calloc(bs->cache_sets, sizeof(cache_set_t));
+    bs->cache_data = (uint8_t *) malloc(bs->cache_sets * CACHE_WAYS * bs->block_size);
+    bs->cached = bitmap_create(bs->block_count);
+    if (bs->front && bs->sets && bs->cache_data && bs->cached &&
+        (init || file_io(bs->fd, bs->front, front_size(bs), 0, false))) {
+        for (size_t set = 0; set < bs->cache_sets; ++set) {
+            pthread_mutex_init(&bs->sets[set].lock, NULL);
+            for (size_t way = 0; way < CACHE_WAYS; ++way) {
+                bs->sets[set].blocks[way] = EMPTY_WAY;
+            }
+        }
+        return true;
+    }
+    free(bs->front);
+    free(bs->sets);
+    free(bs->cache_data);
+    bitmap_destroy(bs->cached);
+    return false;
+}
+
+static void pread_close(block_store_t *const bs) {
+    // Nothing else has the header and FBM, it's now or never for them. Close can't say it failed,
+    // which is why block_store.h tells pread users to sync and check that first
+    store_front(bs, 0, bs->data_start);
+    for (size_t set = 0; set < bs->cache_sets; ++set) {
+        pthread_mutex_destroy(&bs->sets[set].lock);
+    }
+    free(bs->front);
+    free(bs->sets);
+    free(bs->cache_data);
+    bitmap_destroy(bs->cached);
+}
+
+// Whole blocks go through the cache, anything bigger or smaller goes straight to the file
+// A 1 MB read has no business pushing every random block out of the cache
+static bool pread_copy(block_store_t *const bs, const size_t offset, uint8_t *const buffer, const size_t length,
+                       const bool to_blocks) {
+    const size_t block = offset / bs->block_size;
+    if (offset % bs->block_size == 0 && length == bs->block_size) {
+        return cache_copy(bs, block, buffer, to_blocks);
+    }
+    const bool moved = file_io(bs->fd, buffer, length, bs->header_size + offset, to_blocks);
+    if (to_blocks) {
+        // Failed or not, copies of these blocks don't match the file anymore
+        drop_stale(bs, block, (offset + length + bs->block_size - 1) / bs->block_size);
+    }
+    return moved;
+}
+
+static uint8_t *pread_pointer(const block_store_t *const bs, const size_t block) {
+    (void) bs;
+    (void) block;
+    return NULL;
+}
+
+// Data blocks are in the file as soon as they're written, flushing is the header and FBM and then fdatasync
+static bool pread_flush(block_store_t *const bs, const size_t start, const size_t end) {
+    return (start >= bs->data_start || store_front(bs, start, end < bs->data_start ? end : bs->data_start)) &&
+           fdatasync(bs->fd) == 0;
+}
+
+// fdatasync can't do less than the whole file, so dirty blocks in the range only decide whether it's called
+static bool pread_sync(block_store_t *const bs, const size_t start, const size_t end) {
+    const bool front = start < bs->data_start;
+    if (front && !store_front(bs, start, end < bs->data_start ? end : bs->data_start)) {
+        return false;
+    }
+    const size_t dirty = bitmap_ffs_reset_atomic(bs->dirty, start > bs->data_start ? start : bs->data_start, end);
+    if (dirty != SIZE_MAX) {
+        bitmap_reset_range_atomic(bs->dirty, dirty, end);
+    } else if (!front) {
+        return true;
+    }
+    if (fdatasync(bs->fd) == 0) {
+        return true;
+    }
+    // One bit back is enough to get the next sync to call it again
+    if (dirty != SIZE_MAX) {
+        mark_dirty(bs, dirty, 1);
+    }
+    return false;
+}
+
+// The hints go to the page cache under the data blocks, huge pages are for mappings and there's none here
+static bool pread_advise(block_store_t *const bs, const unsigned advice) {
+    const int pattern_advice = advice & BLOCK_STORE_ADVISE_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL
+                               : advice & BLOCK_STORE_ADVISE_RANDOM   ? POSIX_FADV_RANDOM
+                                                                      : POSIX_FADV_NORMAL;
+    const size_t data = front_size(bs);
+    return posix_fadvise(bs->fd, data, bs->file_size - data, pattern_advice) == 0 &&
+           !(advice & BLOCK_STORE_ADVISE_HUGEPAGE);
+}
+
+// The header and FBM were read in at open
+static bool pread_prefetch(block_store_t *const bs, const size_t start, const size_t end) {
+    const size_t first = start > bs->data_start ? start : bs->data_start;
+    return first >= end || posix_fadvise(bs->fd, bs->header_size + first * bs->block_size,
+                                         (end - first) * bs->block_size, POSIX_FADV_WILLNEED) == 0;
+}
+
+static const backend_t pread_backend = {
+    pread_open, pread_close, pread_copy, pread_pointer, pread_flush, pread_sync, pread_advise, pread_prefetch,
+};
+
+// Indexed by block_store_backend_t
+static const backend_t *const backends[] = {&mmap_backend, &pread_backend};
+
+block_store_t *block_store_init(const bool init, const char *const fname, size_t block_size, size_t block_count,
+                                const backend_t *const backend, const size_t cache_blocks) {
+    if (fname && (!init || valid_geometry(block_size, block_count))) {
+        block_store_t *bs = (block_store_t *) calloc(1, sizeof(block_store_t));
         if (bs) {
-            bs->fd = init ? create_file(fname) : check_file(fname);
+            size_t header_size = HEADER_SIZE;
+            bs->fd = init ? create_file(fname, HEADER_SIZE + block_size * block_count)
+                          : check_file(fname, &block_size, &block_count, &header_size);
             if (bs->fd != -1) {
-                bs->data_blocks = (uint8_t *) mmap(NULL, BYTE_TOTAL, PROT_READ | PROT_WRITE, MAP_SHARED, bs->fd, 0);
-                if (bs->data_blocks != (uint8_t *) MAP_FAILED) {
+                bs->backend = backend;
+                bs->block_size = block_size;
+                bs->block_count = block_count;
+                bs->data_start = fbm_blocks(block_size, block_count);
+                bs->chunk_count = (block_count + CHUNK_BITS - 1) / CHUNK_BITS;
+                bs->header_size = header_size;
+                bs->file_size = header_size + block_size * block_count;
+                bs->chunk_free = (uint16_t *) malloc(sizeof(uint16_t) * bs->chunk_count);
+                bs->page_size = sysconf(_SC_PAGESIZE);
+                bs->dirty = bitmap_create(block_count);
+                if (bs->chunk_free && bs->dirty && backend->open(bs, init, cache_blocks)) {
                     // Woo hoo! Done. Mostly. Kinda.
+                    bs->user_area = header_size ? bs->front + USER_AREA_OFFSET : NULL;
                     if (init) {
-                        // init FBM and wipe remaining data
-                        // Could/should be done in create_file
-                        // but it's so much easier here...
-                        memset(bs->data_blocks, 0xFF, FBM_BLOCK_COUNT >> 3);
-                        memset(bs->data_blocks + FBM_BYTE_TOTAL, 0x00, DATA_BLOCK_BYTE_TOTAL);
+                        // Just the header. create_file truncated the file to nothing and back out,
+                        // so the FBM and data already read as zeros without a page of it being touched
+                        header_t header = {HEADER_MAGIC, (uint32_t) block_size, block_count};
+                        memcpy(bs->front, &header, sizeof(header));
                     }
-                    // Not quite sure what to do with madvise
-                    // Honestly, I feel like a split mapping may be best
-                    // Sequential for the FBM, random for the data
-                    // but I'll just not mess with it unless I get the time to profile them
-                    // madvise()
-                    bs->fbm = bitmap_overlay(BLOCK_COUNT, bs->data_blocks);
+                    // Access hints are left to block_store_advise, see block_store_open_advised
+                    bs->fbm = bitmap_overlay(block_count, bs->front + header_size);
                     if (bs->fbm) {
+                        if (init) {
+                            bitmap_set_range(bs->fbm, 0, bs->data_start);
+                        }
+                        // Region 0 starts at the front like always, the rest spread out over the device
+                        for (size_t region = 0; region < ALLOC_REGIONS; ++region) {
+                            const size_t start = region * bs->chunk_count / ALLOC_REGIONS * CHUNK_BITS;
+                            bs->cursors[region] = start > bs->data_start ? start : bs->data_start;
+                        }
+                        for (size_t chunk = 0; chunk < bs->chunk_count; ++chunk) {
+                            const size_t start = chunk * CHUNK_BITS;
+                            const size_t end = start + CHUNK_BITS < block_count ? start + CHUNK_BITS : block_count;
+                            bs->chunk_free[chunk] = (end - start) - bitmap_total_set_range(bs->fbm, start, end);
+                        }
+                        pthread_mutex_init(&bs->async_lock, NULL);
+                        bs->ring.fd = -1;
                         return bs;
                     }
-                    munmap(bs->data_blocks, BYTE_TOTAL);
+                    backend->close(bs);
                 }
+                free(bs->chunk_free);
+                bitmap_destroy(bs->dirty);
                 close(bs->fd);
             }
             free(bs);
@@ -87,62 +639,671 @@ block_store_t *block_store_init(const bool init, const char *const fname) {
 }
 
 block_store_t *block_store_create(const char *const fname) {
-    return block_store_init(true, fname);
+    return block_store_init(true, fname, BLOCK_SIZE, BLOCK_COUNT, &mmap_backend, 0);
+}
+
+block_store_t *block_store_create_geometry(const char *const fname, const size_t block_size,
+                                           const size_t block_count) {
+    return block_store_init(true, fname, block_size, block_count, &mmap_backend, 0);
 }
 
 block_store_t *block_store_open(const char *const fname) {
-    return block_store_init(false, fname);
+    return block_store_init(false, fname, 0, 0, &mmap_backend, 0);
+}
+
+block_store_t *block_store_open_backend(const char *const fname, const block_store_backend_t backend,
+                                        const size_t cache_blocks) {
+    if ((size_t) backend >= sizeof(backends) / sizeof(backends[0])) {
+        return NULL;
+    }
+    return block_store_init(false, fname, 0, 0, backends[backend], cache_blocks);
+}
+
+// One access pattern at most, and nothing that isn't a flag
+static bool valid_advice(const unsigned advice) {
+    const unsigned pattern = BLOCK_STORE_ADVISE_SEQUENTIAL | BLOCK_STORE_ADVISE_RANDOM;
+    return (advice & pattern) != pattern &&
+           !(advice & ~(pattern | BLOCK_STORE_ADVISE_PREFETCH | BLOCK_STORE_ADVISE_HUGEPAGE));
+}
+
+block_store_t *block_store_open_advised(const char *const fname, const unsigned advice) {
+    if (!valid_advice(advice)) {
+        return NULL;
+    }
+    block_store_t *bs = block_store_init(false, fname, 0, 0, &mmap_backend, 0);
+    if (bs) {
+        // Only hints, a kernel that won't take one still leaves a working block_store
+        block_store_advise(bs, advice);
+    }
+    return bs;
 }
 
 void block_store_close(block_store_t *const bs) {
     if (bs) {
+        // Anything still queued runs first, callbacks and all
+        block_store_set_queue_depth(bs, 0);
+        pthread_mutex_destroy(&bs->async_lock);
         bitmap_destroy(bs->fbm);
-        munmap(bs->data_blocks, BYTE_TOTAL);
+        bitmap_destroy(bs->dirty);
+        bs->backend->close(bs);
         close(bs->fd);
+        free(bs->chunk_free);
         free(bs);
     }
 }
 
+size_t block_store_get_block_size(const block_store_t *const bs) {
+    return bs ? bs->block_size : 0;
+}
+
+size_t block_store_get_block_count(const block_store_t *const bs) {
+    return bs ? bs->block_count : 0;
+}
+
+size_t block_store_get_data_start(const block_store_t *const bs) {
+    return bs ? bs->data_start : 0;
+}
+
+size_t block_store_get_used_blocks(const block_store_t *const bs) {
+    if (bs) {
+        // The chunk counts have it already, and reading them is safe while other threads allocate
+        size_t free_blocks = 0;
+        for (size_t chunk = 0; chunk < bs->chunk_count; ++chunk) {
+            free_blocks += __atomic_load_n(&bs->chunk_free[chunk], __ATOMIC_RELAXED);
+        }
+        return bs->block_count - free_blocks;
+    }
+    return 0;
+}
+
+void *block_store_get_user_area(block_store_t *const bs) {
+    return bs ? bs->user_area : NULL;
+}
+
+// Every FBM change goes through these so the chunk counts stay honest
+// The bit changes first, the count follows it
+static void count_claimed(block_store_t *const bs, size_t start, const size_t end) {
+    while (start < end) {
+        const size_t chunk = start / CHUNK_BITS;
+        const size_t piece_end = (chunk + 1) * CHUNK_BITS < end ? (chunk + 1) * CHUNK_BITS : end;
+        __atomic_fetch_sub(&bs->chunk_free[chunk], (uint16_t)(piece_end - start), __ATOMIC_RELAXED);
+        start = piece_end;
+    }
+}
+
+static bool claim_block(block_store_t *const bs, const size_t block_id) {
+    if (bitmap_test_and_set_atomic(bs->fbm, block_id)) {
+        return false;
+    }
+    count_claimed(bs, block_id, block_id + 1);
+    return true;
+}
+
+static void unclaim_block(block_store_t *const bs, const size_t block_id) {
+    if (bitmap_test_and_reset_atomic(bs->fbm, block_id)) {
+        __atomic_fetch_add(&bs->chunk_free[block_id / CHUNK_BITS], 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Range version, one chunk-sized piece at a time so each count gets adjusted once
+static void unclaim_range(block_store_t *const bs, size_t start, const size_t end) {
+    while (start < end) {
+        const size_t chunk = start / CHUNK_BITS;
+        const size_t piece_end = (chunk + 1) * CHUNK_BITS < end ? (chunk + 1) * CHUNK_BITS : end;
+        const size_t freed = bitmap_reset_range_atomic(bs->fbm, start, piece_end);
+        __atomic_fetch_add(&bs->chunk_free[chunk], (uint16_t) freed, __ATOMIC_RELAXED);
+        start = piece_end;
+    }
+}
+
+// Claims the first free block in [from, end), hopping over chunks the counts say are full
+static size_t claim_free(block_store_t *const bs, size_t from, const size_t end) {
+    while (from < end) {
+        const size_t chunk = from / CHUNK_BITS;
+        const size_t chunk_end = (chunk + 1) * CHUNK_BITS < end ? (chunk + 1) * CHUNK_BITS : end;
+        if (__atomic_load_n(&bs->chunk_free[chunk], __ATOMIC_RELAXED)) {
+            const size_t free_block = bitmap_ffz_claim_atomic(bs->fbm, from, chunk_end);
+            if (free_block != SIZE_MAX) {
+                count_claimed(bs, free_block, free_block + 1);
+                return free_block;
+            }
+        }
+        from = chunk_end;
+    }
+    return SIZE_MAX;
+}
+
+// Claims a free run of at least min blocks in [from, end), stopping the run at want
+// The run is claimed as it's found, a run that comes up short goes back and the search carries on past it
+static bool claim_run(block_store_t *const bs, size_t from, const size_t end, const size_t want, const size_t min,
+                      size_t *const run_start, size_t *const run_length) {
+    while ((from = claim_free(bs, from, end)) != SIZE_MAX) {
+        const size_t limit = end - from < want ? end : from + want;
+        const size_t run_end = bitmap_claim_range_atomic(bs->fbm, from + 1, limit);
+        count_claimed(bs, from + 1, run_end);
+        if (run_end - from >= min) {
+            *run_start = from;
+            *run_length = run_end - from;
+            return true;
+        }
+        unclaim_range(bs, from, run_end);
+        from = run_end;
+    }
+    return false;
+}
+
 unsigned block_store_allocate(block_store_t *const bs) {
     if (bs) {
-        size_t free_block = bitmap_ffz(bs->fbm);
-        if (free_block != SIZE_MAX) {
-            bitmap_set(bs->fbm, free_block);
-            return free_block;
+        size_t *const cursor = &bs->cursors[thread_region()];
+        const size_t start = __atomic_load_n(cursor, __ATOMIC_RELAXED);
+        // Start in the cursor's chunk, walk forward, and come back around to the
+        // front of the cursor's chunk last (that's the extra iteration)
+        size_t chunk = start / CHUNK_BITS;
+        for (size_t tried = 0; tried <= bs->chunk_count; ++tried, chunk = (chunk + 1) % bs->chunk_count) {
+            const size_t from = tried ? chunk * CHUNK_BITS : start;
+            const size_t chunk_end =
+                (chunk + 1) * CHUNK_BITS < bs->block_count ? (chunk + 1) * CHUNK_BITS : bs->block_count;
+            const size_t free_block = claim_free(bs, from, chunk_end);
+            if (free_block != SIZE_MAX) {
+                __atomic_store_n(cursor, (free_block + 1) % bs->block_count, __ATOMIC_RELAXED);
+                return free_block;
+            }
         }
     }
     return 0;
 }
 
-bool block_store_request(block_store_t *const bs, const unsigned block_id) {
-    if (bs && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT) {
-        if (!bitmap_test(bs->fbm, block_id)) {
-            bitmap_set(bs->fbm, block_id);
+bool block_store_allocate_extent(block_store_t *const bs, const unsigned want, const unsigned min,
+                                 unsigned *const start, unsigned *const count) {
+    if (bs && start && count && min && min <= want) {
+        size_t *const cursor = &bs->cursors[thread_region()];
+        const size_t from = __atomic_load_n(cursor, __ATOMIC_RELAXED);
+        // Same next-fit order as single allocation: cursor to the end, then the front up to the cursor.
+        // The second pass runs want - 1 past the cursor, so a free run that straddles it still counts
+        const size_t wrap_end = from + want - 1 < bs->block_count ? from + want - 1 : bs->block_count;
+        size_t run_start, run_length;
+        if (claim_run(bs, from, bs->block_count, want, min, &run_start, &run_length) ||
+            claim_run(bs, bs->data_start, wrap_end, want, min, &run_start, &run_length)) {
+            __atomic_store_n(cursor, (run_start + run_length) % bs->block_count, __ATOMIC_RELAXED);
+            *start = run_start;
+            *count = run_length;
             return true;
         }
     }
     return false;
 }
 
+bool block_store_request(block_store_t *const bs, const unsigned block_id) {
+    if (bs && block_id >= bs->data_start && block_id < bs->block_count) {
+        return claim_block(bs, block_id);
+    }
+    return false;
+}
+
 void block_store_release(block_store_t *const bs, const unsigned block_id) {
-    if (bs && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT) {
-        bitmap_reset(bs->fbm, block_id);
+    if (bs && block_id >= bs->data_start && block_id < bs->block_count) {
+        unclaim_block(bs, block_id);
+    }
+}
+
+void block_store_release_range(block_store_t *const bs, const unsigned start, const unsigned count) {
+    if (bs && count && start >= bs->data_start && start < bs->block_count && count <= bs->block_count - start) {
+        unclaim_range(bs, start, (size_t) start + count);
     }
 }
 
 bool block_store_read(block_store_t *const bs, const unsigned block_id, void *const dst) {
-    if (bs && dst && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT /* && bitmap_set(bs->fbm,block_id) */) {
-        memcpy(dst, bs->data_blocks + (BLOCK_SIZE * block_id), BLOCK_SIZE);
-        return true;
+    if (bs && dst && block_id >= bs->data_start && block_id < bs->block_count /* && bitmap_set(bs->fbm,block_id) */) {
+        return bs->backend->copy(bs, bs->block_size * block_id, (uint8_t *) dst, bs->block_size, false);
     }
     return false;
 }
 
 
 bool block_store_write(block_store_t *const bs, const unsigned block_id, const void *const src) {
-    if (bs && src && block_id >= DATA_BLOCK_START && block_id <= BLOCK_COUNT /* && bitmap_set(bs->fbm,block_id) */) {
-        memcpy(bs->data_blocks + (BLOCK_SIZE * block_id), src, BLOCK_SIZE);
-        return true;
+    if (bs && src && block_id >= bs->data_start && block_id < bs->block_count /* && bitmap_set(bs->fbm,block_id) */) {
+        if (bs->backend->copy(bs, bs->block_size * block_id, (uint8_t *) src, bs->block_size, true)) {
+            mark_dirty(bs, block_id, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Shared by readv and writev, the only difference is which way the copy goes
+static size_t transfer_v(block_store_t *const bs, const unsigned *const block_ids, size_t block_count,
+                         const struct iovec *const iov, const int iovcnt, const bool to_blocks) {
+    if (!bs || !block_ids || !iov || iovcnt < 0) {
+        return 0;
+    }
+    // Only whole blocks move, so trim the request to what the buffers can hold
+    size_t capacity = 0;
+    for (int vec = 0; vec < iovcnt; ++vec) {
+        capacity += iov[vec].iov_len;
+    }
+    if (block_count > capacity / bs->block_size) {
+        block_count = capacity / bs->block_size;
+    }
+
+    size_t done = 0;
+    int vec = 0;
+    size_t vec_offset = 0;
+    while (done < block_count) {
+        const unsigned first = block_ids[done];
+        if (first < bs->data_start || first >= bs->block_count) {
+            break;
+        }
+        size_t run = 1;
+        while (done + run < block_count && (size_t) first + run < bs->block_count &&
+               block_ids[done + run] == first + run) {
+            ++run;
+        }
+        // One run may still get split up by the buffer boundaries
+        size_t offset = bs->block_size * first;
+        size_t bytes = run * bs->block_size;
+        while (bytes) {
+            if (vec_offset == iov[vec].iov_len) {
+                ++vec;
+                vec_offset = 0;
+                continue;
+            }
+            size_t piece = iov[vec].iov_len - vec_offset;
+            if (piece > bytes) {
+                piece = bytes;
+            }
+            uint8_t *buffer = (uint8_t *) iov[vec].iov_base + vec_offset;
+            if (!bs->backend->copy(bs, offset, buffer, piece, to_blocks)) {
+                // Some of the run may have made it, it's counted as written but not as done
+                if (to_blocks) {
+                    mark_dirty(bs, first, run);
+                }
+                return done;
+            }
+            offset += piece;
+            vec_offset += piece;
+            bytes -= piece;
+        }
+        if (to_blocks) {
+            mark_dirty(bs, first, run);
+        }
+        done += run;
+    }
+    return done;
+}
+
+size_t block_store_readv(block_store_t *const bs, const unsigned *const block_ids, const size_t block_count,
+                         const struct iovec *const iov, const int iovcnt) {
+    return transfer_v(bs, block_ids, block_count, iov, iovcnt, false);
+}
+
+size_t block_store_writev(block_store_t *const bs, const unsigned *const block_ids, const size_t block_count,
+                          const struct iovec *const iov, const int iovcnt) {
+    return transfer_v(bs, block_ids, block_count, iov, iovcnt, true);
+}
+
+bool block_store_flush(block_store_t *const bs, const size_t start, const size_t count) {
+    if (bs && count && start < bs->block_count && count <= bs->block_count - start) {
+        bitmap_reset_range_atomic(bs->dirty, start, start + count);
+        if (bs->backend->flush(bs, start, start + count)) {
+            return true;
+        }
+        mark_dirty(bs, start, count);
+    }
+    return false;
+}
+
+bool block_store_sync(block_store_t *const bs) {
+    return bs && bs->backend->sync(bs, 0, bs->block_count);
+}
+
+bool block_store_sync_range(block_store_t *const bs, const size_t start, const size_t count) {
+    if (bs && count && start < bs->block_count && count <= bs->block_count - start) {
+        return bs->backend->sync(bs, start, start + count);
+    }
+    return false;
+}
+
+bool block_store_advise(block_store_t *const bs, const unsigned advice) {
+    if (!bs || !valid_advice(advice)) {
+        return false;
+    }
+    bool taken = bs->backend->advise(bs, advice);
+    if (advice & BLOCK_STORE_ADVISE_PREFETCH) {
+        taken = block_store_prefetch(bs, 0, bs->data_start) && taken;
+    }
+    bs->advice = advice;
+    return taken;
+}
+
+bool block_store_prefetch(block_store_t *const bs, const size_t start, const size_t count) {
+    if (bs && count && start < bs->block_count && count <= bs->block_count - start) {
+        return bs->backend->prefetch(bs, start, start + count);
     }
     return false;
 }
+
+const void *block_store_get_ptr(const block_store_t *const bs, const unsigned block_id) {
+    if (bs && block_id >= bs->data_start && block_id < bs->block_count) {
+        return bs->backend->pointer(bs, block_id);
+    }
+    return NULL;
+}
+
+void *block_store_get_ptr_mut(block_store_t *const bs, const unsigned block_id) {
+    if (bs && block_id >= bs->data_start && block_id < bs->block_count) {
+        uint8_t *const block = bs->backend->pointer(bs, block_id);
+        if (block) {
+            mark_dirty(bs, block_id, 1);
+        }
+        return block;
+    }
+    return NULL;
+}
+
+// Async requests
+
+#ifdef HAVE_URING
+static bool ring_open(block_store_t *const bs, const unsigned depth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int fd = (int) syscall(__NR_io_uring_setup, depth, &params);
+    if (fd == -1) {
+        return false;
+    }
+    ring_t *const ring = &bs->ring;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        ring->sq_ring_size = ring->cq_ring_size > ring->sq_ring_size ? ring->cq_ring_size : ring->sq_ring_size;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = (uint8_t *) mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single ? ring->sq_ring
+                           : (uint8_t *) mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ring == (uint8_t *) MAP_FAILED || ring->cq_ring == (uint8_t *) MAP_FAILED ||
+        ring->sqes == (struct io_uring_sqe *) MAP_FAILED) {
+        if (ring->sqes != (struct io_uring_sqe *) MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (!single && ring->cq_ring != (uint8_t *) MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sq_ring != (uint8_t *) MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        close(fd);
+        return false;
+    }
+    ring->sq_head = (unsigned *) (ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *) (ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (ring->cq_ring + params.cq_off.cqes);
+    ring->fd = fd;
+    return true;
+}
+
+static void ring_close(block_store_t *const bs) {
+    ring_t *const ring = &bs->ring;
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+// Puts a request in the submission ring, the kernel hears about it at the next ring_enter
+// Never more than queue_depth outstanding, so the ring (at least that big) always has room
+static void ring_queue(block_store_t *const bs, const unsigned index) {
+    ring_t *const ring = &bs->ring;
+    const request_t *const request = &bs->requests[index];
+    const unsigned tail = *ring->sq_tail;
+    const unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *const sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = bs->fd;
+    sqe->off = bs->header_size + request->block * bs->block_size;
+    sqe->addr = (uint64_t)(uintptr_t) &request->iov;
+    sqe->len = 1;
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Submits what's queued, and waits for min_complete completions if that's not 0
+// false only for errors worth giving up over, an interrupted wait is just tried again
+static bool ring_enter(block_store_t *const bs, const unsigned min_complete) {
+    const int submitted = (int) syscall(__NR_io_uring_enter, bs->ring.fd, bs->unsubmitted, min_complete,
+                                        min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted == -1) {
+        return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+    }
+    bs->unsubmitted -= submitted;
+    bs->in_flight += submitted;
+    return true;
+}
+#endif
+
+// Everything a synchronous write does once its data has landed, then the callback
+static void finish_request(block_store_t *const bs, const unsigned index, const bool ok) {
+    const request_t *const request = &bs->requests[index];
+    if (request->write) {
+        // Failed ones too, part of it may have made it
+        mark_dirty(bs, request->block, request->count);
+        if (bs->cached) {
+            drop_stale(bs, request->block, request->block + request->count);
+        }
+    }
+    if (request->done) {
+        request->done(request->arg, ok);
+    }
+    bs->free_requests[bs->free_count++] = index;
+}
+
+// The synchronous way to run a queued request, for when there's no ring or it stopped working
+static void run_request(block_store_t *const bs, const unsigned index) {
+    const request_t *const request = &bs->requests[index];
+    const bool ok = bs->backend->copy(bs, request->block * bs->block_size, (uint8_t *) request->iov.iov_base,
+                                      request->iov.iov_len, request->write);
+    finish_request(bs, index, ok);
+}
+
+#ifdef HAVE_URING
+static size_t ring_reap(block_store_t *const bs) {
+    ring_t *const ring = &bs->ring;
+    size_t reaped = 0;
+    for (unsigned head = *ring->cq_head; head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE); ++reaped) {
+        const struct io_uring_cqe *const cqe = &ring->cqes[head & *ring->cq_mask];
+        const unsigned index = (unsigned) cqe->user_data;
+        const int result = cqe->res;
+        __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        --bs->in_flight;
+        // A short one gets finished synchronously, it only happens when a request is more than one call moves
+        const request_t *const request = &bs->requests[index];
+        bool ok = result >= 0;
+        if (ok && (size_t) result < request->iov.iov_len) {
+            ok = file_io(bs->fd, (uint8_t *) request->iov.iov_base + result, request->iov.iov_len - result,
+                         bs->header_size + request->block * bs->block_size + result, request->write);
+        }
+        finish_request(bs, index, ok);
+    }
+    return reaped;
+}
+
+// ring_enter failed for good. What the kernel never picked up is taken back out of the ring and run synchronously,
+// what it has is reaped however long that takes, since it can still land in the caller's buffers.
+// Then the ring is closed, and later requests take the synchronous path
+static size_t ring_abandon(block_store_t *const bs) {
+    ring_t *const ring = &bs->ring;
+    size_t reaped = 0;
+    const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    for (unsigned at = head; at != *ring->sq_tail; ++at, ++reaped) {
+        run_request(bs, (unsigned) ring->sqes[ring->sq_array[at & *ring->sq_mask]].user_data);
+    }
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    bs->unsubmitted = 0;
+    while (bs->in_flight) {
+        reaped += ring_reap(bs);
+        // Completions still get posted without io_uring_enter, any syscall gives them a chance to
+        if (bs->in_flight && !ring_enter(bs, 1)) {
+            sched_yield();
+        }
+    }
+    ring_close(bs);
+    return reaped;
+}
+#endif
+
+// block_store_wait with the lock held
+static size_t wait_locked(block_store_t *const bs, const size_t min) {
+    size_t reaped = 0;
+#ifdef HAVE_URING
+    if (bs->ring.fd != -1) {
+        reaped = ring_reap(bs);
+        while (bs->unsubmitted || (reaped < min && bs->in_flight)) {
+            if (!ring_enter(bs, reaped < min ? 1 : 0)) {
+                return reaped + ring_abandon(bs);
+            }
+            reaped += ring_reap(bs);
+        }
+        return reaped;
+    }
+#endif
+    // No ring, each request is a synchronous copy, and all of them run no matter what min is
+    (void) min;
+    for (unsigned index = 0; bs->unsubmitted && index < bs->queue_depth; ++index) {
+        request_t *const request = &bs->requests[index];
+        if (request->queued) {
+            request->queued = false;
+            --bs->unsubmitted;
+            run_request(bs, index);
+            ++reaped;
+        }
+    }
+    return reaped;
+}
+
+bool block_store_set_queue_depth(block_store_t *const bs, const unsigned depth) {
+    if (!bs || depth > MAX_QUEUE_DEPTH) {
+        return false;
+    }
+    pthread_mutex_lock(&bs->async_lock);
+    // Whatever the old queue has going finishes on it
+    wait_locked(bs, SIZE_MAX);
+    bool set = !bs->unsubmitted && !bs->in_flight;
+    if (set) {
+#ifdef HAVE_URING
+        if (bs->ring.fd != -1) {
+            ring_close(bs);
+        }
+#endif
+        free(bs->requests);
+        free(bs->free_requests);
+        bs->requests = NULL;
+        bs->free_requests = NULL;
+        bs->free_count = 0;
+        __atomic_store_n(&bs->queue_depth, 0, __ATOMIC_RELEASE);
+        if (depth) {
+            bs->requests = (request_t *) calloc(depth, sizeof(request_t));
+            bs->free_requests = (unsigned *) malloc(depth * sizeof(unsigned));
+            set = bs->requests && bs->free_requests;
+            if (set) {
+                for (unsigned index = 0; index < depth; ++index) {
+                    bs->free_requests[bs->free_count++] = depth - 1 - index;
+                }
+#ifdef HAVE_URING
+                // The environment can turn io_uring off, to compare against it or to work around a kernel
+                if (!getenv("BLOCK_STORE_NO_URING")) {
+                    ring_open(bs, depth);
+                }
+#endif
+                __atomic_store_n(&bs->queue_depth, depth, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    pthread_mutex_unlock(&bs->async_lock);
+    return set;
+}
+
+unsigned block_store_get_queue_depth(const block_store_t *const bs) {
+    return bs ? __atomic_load_n(&bs->queue_depth, __ATOMIC_ACQUIRE) : 0;
+}
+
+bool block_store_queue_uses_uring(block_store_t *const bs) {
+    if (!bs) {
+        return false;
+    }
+    pthread_mutex_lock(&bs->async_lock);
+    const bool uring = bs->ring.fd != -1;
+    pthread_mutex_unlock(&bs->async_lock);
+    return uring;
+}
+
+// Shared by read_async and write_async
+static bool queue_request(block_store_t *const bs, const unsigned block_id, const size_t count, void *const buffer,
+                          const bool write, const block_store_callback_t done, void *const arg) {
+    if (!bs || !buffer || !count || block_id < bs->data_start || block_id >= bs->block_count ||
+        count > bs->block_count - block_id) {
+        return false;
+    }
+    pthread_mutex_lock(&bs->async_lock);
+    // A full queue makes room the only way it can, by finishing something
+    if (bs->queue_depth && !bs->free_count) {
+        wait_locked(bs, 1);
+    }
+    const bool queued = bs->free_count > 0;
+    if (queued) {
+        const unsigned index = bs->free_requests[--bs->free_count];
+        request_t *const request = &bs->requests[index];
+        request->iov.iov_base = buffer;
+        request->iov.iov_len = count * bs->block_size;
+        request->block = block_id;
+        request->count = count;
+        request->done = done;
+        request->arg = arg;
+        request->write = write;
+        ++bs->unsubmitted;
+#ifdef HAVE_URING
+        if (bs->ring.fd != -1) {
+            ring_queue(bs, index);
+        } else {
+            request->queued = true;
+        }
+#else
+        request->queued = true;
+#endif
+    }
+    pthread_mutex_unlock(&bs->async_lock);
+    return queued;
+}
+
+bool block_store_read_async(block_store_t *const bs, const unsigned block_id, const size_t count, void *const dst,
+                            const block_store_callback_t done, void *const arg) {
+    return queue_request(bs, block_id, count, dst, false, done, arg);
+}
+
+bool block_store_write_async(block_store_t *const bs, const unsigned block_id, const size_t count,
+                             const void *const src, const block_store_callback_t done, void *const arg) {
+    return queue_request(bs, block_id, count, (void *) src, true, done, arg);
+}
+
+size_t block_store_wait(block_store_t *const bs, const size_t min) {
+    if (!bs) {
+        return 0;
+    }
+    pthread_mutex_lock(&bs->async_lock);
+    const size_t reaped = wait_locked(bs, min);
+    pthread_mutex_unlock(&bs->async_lock);
+    return reaped;
+}
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <cstddef>
 #include <cstring>
+#include <unistd.h>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
 
 #include "block_store.h"
@@ -20,6 +23,28 @@ TEST(bs_create_close, basic) {
     block_store_close(res);
 }
 
+TEST(bs_create_close, over_old_file) {
+    // a block written and used, then the file created again on top of it
+    block_store_t *bs = block_store_create_geometry("test_z.bs", 4096, 1000);
+    ASSERT_NE(nullptr, bs);
+    uint8_t data[4096], back[4096];
+    memset(data, 0x5A, sizeof(data));
+    ASSERT_TRUE(block_store_request(bs, 500));
+    ASSERT_TRUE(block_store_write(bs, 500, data));
+    block_store_close(bs);
+
+    // nothing of it is left, in the FBM or the data
+    bs = block_store_create("test_z.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(16u, block_store_get_used_blocks(bs));
+    memset(data, 0, sizeof(data));
+    for (unsigned block = 16; block < 65536; ++block) {
+        ASSERT_TRUE(block_store_read(bs, block, back));
+        ASSERT_EQ(0, memcmp(data, back, 512));
+    }
+    block_store_close(bs);
+}
+
 TEST(bs_destroy, null_object) {
     block_store_close(NULL);
     // Congrats, you didn't crash!
@@ -137,10 +162,632 @@ TEST(bs_request_release, fbm_attack) {
 
 TEST(bs_request, fill_device) {
     block_store_t *bs = block_store_create("test_l.bs");
+    ASSERT_EQ(block_store_get_used_blocks(bs), 16u);
     for (unsigned i = 16; i < 65536; ++i) {
         ASSERT_TRUE(block_store_request(bs, i));
     }
     ASSERT_EQ(block_store_allocate(bs), 0);
+    ASSERT_EQ(block_store_get_used_blocks(bs), 65536u);
+    block_store_release_range(bs, 100, 50);
+    ASSERT_EQ(block_store_get_used_blocks(bs), 65536u - 50u);
+    ASSERT_EQ(block_store_get_used_blocks(NULL), 0u);
+    block_store_close(bs);
+}
+
+TEST(bs_allocate, next_fit) {
+    block_store_t *bs = block_store_create("test_m.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // back to back allocations should be contiguous
+    unsigned first = block_store_allocate(bs);
+    ASSERT_NE(0u, first);
+    for (unsigned i = 1; i < 5000; ++i) {
+        ASSERT_EQ(first + i, block_store_allocate(bs));
+    }
+
+    // released blocks behind the cursor don't get handed right back...
+    block_store_release(bs, first + 10);
+    ASSERT_EQ(first + 5000, block_store_allocate(bs));
+
+    // ...but they do once everything in front of the cursor is gone
+    for (unsigned i = first + 5001; i < 65536; ++i) {
+        ASSERT_TRUE(block_store_request(bs, i));
+    }
+    ASSERT_EQ(first + 10, block_store_allocate(bs));
+    ASSERT_EQ(0u, block_store_allocate(bs));
+
+    // double release shouldn't make up free space that isn't there
+    block_store_release(bs, first + 10);
+    block_store_release(bs, first + 10);
+    ASSERT_EQ(first + 10, block_store_allocate(bs));
+    ASSERT_EQ(0u, block_store_allocate(bs));
+
+    // request/release are range checked
+    ASSERT_FALSE(block_store_request(bs, 65536));
+    block_store_close(bs);
+}
+
+TEST(bs_allocate_extent, basic_use) {
+    block_store_t *bs = block_store_create("test_n.bs");
+    ASSERT_NE(nullptr, bs);
+
+    unsigned start = 0, count = 0;
+    ASSERT_TRUE(block_store_allocate_extent(bs, 100, 1, &start, &count));
+    ASSERT_EQ(16u, start);
+    ASSERT_EQ(100u, count);
+    // all of it is really allocated
+    for (unsigned i = start; i < start + count; ++i) {
+        ASSERT_FALSE(block_store_request(bs, i));
+    }
+    // and single allocation picks up after it
+    ASSERT_EQ(start + count, block_store_allocate(bs));
+
+    // a taken block in the middle of a run cuts it short...
+    ASSERT_TRUE(block_store_request(bs, 300));
+    ASSERT_TRUE(block_store_allocate_extent(bs, 1000, 1, &start, &count));
+    ASSERT_EQ(117u, start);
+    ASSERT_EQ(300u - 117u, count);
+    // ...unless min says that's not good enough
+    ASSERT_TRUE(block_store_request(bs, 400));
+    ASSERT_TRUE(block_store_allocate_extent(bs, 1000, 200, &start, &count));
+    ASSERT_EQ(401u, start);
+    ASSERT_EQ(1000u, count);
+
+    // releasing a range frees all of it, and only it
+    block_store_release_range(bs, 117, 183);
+    ASSERT_TRUE(block_store_request(bs, 117));
+    ASSERT_TRUE(block_store_request(bs, 299));
+    ASSERT_FALSE(block_store_request(bs, 300));
+    ASSERT_FALSE(block_store_request(bs, 116));
+
+    // bad values
+    ASSERT_FALSE(block_store_allocate_extent(NULL, 10, 1, &start, &count));
+    ASSERT_FALSE(block_store_allocate_extent(bs, 10, 0, &start, &count));
+    ASSERT_FALSE(block_store_allocate_extent(bs, 10, 11, &start, &count));
+    ASSERT_FALSE(block_store_allocate_extent(bs, 10, 1, NULL, &count));
+    ASSERT_FALSE(block_store_allocate_extent(bs, 10, 1, &start, NULL));
+    block_store_release_range(bs, 0, 20);  // touches the FBM, so nothing happens
+    ASSERT_FALSE(block_store_request(bs, 16));
+
+    block_store_close(bs);
+}
+
+TEST(bs_allocate_extent, fill_device) {
+    block_store_t *bs = block_store_create("test_o.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // every other block taken, so nothing longer than 1 exists
+    for (unsigned i = 16; i < 65536; i += 2) {
+        ASSERT_TRUE(block_store_request(bs, i));
+    }
+    unsigned start = 0, count = 0;
+    ASSERT_FALSE(block_store_allocate_extent(bs, 4, 2, &start, &count));
+    ASSERT_TRUE(block_store_allocate_extent(bs, 4, 1, &start, &count));
+    ASSERT_EQ(1u, count);
+
+    // free the back half and it all comes back as one extent
+    // (plus the free odd block just in front of it)
+    block_store_release_range(bs, 32768, 32768);
+    ASSERT_TRUE(block_store_allocate_extent(bs, 65536, 2, &start, &count));
+    ASSERT_EQ(32767u, start);
+    ASSERT_EQ(32769u, count);
+    ASSERT_NE(0u, block_store_allocate(bs));
+
+    // a free run that straddles the cursor is still found
+    while (block_store_allocate(bs) != 0) {
+    }
+    block_store_release_range(bs, 1000, 10);
+    ASSERT_TRUE(block_store_allocate_extent(bs, 5, 5, &start, &count));
+    ASSERT_EQ(1000u, start);
+    ASSERT_EQ(5u, count);
+    block_store_release_range(bs, 1000, 5);
+    ASSERT_TRUE(block_store_allocate_extent(bs, 10, 10, &start, &count));
+    ASSERT_EQ(1000u, start);
+    ASSERT_EQ(10u, count);
+    block_store_release_range(bs, 1000, 10);
+    ASSERT_TRUE(block_store_allocate_extent(bs, 5, 5, &start, &count));
+    block_store_release_range(bs, 1000, 5);
+    ASSERT_TRUE(block_store_allocate_extent(bs, 10, 6, &start, &count));
+    ASSERT_EQ(1000u, start);
+    ASSERT_EQ(10u, count);
+
+    block_store_close(bs);
+}
+
+TEST(bs_get_ptr, basic_use) {
+    block_store_t *bs = block_store_create("test_p.bs");
+    ASSERT_NE(nullptr, bs);
+
+    uint8_t data_blocks[2][512];
+    memset(data_blocks[0], 0x5A, 512);
+
+    unsigned block_a = block_store_allocate(bs);
+    ASSERT_TRUE(block_store_write(bs, block_a, data_blocks[0]));
+
+    // reads see what was written
+    const void *view = block_store_get_ptr(bs, block_a);
+    ASSERT_NE(nullptr, view);
+    ASSERT_EQ(0, memcmp(view, data_blocks[0], 512));
+
+    // writes through the pointer are what block_store_read sees
+    uint8_t *edit = (uint8_t *) block_store_get_ptr_mut(bs, block_a);
+    ASSERT_EQ(view, edit);
+    memset(edit, 0xA5, 512);
+    ASSERT_TRUE(block_store_read(bs, block_a, data_blocks[1]));
+    memset(data_blocks[0], 0xA5, 512);
+    ASSERT_EQ(0, memcmp(data_blocks[0], data_blocks[1], 512));
+
+    // neighbors are a block apart
+    ASSERT_EQ((const uint8_t *) view + 512, block_store_get_ptr(bs, block_a + 1));
+
+    // the FBM is off limits, as is anything off the end
+    for (unsigned i = 0; i < 16; ++i) {
+        ASSERT_EQ(nullptr, block_store_get_ptr(bs, i));
+        ASSERT_EQ(nullptr, block_store_get_ptr_mut(bs, i));
+    }
+    ASSERT_EQ(nullptr, block_store_get_ptr(bs, 65536));
+    ASSERT_EQ(nullptr, block_store_get_ptr_mut(bs, 65536));
+    ASSERT_EQ(nullptr, block_store_get_ptr(NULL, block_a));
+    ASSERT_EQ(nullptr, block_store_get_ptr_mut(NULL, block_a));
+
+    block_store_close(bs);
+}
+
+TEST(bs_flush, basic_use) {
+    block_store_t *bs = block_store_create("test_f.bs");
+    ASSERT_NE(nullptr, bs);
+
+    uint8_t data[2][512];
+    memset(data[0], 0x6B, 512);
+    unsigned block = block_store_allocate(bs);
+    ASSERT_TRUE(block_store_write(bs, block, data[0]));
+
+    // one block, a run with the FBM and header in it, the whole device
+    ASSERT_TRUE(block_store_flush(bs, block, 1));
+    ASSERT_TRUE(block_store_flush(bs, 0, 17));
+    ASSERT_TRUE(block_store_flush(bs, 0, 65536));
+    ASSERT_TRUE(block_store_flush(bs, 65535, 1));
+
+    // nothing to flush, or past the end
+    ASSERT_FALSE(block_store_flush(bs, block, 0));
+    ASSERT_FALSE(block_store_flush(bs, 65536, 1));
+    ASSERT_FALSE(block_store_flush(bs, 65535, 2));
+    ASSERT_FALSE(block_store_flush(NULL, block, 1));
+    block_store_close(bs);
+
+    // what was flushed is what comes back
+    bs = block_store_open("test_f.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_TRUE(block_store_read(bs, block, data[1]));
+    ASSERT_EQ(0, memcmp(data[0], data[1], 512));
+    block_store_close(bs);
+}
+
+TEST(bs_sync, basic_use) {
+    block_store_t *bs = block_store_create("test_y.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // nothing written yet, still has the header and FBM to go
+    ASSERT_TRUE(block_store_sync(bs));
+    ASSERT_TRUE(block_store_sync_range(bs, 16, 65520));
+
+    // scattered blocks, a run through writev, two blocks sharing a page, and one through a pointer
+    uint8_t data[4][512];
+    for (int i = 0; i < 4; ++i) {
+        memset(data[i], 0x20 + i, 512);
+    }
+    ASSERT_TRUE(block_store_write(bs, 100, data[0]));
+    ASSERT_TRUE(block_store_write(bs, 102, data[1]));
+    ASSERT_TRUE(block_store_write(bs, 60000, data[2]));
+    const unsigned ids[3] = {5000, 5001, 5002};
+    struct iovec iov = {data, 3 * 512};
+    ASSERT_EQ(3u, block_store_writev(bs, ids, 3, &iov, 1));
+    void *block = block_store_get_ptr_mut(bs, 70);
+    ASSERT_NE(nullptr, block);
+    memcpy(block, data[3], 512);
+
+    // part of it, then the rest, then again with nothing left
+    ASSERT_TRUE(block_store_sync_range(bs, 100, 3));
+    ASSERT_TRUE(block_store_sync(bs));
+    ASSERT_TRUE(block_store_sync(bs));
+    ASSERT_TRUE(block_store_sync_range(bs, 65535, 1));
+
+    // nothing to sync, or past the end
+    ASSERT_FALSE(block_store_sync_range(bs, 100, 0));
+    ASSERT_FALSE(block_store_sync_range(bs, 65536, 1));
+    ASSERT_FALSE(block_store_sync_range(bs, 65535, 2));
+    ASSERT_FALSE(block_store_sync_range(NULL, 100, 1));
+    ASSERT_FALSE(block_store_sync(NULL));
+    block_store_close(bs);
+
+    bs = block_store_open("test_y.bs");
+    ASSERT_NE(nullptr, bs);
+    uint8_t back[512];
+    const unsigned expect_ids[7] = {100, 102, 60000, 5000, 5001, 5002, 70};
+    const int expect_data[7] = {0, 1, 2, 0, 1, 2, 3};
+    for (int i = 0; i < 7; ++i) {
+        ASSERT_TRUE(block_store_read(bs, expect_ids[i], back));
+        ASSERT_EQ(0, memcmp(data[expect_data[i]], back, 512));
+    }
+    block_store_close(bs);
+}
+
+TEST(bs_advise, basic_use) {
+    block_store_t *bs = block_store_create("test_x.bs");
+    ASSERT_NE(nullptr, bs);
+    uint8_t data[512], back[512];
+    memset(data, 0x3C, sizeof(data));
+    ASSERT_TRUE(block_store_write(bs, 1000, data));
+    block_store_close(bs);
+
+    // every mode still reads and writes the same, huge pages are up to the kernel so only the others have to be taken
+    const unsigned modes[6] = {BLOCK_STORE_ADVISE_NORMAL,
+                               BLOCK_STORE_ADVISE_SEQUENTIAL,
+                               BLOCK_STORE_ADVISE_RANDOM,
+                               BLOCK_STORE_ADVISE_PREFETCH,
+                               BLOCK_STORE_ADVISE_RANDOM | BLOCK_STORE_ADVISE_PREFETCH,
+                               BLOCK_STORE_ADVISE_SEQUENTIAL | BLOCK_STORE_ADVISE_HUGEPAGE};
+    for (int m = 0; m < 6; ++m) {
+        bs = block_store_open_advised("test_x.bs", modes[m]);
+        ASSERT_NE(nullptr, bs);
+        ASSERT_TRUE(block_store_read(bs, 1000, back));
+        ASSERT_EQ(0, memcmp(data, back, 512));
+        ASSERT_TRUE(block_store_write(bs, 2000 + m, data));
+        ASSERT_FALSE(block_store_request(bs, 15));
+        if (!(modes[m] & BLOCK_STORE_ADVISE_HUGEPAGE)) {
+            ASSERT_TRUE(block_store_advise(bs, modes[(m + 1) % 5]));
+        }
+        ASSERT_TRUE(block_store_prefetch(bs, 0, 48));
+        ASSERT_TRUE(block_store_prefetch(bs, 1000, 1));
+        ASSERT_TRUE(block_store_prefetch(bs, 65535, 1));
+        block_store_close(bs);
+    }
+
+    // both patterns, flags that don't exist, nothing to prefetch or past the end
+    ASSERT_EQ(nullptr,
+              block_store_open_advised("test_x.bs", BLOCK_STORE_ADVISE_SEQUENTIAL | BLOCK_STORE_ADVISE_RANDOM));
+    ASSERT_EQ(nullptr, block_store_open_advised("test_x.bs", 0x10));
+    ASSERT_EQ(nullptr, block_store_open_advised(NULL, BLOCK_STORE_ADVISE_NORMAL));
+    bs = block_store_open("test_x.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_FALSE(block_store_advise(bs, BLOCK_STORE_ADVISE_SEQUENTIAL | BLOCK_STORE_ADVISE_RANDOM));
+    ASSERT_FALSE(block_store_advise(NULL, BLOCK_STORE_ADVISE_NORMAL));
+    ASSERT_FALSE(block_store_prefetch(bs, 1000, 0));
+    ASSERT_FALSE(block_store_prefetch(bs, 65536, 1));
+    ASSERT_FALSE(block_store_prefetch(bs, 65535, 2));
+    ASSERT_FALSE(block_store_prefetch(NULL, 1000, 1));
+    for (int m = 0; m < 6; ++m) {
+        ASSERT_TRUE(block_store_read(bs, 2000 + m, back));
+        ASSERT_EQ(0, memcmp(data, back, 512));
+    }
+    block_store_close(bs);
+}
+
+TEST(bs_backend, pread) {
+    block_store_t *bs = block_store_create("test_w.bs");
+    ASSERT_NE(nullptr, bs);
+    uint8_t data[512], back[512];
+    memset(data, 0x5A, sizeof(data));
+    ASSERT_TRUE(block_store_write(bs, 1000, data));
+    block_store_close(bs);
+
+    // a small cache, so the loops below push blocks back out of it
+    bs = block_store_open_backend("test_w.bs", BLOCK_STORE_BACKEND_PREAD, 16);
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(512u, block_store_get_block_size(bs));
+    ASSERT_EQ(65536u, block_store_get_block_count(bs));
+    ASSERT_TRUE(block_store_read(bs, 1000, back));
+    ASSERT_EQ(0, memcmp(data, back, 512));
+    ASSERT_EQ(nullptr, block_store_get_ptr(bs, 1000));
+    ASSERT_EQ(nullptr, block_store_get_ptr_mut(bs, 1000));
+    ASSERT_FALSE(block_store_request(bs, 15));
+    ASSERT_TRUE(block_store_request(bs, 5000));
+    memcpy(block_store_get_user_area(bs), "pread", 6);
+    for (unsigned block = 2000; block < 2100; ++block) {
+        memset(data, block & 0xFF, sizeof(data));
+        ASSERT_TRUE(block_store_write(bs, block, data));
+    }
+    for (unsigned block = 2000; block < 2100; ++block) {
+        ASSERT_TRUE(block_store_read(bs, block, back));
+        ASSERT_EQ(block & 0xFF, back[0]);
+        ASSERT_EQ(block & 0xFF, back[511]);
+    }
+
+    // a run goes around the cache, but can't leave it holding the old copies
+    uint8_t run[512 * 4], run_back[512 * 4];
+    memset(run, 0xC3, sizeof(run));
+    ASSERT_TRUE(block_store_read(bs, 2001, back));
+    const unsigned ids[4] = {2000, 2001, 2002, 2003};
+    struct iovec iov[2] = {{run, 700}, {run + 700, sizeof(run) - 700}};
+    ASSERT_EQ(4u, block_store_writev(bs, ids, 4, iov, 2));
+    ASSERT_TRUE(block_store_read(bs, 2001, back));
+    ASSERT_EQ(0, memcmp(run, back, 512));
+    struct iovec iov_back[1] = {{run_back, sizeof(run_back)}};
+    ASSERT_EQ(4u, block_store_readv(bs, ids, 4, iov_back, 1));
+    ASSERT_EQ(0, memcmp(run, run_back, sizeof(run)));
+
+    ASSERT_TRUE(block_store_sync(bs));
+    ASSERT_TRUE(block_store_sync_range(bs, 2000, 100));
+    ASSERT_TRUE(block_store_flush(bs, 0, 16));
+    ASSERT_TRUE(block_store_advise(bs, BLOCK_STORE_ADVISE_RANDOM | BLOCK_STORE_ADVISE_PREFETCH));
+    ASSERT_FALSE(block_store_advise(bs, BLOCK_STORE_ADVISE_HUGEPAGE));
+    ASSERT_TRUE(block_store_prefetch(bs, 2000, 100));
+    ASSERT_FALSE(block_store_read(bs, 15, back));
+    ASSERT_FALSE(block_store_write(bs, 65536, data));
+    block_store_close(bs);
+
+    // everything, the FBM and user area included, is there for the mmap backend
+    bs = block_store_open_backend("test_w.bs", BLOCK_STORE_BACKEND_MMAP, 0);
+    ASSERT_NE(nullptr, bs);
+    ASSERT_FALSE(block_store_request(bs, 5000));
+    ASSERT_STREQ("pread", (const char *) block_store_get_user_area(bs));
+    ASSERT_EQ(0, memcmp(run, block_store_get_ptr(bs, 2000), 512));
+    for (unsigned block = 2004; block < 2100; ++block) {
+        ASSERT_EQ(block & 0xFF, ((const uint8_t *) block_store_get_ptr(bs, block))[0]);
+    }
+    block_store_close(bs);
+
+    ASSERT_EQ(nullptr, block_store_open_backend("test_w.bs", (block_store_backend_t) 2, 0));
+    ASSERT_EQ(nullptr, block_store_open_backend("test_not_there.bs", BLOCK_STORE_BACKEND_PREAD, 0));
+    ASSERT_EQ(nullptr, block_store_open_backend(NULL, BLOCK_STORE_BACKEND_PREAD, 0));
+}
+
+static void count_done(void *arg, bool ok) {
+    if (ok) {
+        ++*(int *) arg;
+    }
+}
+
+TEST(bs_async, basic_use) {
+    block_store_t *bs = block_store_create("test_v.bs");
+    ASSERT_NE(nullptr, bs);
+    block_store_close(bs);
+
+    // io_uring (if the kernel has it), then the synchronous fallback, each on both backends
+    for (int pass = 0; pass < 4; ++pass) {
+        if (pass >= 2) {
+            setenv("BLOCK_STORE_NO_URING", "1", 1);
+        }
+        bs = block_store_open_backend("test_v.bs", (block_store_backend_t)(pass % 2), 16);
+        ASSERT_NE(nullptr, bs);
+        uint8_t data[512 * 8], back[512 * 8], one[512];
+        ASSERT_FALSE(block_store_read_async(bs, 1000, 1, back, count_done, NULL));
+        ASSERT_EQ(0u, block_store_get_queue_depth(bs));
+        ASSERT_TRUE(block_store_set_queue_depth(bs, 4));
+        ASSERT_EQ(4u, block_store_get_queue_depth(bs));
+        if (pass >= 2) {
+            ASSERT_FALSE(block_store_queue_uses_uring(bs));
+        }
+
+        // twice the depth, so queueing has to wait for room part way through
+        int done = 0;
+        for (unsigned r = 0; r < 8; ++r) {
+            memset(data + r * 512, pass * 16 + r, 512);
+            ASSERT_TRUE(block_store_write_async(bs, 1000 + r, 1, data + r * 512, count_done, &done));
+        }
+        ASSERT_GE(block_store_wait(bs, SIZE_MAX), 1u);
+        ASSERT_EQ(8, done);
+        for (unsigned r = 0; r < 8; ++r) {
+            ASSERT_TRUE(block_store_read(bs, 1000 + r, one));
+            ASSERT_EQ(0, memcmp(data + r * 512, one, 512));
+        }
+
+        // a run each way, the cached copy of 2001 can't survive the write
+        memset(back, 0, sizeof(back));
+        ASSERT_TRUE(block_store_read(bs, 2001, one));
+        ASSERT_TRUE(block_store_write_async(bs, 2000, 8, data, NULL, NULL));
+        ASSERT_EQ(1u, block_store_wait(bs, SIZE_MAX));
+        done = 0;
+        ASSERT_TRUE(block_store_read_async(bs, 2000, 8, back, count_done, &done));
+        ASSERT_EQ(1u, block_store_wait(bs, 1));
+        ASSERT_EQ(1, done);
+        ASSERT_EQ(0, memcmp(data, back, sizeof(data)));
+        ASSERT_TRUE(block_store_read(bs, 2001, one));
+        ASSERT_EQ(0, memcmp(data + 512, one, 512));
+        ASSERT_TRUE(block_store_sync(bs));
+
+        // bad blocks, no buffer, nothing to wait for, too deep
+        ASSERT_FALSE(block_store_read_async(bs, 15, 1, back, NULL, NULL));
+        ASSERT_FALSE(block_store_read_async(bs, 65535, 2, back, NULL, NULL));
+        ASSERT_FALSE(block_store_read_async(bs, 1000, 0, back, NULL, NULL));
+        ASSERT_FALSE(block_store_write_async(bs, 1000, 1, NULL, NULL, NULL));
+        ASSERT_FALSE(block_store_read_async(NULL, 1000, 1, back, NULL, NULL));
+        ASSERT_EQ(0u, block_store_wait(bs, SIZE_MAX));
+        ASSERT_EQ(0u, block_store_wait(NULL, 1));
+        ASSERT_FALSE(block_store_set_queue_depth(bs, 4097));
+        ASSERT_FALSE(block_store_set_queue_depth(NULL, 4));
+
+        // a new depth, or closing, finishes what's queued first
+        done = 0;
+        ASSERT_TRUE(block_store_read_async(bs, 1000, 1, back, count_done, &done));
+        ASSERT_TRUE(block_store_set_queue_depth(bs, 64));
+        ASSERT_EQ(1, done);
+        ASSERT_TRUE(block_store_read_async(bs, 1001, 1, back, count_done, &done));
+        block_store_close(bs);
+        ASSERT_EQ(2, done);
+        ASSERT_EQ(0, memcmp(data + 512, back, 512));
+    }
+    unsetenv("BLOCK_STORE_NO_URING");
+}
+
+TEST(bs_readv_writev, basic_use) {
+    block_store_t *bs = block_store_create("test_q.bs");
+    ASSERT_NE(nullptr, bs);
+
+    // a run, a jump backwards, and a repeat
+    const unsigned ids[6] = {100, 101, 102, 50, 51, 100};
+    uint8_t source[6][512];
+    for (int i = 0; i < 6; ++i) {
+        memset(source[i], 0x10 + i, 512);
+    }
+
+    // uneven buffers so blocks straddle them
+    struct iovec out[3] = {{source[0], 700}, {source[0] + 700, 1000}, {source[0] + 1700, 6 * 512 - 1700}};
+    ASSERT_EQ(6u, block_store_writev(bs, ids, 6, out, 3));
+
+    // the repeat wins for block 100, everything else is as written
+    uint8_t block[512];
+    ASSERT_TRUE(block_store_read(bs, 100, block));
+    ASSERT_EQ(0, memcmp(block, source[5], 512));
+    ASSERT_TRUE(block_store_read(bs, 102, block));
+    ASSERT_EQ(0, memcmp(block, source[2], 512));
+    ASSERT_TRUE(block_store_read(bs, 51, block));
+    ASSERT_EQ(0, memcmp(block, source[4], 512));
+
+    uint8_t dest[5][512];
+    memset(dest, 0, sizeof(dest));
+    struct iovec in[2] = {{dest[0], 100}, {dest[0] + 100, 5 * 512 - 100}};
+    ASSERT_EQ(5u, block_store_readv(bs, ids, 5, in, 2));
+    ASSERT_EQ(0, memcmp(dest[0], source[5], 512));
+    ASSERT_EQ(0, memcmp(dest[1], source[1], 512));
+    ASSERT_EQ(0, memcmp(dest[4], source[4], 512));
+
+    // buffers that can't hold everything stop at the last whole block
+    struct iovec short_in = {dest[0], 2 * 512 + 10};
+    ASSERT_EQ(2u, block_store_readv(bs, ids, 6, &short_in, 1));
+
+    // a bad id stops it right there
+    const unsigned bad_ids[3] = {200, 5, 201};
+    struct iovec whole = {dest[0], 3 * 512};
+    ASSERT_EQ(1u, block_store_writev(bs, bad_ids, 3, &whole, 1));
+    ASSERT_EQ(1u, block_store_readv(bs, bad_ids, 3, &whole, 1));
+
+    // bad values
+    ASSERT_EQ(0u, block_store_readv(NULL, ids, 6, in, 2));
+    ASSERT_EQ(0u, block_store_readv(bs, NULL, 6, in, 2));
+    ASSERT_EQ(0u, block_store_readv(bs, ids, 6, NULL, 2));
+    ASSERT_EQ(0u, block_store_writev(bs, ids, 6, in, 0));
+
+    block_store_close(bs);
+}
+
+TEST(bs_geometry, basic_use) {
+    // 4K blocks, 10000 of them, the FBM fits in one block
+    block_store_t *bs = block_store_create_geometry("test_r.bs", 4096, 10000);
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(4096u, block_store_get_block_size(bs));
+    ASSERT_EQ(10000u, block_store_get_block_count(bs));
+    ASSERT_EQ(1u, block_store_get_data_start(bs));
+
+    ASSERT_FALSE(block_store_request(bs, 0));
+    ASSERT_TRUE(block_store_request(bs, 9999));
+    ASSERT_FALSE(block_store_request(bs, 10000));
+    unsigned block = block_store_allocate(bs);
+    ASSERT_EQ(1u, block);
+
+    uint8_t data[2][4096];
+    memset(data[0], 0x3C, 4096);
+    ASSERT_TRUE(block_store_write(bs, 9999, data[0]));
+    void *user = block_store_get_user_area(bs);
+    ASSERT_NE(nullptr, user);
+    memcpy(user, "superblock", 11);
+    block_store_close(bs);
+
+    // the geometry (and user area) comes back from the header
+    bs = block_store_open("test_r.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(4096u, block_store_get_block_size(bs));
+    ASSERT_EQ(10000u, block_store_get_block_count(bs));
+    ASSERT_EQ(0, memcmp(block_store_get_user_area(bs), "superblock", 11));
+    ASSERT_TRUE(block_store_read(bs, 9999, data[1]));
+    ASSERT_EQ(0, memcmp(data[0], data[1], 4096));
+    ASSERT_FALSE(block_store_request(bs, 9999));
+    ASSERT_EQ(2u, block_store_allocate(bs));
+    block_store_close(bs);
+
+    // the default geometry hasn't changed
+    bs = block_store_create("test_r.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(512u, block_store_get_block_size(bs));
+    ASSERT_EQ(65536u, block_store_get_block_count(bs));
+    ASSERT_EQ(16u, block_store_get_data_start(bs));
+    block_store_close(bs);
+}
+
+TEST(bs_geometry, bad_values) {
+    ASSERT_EQ(nullptr, block_store_create_geometry(NULL, 512, 65536));
+    ASSERT_EQ(nullptr, block_store_create_geometry("test_s.bs", 256, 65536));
+    ASSERT_EQ(nullptr, block_store_create_geometry("test_s.bs", 1000, 65536));
+    ASSERT_EQ(nullptr, block_store_create_geometry("test_s.bs", 131072, 65536));
+    ASSERT_EQ(nullptr, block_store_create_geometry("test_s.bs", 512, 1));
+    ASSERT_EQ(nullptr, block_store_create_geometry("test_s.bs", 512, ((size_t) 1 << 32) + 1));
+    ASSERT_EQ(0u, block_store_get_block_size(NULL));
+    ASSERT_EQ(0u, block_store_get_block_count(NULL));
+    ASSERT_EQ(nullptr, block_store_get_user_area(NULL));
+}
+
+TEST(bs_geometry, headerless_file) {
+    // what block_store_create used to make, just the blocks with no header in front
+    FILE *file = fopen("test_t.bs", "w");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(0, ftruncate(fileno(file), 65536 * 512));
+    uint8_t fbm[2] = {0xFF, 0xFF};
+    ASSERT_EQ(2u, fwrite(fbm, 1, 2, file));
+    fclose(file);
+
+    block_store_t *bs = block_store_open("test_t.bs");
+    ASSERT_NE(nullptr, bs);
+    ASSERT_EQ(512u, block_store_get_block_size(bs));
+    ASSERT_EQ(16u, block_store_get_data_start(bs));
+    ASSERT_EQ(nullptr, block_store_get_user_area(bs));
+    ASSERT_EQ(16u, block_store_allocate(bs));
+    block_store_close(bs);
+}
+
+TEST(bs_allocate, threads) {
+    block_store_t *bs = block_store_create("test_t.bs");
+    ASSERT_NE(nullptr, bs);
+    const int thread_count = 8;
+    std::vector<std::vector<unsigned>> got(thread_count);
+    std::vector<std::thread> threads;
+
+    // every thread allocates until the device is full, singles and extents mixed
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (unsigned i = 0;; ++i) {
+                unsigned start, count = 1;
+                if (i % 4 == 0 ? !block_store_allocate_extent(bs, 5, 1, &start, &count)
+                               : (start = block_store_allocate(bs)) == 0) {
+                    break;
+                }
+                for (unsigned block = start; block < start + count; ++block) {
+                    got[t].push_back(block);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    ASSERT_EQ(65536u, block_store_get_used_blocks(bs));
+    std::vector<int> owners(65536, 0);
+    for (const auto &blocks : got) {
+        for (unsigned block : blocks) {
+            ASSERT_GE(block, 16u);
+            ++owners[block];
+        }
+    }
+    for (unsigned block = 16; block < 65536; ++block) {
+        ASSERT_EQ(1, owners[block]);
+    }
+
+    // and gives everything back, the same way it came out
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < got[t].size(); ++i) {
+                if (i % 2) {
+                    block_store_release(bs, got[t][i]);
+                } else {
+                    block_store_release_range(bs, got[t][i], 1);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(16u, block_store_get_used_blocks(bs));
     block_store_close(bs);
 }
 
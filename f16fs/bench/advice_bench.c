@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "f16fs.h"
+
+// A big file to stream through and pick at, and a pile of small ones
+#define BIG_SIZE (128 * 1024 * 1024)
+#define CHUNK (256 * 1024)
+#define RANDOM_READS 8192
+#define RANDOM_SIZE 4096
+#define SMALL_FILES 500
+#define SMALL_SIZE 4096
+
+typedef struct {
+    const char *name;
+    unsigned advice;
+} advice_mode_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long faults(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+// Gets the image out of the page cache, so every mode starts cold
+static void evict(const char *image) {
+    int fd = open(image, O_RDONLY);
+    if (fd != -1) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static bool build(const char *image, uint8_t *buffer) {
+    fs_geometry_t geometry = {4096, 65536, 1024, true, 0};
+    F16FS_t *fs = fs_format_geometry(image, &geometry);
+    if (!fs || fs_create(fs, "/big", FS_REGULAR) < 0) {
+        return false;
+    }
+    int fd = fs_open(fs, "/big");
+    bool built = fd >= 0 && fs_write(fs, fd, buffer, BIG_SIZE) == BIG_SIZE && fs_close(fs, fd) == 0;
+    char path[32];
+    for (int f = 0; built && f < SMALL_FILES; ++f) {
+        snprintf(path, sizeof(path), "/small%d", f);
+        built = fs_create(fs, path, FS_REGULAR) == 0 && (fd = fs_open(fs, path)) >= 0 &&
+                fs_write(fs, fd, buffer + f, SMALL_SIZE) == SMALL_SIZE && fs_close(fs, fd) == 0;
+    }
+    return fs_unmount(fs) == 0 && built;
+}
+
+// One workload from a cold mount, MB/s and page faults through *fault_count, negative if it failed
+static double run(const char *image, unsigned advice, int workload, uint8_t *buffer, long *fault_count) {
+    evict(image);
+    const long faults_before = faults();
+    const double start = now_sec();
+    F16FS_t *fs = fs_mount_advised(image, advice);
+    if (!fs) {
+        return -1;
+    }
+    size_t moved = 0;
+    bool failed = false;
+    if (workload < 2) {
+        int fd = fs_open(fs, "/big");
+        failed = fd < 0;
+        if (workload == 0) {
+            for (size_t offset = 0; !failed && offset < BIG_SIZE; offset += CHUNK) {
+                failed = fs_pread(fs, fd, buffer, CHUNK, offset) != CHUNK;
+                moved += CHUNK;
+            }
+        } else {
+            srand(0x5EED);
+            for (int r = 0; !failed && r < RANDOM_READS; ++r) {
+                off_t offset = (off_t)(rand() % (BIG_SIZE / RANDOM_SIZE)) * RANDOM_SIZE;
+                failed = fs_pread(fs, fd, buffer, RANDOM_SIZE, offset) != RANDOM_SIZE;
+                moved += RANDOM_SIZE;
+            }
+        }
+    } else {
+        char path[32];
+        for (int f = 0; !failed && f < SMALL_FILES; ++f) {
+            snprintf(path, sizeof(path), "/small%d", f);
+            int fd = fs_open(fs, path);
+            failed = fd < 0 || fs_read(fs, fd, buffer, SMALL_SIZE) != SMALL_SIZE || fs_close(fs, fd) < 0;
+            moved += SMALL_SIZE;
+        }
+    }
+    failed = fs_unmount(fs) < 0 || failed;
+    const double elapsed = now_sec() - start;
+    *fault_count = faults() - faults_before;
+    return failed ? -1 : moved / 1e6 / elapsed;
+}
+
+int main(void) {
+    const char *image = "advice_bench.f16fs";
+    uint8_t *buffer = malloc(BIG_SIZE);
+    if (!buffer) {
+        return 1;
+    }
+    for (size_t i = 0; i < BIG_SIZE; ++i) {
+        buffer[i] = (uint8_t)(i * 31 + i / 4096);
+    }
+    if (!build(image, buffer)) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+
+    const advice_mode_t modes[] = {
+        {"normal", FS_ADVISE_NORMAL},
+        {"sequential", FS_ADVISE_SEQUENTIAL},
+        {"random", FS_ADVISE_RANDOM},
+        {"prefetch", FS_ADVISE_PREFETCH},
+        {"hugepage", FS_ADVISE_HUGEPAGE},
+        {"seq+huge", FS_ADVISE_SEQUENTIAL | FS_ADVISE_PREFETCH | FS_ADVISE_HUGEPAGE},
+        {"rand+pre", FS_ADVISE_RANDOM | FS_ADVISE_PREFETCH},
+    };
+    const char *workloads[] = {"stream", "random 4K", "small files"};
+
+    printf("%-12s", "mode");
+    for (int w = 0; w < 3; ++w) {
+        printf(" %12s MB/s %8s", workloads[w], "faults");
+    }
+    printf("\n");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        printf("%-12s", modes[m].name);
+        for (int w = 0; w < 3; ++w) {
+            long fault_count = 0;
+            const double rate = run(image, modes[m].advice, w, buffer, &fault_count);
+            if (rate < 0) {
+                fprintf(stderr, "\n%s failed\n", modes[m].name);
+                return 1;
+            }
+            printf(" %17.1f %8ld", rate, fault_count);
+        }
+        printf("\n");
+    }
+
+    free(buffer);
+    remove(image);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "block_store.h"
+#include "f16fs.h"
+
+// Decimal MB, has to fit under the ~33.4 MB max file size pointers allow
+#define FILE_SIZE (32 * 1000 * 1000)
+#define CHUNK (128 * 1024)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Moves total bytes through fd in CHUNK sized calls, returns MB/s or a negative number on a short transfer
+static double transfer(F16FS_t *fs, int fd, uint8_t *buffer, size_t total, bool writing) {
+    const double start = now_sec();
+    for (size_t done = 0; done < total;) {
+        size_t want = total - done < CHUNK ? total - done : CHUNK;
+        ssize_t moved = writing ? fs_write(fs, fd, buffer + done, want) : fs_read(fs, fd, buffer + done, want);
+        if (moved != (ssize_t) want) {
+            return -1;
+        }
+        done += want;
+    }
+    return total / 1e6 / (now_sec() - start);
+}
+
+// Blocks in use on the unmounted image
+static size_t used_blocks(const char *image) {
+    block_store_t *bs = block_store_open(image);
+    size_t used = block_store_get_used_blocks(bs);
+    block_store_close(bs);
+    return used;
+}
+
+int main(void) {
+    const char *image = "extent_bench.f16fs";
+    static const char *const names[] = {"pointers", "extents"};
+    uint8_t *source = malloc(FILE_SIZE);
+    uint8_t *sink = malloc(FILE_SIZE);
+    if (!source || !sink) {
+        return 1;
+    }
+    for (size_t i = 0; i < FILE_SIZE; ++i) {
+        source[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    printf("%10s %14s %12s %12s %12s\n", "mapping", "data blocks", "meta blocks", "write MB/s", "read MB/s");
+    for (int extents = 0; extents < 2; ++extents) {
+        fs_geometry_t geometry = {512, 65536, 256, extents, 0};
+        F16FS_t *fs = fs_format_geometry(image, &geometry);
+        if (!fs || fs_create(fs, "/file", FS_REGULAR) < 0) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+        fs_unmount(fs);
+        const size_t empty = used_blocks(image);
+
+        fs = fs_mount(image);
+        int fd = fs_open(fs, "/file");
+        double write_rate = transfer(fs, fd, source, FILE_SIZE, true);
+        // remount so the read starts from nothing cached
+        fs_unmount(fs);
+        const size_t full = used_blocks(image);
+        fs = fs_mount(image);
+        fd = fs_open(fs, "/file");
+        double read_rate = transfer(fs, fd, sink, FILE_SIZE, false);
+        if (write_rate < 0 || read_rate < 0 || memcmp(source, sink, FILE_SIZE) != 0) {
+            fprintf(stderr, "%s did not round trip\n", names[extents]);
+            return 1;
+        }
+        const size_t data_blocks = (FILE_SIZE + 511) / 512;
+        printf("%10s %14zu %12zu %12.1f %12.1f\n", names[extents], data_blocks, full - empty - data_blocks,
+               write_rate, read_rate);
+        fs_close(fs, fd);
+        fs_unmount(fs);
+    }
+
+    remove(image);
+    free(source);
+    free(sink);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "f16fs.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Resident MB right now, the second field of /proc/self/statm is resident pages
+static double resident_mb(void) {
+    long size, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%ld %ld", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(file);
+    }
+    return (double) resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+int main(void) {
+    const char *image = "format_bench.f16fs";
+    // the default, then the same blocks bigger, then a lot more of them
+    const fs_geometry_t geometries[] = {
+        {512, 65536, 256, false, 0},
+        {4096, 65536, 256, false, 0},
+        {4096, 262144, 4096, true, 1024},
+    };
+
+    printf("%10s %10s %10s %12s %12s %12s\n", "block", "blocks", "image MB", "format ms", "RSS +MB", "unmount ms");
+    for (size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); ++g) {
+        const fs_geometry_t *geometry = &geometries[g];
+        const double resident = resident_mb();
+        double start = now_sec();
+        F16FS_t *fs = fs_format_geometry(image, geometry);
+        const double format_ms = (now_sec() - start) * 1e3;
+        if (!fs) {
+            fprintf(stderr, "format failed\n");
+            return 1;
+        }
+        // while it's still mapped, that's when the pages count
+        const double grown = resident_mb() - resident;
+        start = now_sec();
+        if (fs_unmount(fs) < 0) {
+            fprintf(stderr, "unmount failed\n");
+            return 1;
+        }
+        const double unmount_ms = (now_sec() - start) * 1e3;
+        printf("%10zu %10zu %10zu %12.2f %12.2f %12.2f\n", geometry->block_size, geometry->block_count,
+               geometry->block_size * geometry->block_count >> 20, format_ms, grown, unmount_ms);
+        remove(image);
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f16fs.h"
+
+// Every file gets rewritten between syncs, so there's always plenty dirty that isn't the synced file's
+#define FILES 64
+#define FILE_SIZE (64 * 1024)
+#define ROUNDS 20
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ms per sync after rewriting every file, fs_fsync on one of them or fs_sync on the lot, negative if anything failed
+static double run(F16FS_t *fs, const int *fds, const uint8_t *data, const bool whole) {
+    double synced = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int f = 0; f < FILES; ++f) {
+            if (fs_pwrite(fs, fds[f], data + round + f, FILE_SIZE, 0) != FILE_SIZE) {
+                return -1;
+            }
+        }
+        const double start = now_sec();
+        if ((whole ? fs_sync(fs) : fs_fsync(fs, fds[round % FILES])) < 0) {
+            return -1;
+        }
+        synced += now_sec() - start;
+    }
+    return synced * 1e3 / ROUNDS;
+}
+
+int main(void) {
+    const char *image = "fsync_bench.f16fs";
+    uint8_t *data = malloc(FILE_SIZE + ROUNDS + FILES);
+    if (!data) {
+        return 1;
+    }
+    for (size_t i = 0; i < FILE_SIZE + ROUNDS + FILES; ++i) {
+        data[i] = (uint8_t) i;
+    }
+
+    printf("%10s %12s %12s\n", "journal", "fsync ms", "sync ms");
+    const size_t journals[] = {0, 64};
+    for (size_t j = 0; j < sizeof(journals) / sizeof(journals[0]); ++j) {
+        fs_geometry_t geometry = {512, 65536, 256, false, journals[j]};
+        F16FS_t *fs = fs_format_geometry(image, &geometry);
+        if (!fs) {
+            fprintf(stderr, "format failed\n");
+            return 1;
+        }
+        int fds[FILES];
+        for (int f = 0; f < FILES; ++f) {
+            char path[32];
+            snprintf(path, sizeof(path), "/file%d", f);
+            if (fs_create(fs, path, FS_REGULAR) < 0 || (fds[f] = fs_open(fs, path)) < 0) {
+                fprintf(stderr, "setup failed\n");
+                return 1;
+            }
+        }
+        const double one = run(fs, fds, data, false);
+        const double all = run(fs, fds, data, true);
+        if (one < 0 || all < 0) {
+            fprintf(stderr, "%zu block journal failed\n", journals[j]);
+            return 1;
+        }
+        printf("%10zu %12.3f %12.3f\n", journals[j], one, all);
+        fs_unmount(fs);
+    }
+
+    free(data);
+    remove(image);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f16fs.h"
+
+// Small files, so the metadata (and the journal commits for it) is most of the work
+#define FILES 250
+#define FILE_SIZE 4096
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// us per file to create, open, write and close FILES of them, then remove them all, negative if anything failed
+static double run(const char *image, size_t journal_blocks, double *remove_us) {
+    fs_geometry_t geometry = {512, 65536, 256, false, journal_blocks};
+    F16FS_t *fs = fs_format_geometry(image, &geometry);
+    if (!fs) {
+        return -1;
+    }
+    uint8_t data[FILE_SIZE];
+    memset(data, 'j', sizeof(data));
+    char path[32];
+    bool failed = false;
+
+    double start = now_sec();
+    for (int f = 0; f < FILES && !failed; ++f) {
+        snprintf(path, sizeof(path), "/file%d", f);
+        int fd = fs_create(fs, path, FS_REGULAR) < 0 ? -1 : fs_open(fs, path);
+        failed = fd < 0 || fs_write(fs, fd, data, FILE_SIZE) != FILE_SIZE || fs_close(fs, fd) < 0;
+    }
+    const double create_us = (now_sec() - start) * 1e6 / FILES;
+
+    start = now_sec();
+    for (int f = 0; f < FILES && !failed; ++f) {
+        snprintf(path, sizeof(path), "/file%d", f);
+        failed = fs_remove(fs, path) < 0;
+    }
+    *remove_us = (now_sec() - start) * 1e6 / FILES;
+    fs_unmount(fs);
+    return failed ? -1 : create_us;
+}
+
+int main(void) {
+    const char *image = "journal_bench.f16fs";
+    const size_t journals[] = {0, 64, 1024};
+
+    printf("%10s %14s %14s\n", "journal", "create us", "remove us");
+    for (size_t j = 0; j < sizeof(journals) / sizeof(journals[0]); ++j) {
+        double remove_us;
+        const double create_us = run(image, journals[j], &remove_us);
+        if (create_us < 0) {
+            fprintf(stderr, "%zu block journal failed\n", journals[j]);
+            return 1;
+        }
+        printf("%10zu %14.1f %14.1f\n", journals[j], create_us, remove_us);
+    }
+    remove(image);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f16fs.h"
+
+// Entries in the directory being searched, 254 uses up every inode left after root and /dir
+static const int sizes[] = {1, 7, 32, 128, 254};
+#define LOOKUPS 200000
+#define MAX_DEPTH 16
+
+// Long shared prefix so a plain strcmp has to walk most of every name before it can say no
+#define NAME_FORMAT "/dir/an_entry_name_with_a_long_shared_prefix_%03d"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ns per resolution of path, returns a negative number if the result isn't what was expected
+static double time_lookup(F16FS_t *fs, const char *path, int expect_found, int (*traverse)(F16FS_t *, const char *)) {
+    const double start = now_sec();
+    for (int i = 0; i < LOOKUPS; ++i) {
+        if ((traverse(fs, path) >= 0) != expect_found) {
+            return -1;
+        }
+    }
+    return (now_sec() - start) * 1e9 / LOOKUPS;
+}
+
+int main(void) {
+    const char *image = "path_bench.f16fs";
+    char path[FS_FNAME_MAX * 2];
+
+    printf("%8s %14s %14s %10s\n", "entries", "hit ns", "miss ns", "dcache %");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        F16FS_t *fs = fs_format(image);
+        if (!fs || fs_create(fs, "/dir", FS_DIRECTORY) < 0) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+        for (int e = 0; e < sizes[s]; ++e) {
+            snprintf(path, sizeof(path), NAME_FORMAT, e);
+            if (fs_create(fs, path, FS_REGULAR) < 0) {
+                fprintf(stderr, "could not create %s\n", path);
+                return 1;
+            }
+        }
+
+        // last one created is the last one a linear search gets to
+        snprintf(path, sizeof(path), NAME_FORMAT, sizes[s] - 1);
+        double hit = time_lookup(fs, path, 1, existing_traversal);
+        snprintf(path, sizeof(path), NAME_FORMAT, 999);
+        double miss = time_lookup(fs, path, 0, existing_traversal);
+        if (hit < 0 || miss < 0) {
+            fprintf(stderr, "lookup gave the wrong answer\n");
+            return 1;
+        }
+        dcache_stats_t stats;
+        fs_dcache_stats(fs, &stats);
+        size_t answered = stats.hits + stats.negative_hits;
+        printf("%8d %14.1f %14.1f %10.2f\n", sizes[s], hit, miss, 100.0 * answered / (answered + stats.misses));
+        fs_unmount(fs);
+    }
+
+    // /l00/l01/.../l15, resolving the first depth components of it
+    char deep[MAX_DEPTH * 4 + 1] = "";
+    F16FS_t *fs = fs_format(image);
+    if (!fs) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    printf("\n%8s %14s\n", "depth", "ns");
+    for (int depth = 1; depth <= MAX_DEPTH; ++depth) {
+        snprintf(deep + (depth - 1) * 4, 5, "/l%02d", depth - 1);
+        if (fs_create(fs, deep, FS_DIRECTORY) < 0) {
+            fprintf(stderr, "could not create %s\n", deep);
+            return 1;
+        }
+        double ns = time_lookup(fs, deep, 1, existing_traversal_directory);
+        if (ns < 0) {
+            fprintf(stderr, "lookup gave the wrong answer\n");
+            return 1;
+        }
+        printf("%8d %14.1f\n", depth, ns);
+    }
+    fs_unmount(fs);
+
+    remove(image);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f16fs.h"
+
+// Decimal MB, the biggest one has to fit under the ~33.4 MB max file size
+static const size_t sizes[] = {1000 * 1000, 16 * 1000 * 1000, 32 * 1000 * 1000};
+#define CHUNK (128 * 1024)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Moves total bytes through fd in CHUNK sized calls, returns MB/s or a negative number on a short transfer
+static double transfer(F16FS_t *fs, int fd, uint8_t *buffer, size_t total, bool writing) {
+    const double start = now_sec();
+    for (size_t done = 0; done < total;) {
+        size_t want = total - done < CHUNK ? total - done : CHUNK;
+        ssize_t moved = writing ? fs_write(fs, fd, buffer + done, want) : fs_read(fs, fd, buffer + done, want);
+        if (moved != (ssize_t) want) {
+            return -1;
+        }
+        done += want;
+    }
+    return total / 1e6 / (now_sec() - start);
+}
+
+int main(void) {
+    const char *image = "seq_io_bench.f16fs";
+    uint8_t *source = malloc(sizes[2]);
+    uint8_t *sink = malloc(sizes[2]);
+    if (!source || !sink) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizes[2]; ++i) {
+        source[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    printf("%10s %12s %12s\n", "size", "write MB/s", "read MB/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        // fresh image every time so earlier files don't eat the space
+        F16FS_t *fs = fs_format(image);
+        if (!fs || fs_create(fs, "/file", FS_REGULAR) < 0) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+        int fd = fs_open(fs, "/file");
+        double write_rate = transfer(fs, fd, source, sizes[s], true);
+        fs_seek(fs, fd, 0, FS_SEEK_SET);
+        double read_rate = transfer(fs, fd, sink, sizes[s], false);
+        if (write_rate < 0 || read_rate < 0 || memcmp(source, sink, sizes[s]) != 0) {
+            fprintf(stderr, "%zu bytes did not round trip\n", sizes[s]);
+            return 1;
+        }
+        printf("%8zuMB %12.1f %12.1f\n", sizes[s] / (1000 * 1000), write_rate, read_rate);
+        fs_close(fs, fd);
+        fs_unmount(fs);
+    }
+
+    remove(image);
+    free(source);
+    free(sink);
+    return 0;
+}
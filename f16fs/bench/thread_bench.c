@@ -0,0 +1,111 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "f16fs.h"
+
+// Every thread gets a file of its own, so nothing but the block store is shared
+#define MAX_THREADS 8
+#define FILE_SIZE (4 * 1024 * 1024)
+#define CHUNK (64 * 1024)
+#define PASSES 8
+
+typedef struct {
+    F16FS_t *fs;
+    int fd;
+    bool writing;
+    bool failed;
+    uint8_t *buffer;
+} worker_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// PASSES trips over the worker's file in CHUNK sized pread/pwrite calls
+static void *work(void *arg) {
+    worker_t *worker = arg;
+    for (int pass = 0; pass < PASSES; ++pass) {
+        for (size_t offset = 0; offset < FILE_SIZE; offset += CHUNK) {
+            ssize_t moved = worker->writing
+                                ? fs_pwrite(worker->fs, worker->fd, worker->buffer + offset, CHUNK, offset)
+                                : fs_pread(worker->fs, worker->fd, worker->buffer + offset, CHUNK, offset);
+            if (moved != CHUNK) {
+                worker->failed = true;
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Runs threads workers at once, returns aggregate MB/s or a negative number if any of them came up short
+static double run(worker_t *workers, int threads, bool writing) {
+    pthread_t ids[MAX_THREADS];
+    const double start = now_sec();
+    for (int t = 0; t < threads; ++t) {
+        workers[t].writing = writing;
+        workers[t].failed = false;
+        pthread_create(&ids[t], NULL, work, &workers[t]);
+    }
+    bool failed = false;
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        failed = failed || workers[t].failed;
+    }
+    const double elapsed = now_sec() - start;
+    return failed ? -1 : (double) threads * PASSES * FILE_SIZE / 1e6 / elapsed;
+}
+
+int main(void) {
+    const char *image = "thread_bench.f16fs";
+    fs_geometry_t geometry = {4096, 16384, 256, true, 0};
+    F16FS_t *fs = fs_format_geometry(image, &geometry);
+    if (!fs) {
+        fprintf(stderr, "format failed\n");
+        return 1;
+    }
+
+    worker_t workers[MAX_THREADS];
+    for (int t = 0; t < MAX_THREADS; ++t) {
+        char path[32];
+        snprintf(path, sizeof(path), "/file%d", t);
+        workers[t].fs = fs;
+        workers[t].buffer = malloc(FILE_SIZE);
+        if (!workers[t].buffer || fs_create(fs, path, FS_REGULAR) < 0 || (workers[t].fd = fs_open(fs, path)) < 0) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+        memset(workers[t].buffer, 'a' + t, FILE_SIZE);
+        // lay the file down first so the timed writes are overwrites
+        if (fs_pwrite(fs, workers[t].fd, workers[t].buffer, FILE_SIZE, 0) != FILE_SIZE) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+    }
+
+    printf("%8s %12s %12s\n", "threads", "pread MB/s", "pwrite MB/s");
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        double read_rate = run(workers, threads, false);
+        double write_rate = run(workers, threads, true);
+        if (read_rate < 0 || write_rate < 0) {
+            fprintf(stderr, "%d threads came up short\n", threads);
+            return 1;
+        }
+        printf("%8d %12.1f %12.1f\n", threads, read_rate, write_rate);
+    }
+
+    for (int t = 0; t < MAX_THREADS; ++t) {
+        fs_close(fs, workers[t].fd);
+        free(workers[t].buffer);
+    }
+    fs_unmount(fs);
+    remove(image);
+    return 0;
+}
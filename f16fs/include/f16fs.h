@@ -8,10 +8,13 @@ extern "C" {
 
 #include <dyn_array.h>
 
+//one F16FS_t can be shared by threads, anything but fs_unmount may be called concurrently
+//reads and writes on different files run side by side, creating, removing and moving files take turns
+//calls through one descriptor that use its R/W position take turns too, fs_pread/fs_pwrite don't have to
 typedef struct F16FS F16FS_t;
 typedef struct inode inode_t;
 
-typedef enum { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END } seek_t;
+typedef enum { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END, FS_SEEK_DATA, FS_SEEK_HOLE } seek_t;
 
 typedef enum { FS_REGULAR, FS_DIRECTORY } file_t;
 
@@ -27,6 +30,32 @@ typedef struct {
 
 
 
+//counters for the path lookup cache
+typedef struct {
+	size_t hits;			//name found in the cache
+	size_t negative_hits;	//cache already knew the name wasn't there
+	size_t misses;			//had to search the directory
+} dcache_stats_t;
+
+//shape of a file system, picked at format time and stored in its superblock
+typedef struct {
+	size_t block_size;		//bytes per block, power of 2 from 512 to 65536
+	size_t block_count;		//blocks on the device, pointers go 32-bit past 65536
+	size_t inode_count;		//rounded up to fill the last inode table block
+	bool extents;			//map file blocks with extents (runs) instead of direct/indirect pointers
+	size_t journal_blocks;	//blocks set aside for the metadata journal, 0 for no journal, at least 32 otherwise
+} fs_geometry_t;
+
+//mount options for fs_mount_advised, hints for how the file system is going to be used, or them together
+//SEQUENTIAL and RANDOM can't both be given
+typedef enum {
+	FS_ADVISE_NORMAL = 0x0,
+	FS_ADVISE_SEQUENTIAL = 0x1,	//mostly streaming through big files, read far ahead
+	FS_ADVISE_RANDOM = 0x2,		//mostly small files and scattered I/O, don't read ahead
+	FS_ADVISE_PREFETCH = 0x4,	//read the free block map and inode table in at mount, before they're needed
+	FS_ADVISE_HUGEPAGE = 0x8	//transparent huge pages for file data, where the kernel can
+} fs_advice_t;
+
 //struct for a file descriptor entry 
 typedef struct {
 	int inode_index; //file reference 
@@ -42,6 +71,28 @@ void test_inode_size();
 ///
 F16FS_t *fs_format(const char *path);
 
+///
+/// Formats (and mounts) an F16FS file with the given geometry
+///   fs_format is this with 512 byte blocks, 65536 blocks, 256 inodes and block pointers
+///   Extent file systems describe a contiguous file with a few extents, and files are only limited by free space
+///   With a journal, every call's changes to inodes and directories commit together, and fs_mount replays
+///   whatever a crash kept from reaching its home blocks. File data itself isn't journaled
+///   Long writes are the exception, they commit a batch of blocks at a time, and when other threads are waiting
+///   to change metadata they get their turn before the batch's data is copied in
+/// \param fname The file to format
+/// \param geometry Block size, block count and inode count to use
+/// \return Mounted F16FS object, NULL on error
+///
+F16FS_t *fs_format_geometry(const char *path, const fs_geometry_t *geometry);
+
+///
+/// Reports the geometry a mounted F16FS was formatted with
+/// \param fs The F16FS object to inspect
+/// \param geometry Filled in with the geometry
+/// \return 0 on success, < 0 on error
+///
+int fs_get_geometry(F16FS_t *fs, fs_geometry_t *geometry);
+
 ///
 /// Mounts an F16FS object and prepares it for use
 /// \param fname The file to mount
@@ -49,13 +100,43 @@ F16FS_t *fs_format(const char *path);
 ///
 F16FS_t *fs_mount(const char *path);
 
+///
+/// Mounts an F16FS object with access hints and prepares it for use
+///   The hints only last as long as the mount, and a kernel ignoring them doesn't fail it
+/// \param fname The file to mount
+/// \param advice fs_advice_t flags
+/// \return Mounted F16FS object, NULL on error
+///
+F16FS_t *fs_mount_advised(const char *path, unsigned advice);
+
 ///
 /// Unmounts the given object and frees all related resources
+///   Everything is freed even if the final sync fails, that's still reported as a failure
 /// \param fs The F16FS object to unmount
 /// \return 0 on success, < 0 on failure
 ///
 int fs_unmount(F16FS_t *fs);
 
+///
+/// Writes any inodes changed since the last sync back to the F16FS file, and waits for everything
+/// written since then to be on disk
+///   Inodes are cached in memory while mounted, fs_unmount syncs as well
+///   With a journal, this empties the journal too
+/// \param fs The F16FS object to sync
+/// \return 0 on success, < 0 on failure
+///
+int fs_sync(F16FS_t *fs);
+
+///
+/// Waits for one file's data and inode to be on disk, without touching the rest of the F16FS file
+///   Only the blocks the file has written since they were last synced go out
+///   The file's directory entry isn't covered, without a journal a new file needs fs_sync for that
+/// \param fs The F16FS containing the file
+/// \param fd The file to sync
+/// \return 0 on success, < 0 on failure
+///
+int fs_fsync(F16FS_t *fs, int fd);
+
 ///
 /// Creates a new file at the specified location
 ///   Directories along the path that do not exist are NOT created
@@ -76,6 +157,25 @@ int fs_create(F16FS_t *fs, const char *path, file_t type);
 ///
 int fs_open(F16FS_t *fs, const char *path);
 
+///
+/// Sets how many descriptors may be open at once, the table grows toward it as needed
+///   Defaults to 256, can't go below the slots the table already has
+/// \param fs The F16FS object to adjust
+/// \param limit Maximum number of open descriptors
+/// \return 0 on success, < 0 on failure
+///
+int fs_set_fd_limit(F16FS_t *fs, size_t limit);
+
+///
+/// Gives reads an async queue depth requests deep, so every block an fs_read or fs_pread needs
+///   goes to the block store in one submission (through io_uring where the kernel has it) instead of one at a time
+///   Worth it for images bigger than the page cache, cached ones are faster read in place. Defaults to 0, no queue
+/// \param fs The F16FS object to adjust
+/// \param depth Most block requests outstanding at once, up to 4096, 0 to go back to reading in place
+/// \return 0 on success, < 0 on failure
+///
+int fs_set_queue_depth(F16FS_t *fs, unsigned depth);
+
 ///
 /// Closes the given file descriptor
 /// \param fs The F16FS containing the file
@@ -86,8 +186,10 @@ int fs_close(F16FS_t *fs, int fd);
 
 ///
 /// Moves the R/W position of the given descriptor to the given location
-///   Files cannot be seeked past EOF or before BOF (beginning of file)
-///   Seeking past EOF will seek to EOF, seeking before BOF will seek to BOF
+///   Files can be seeked past EOF, writing there leaves a hole, but not before BOF (beginning of file)
+///   Seeking before BOF will seek to BOF
+///   FS_SEEK_DATA/FS_SEEK_HOLE move to the first data/hole at or after offset (from BOF), EOF counts as a hole
+///   and both are errors when offset is at or past EOF
 /// \param fs The F16FS containing the file
 /// \param fd The descriptor to seek
 /// \param offset Desired offset relative to whence
@@ -99,6 +201,7 @@ off_t fs_seek(F16FS_t *fs, int fd, off_t offset, seek_t whence);
 ///
 /// Reads data from the file linked to the given descriptor
 ///   Reading past EOF returns data up to EOF
+///   Holes read as zeros
 ///   R/W position in incremented by the number of bytes read
 /// \param fs The F16FS containing the file
 /// \param fd The file to read from
@@ -122,6 +225,32 @@ ssize_t fs_read(F16FS_t *fs, int fd, void *dst, size_t nbyte);
 ///
 ssize_t fs_write(F16FS_t *fs, int fd, const void *src, size_t nbyte);
 
+///
+/// Reads data from the file linked to the given descriptor, starting at offset instead of the R/W position
+///   Works like fs_read otherwise, but the R/W position is neither used nor changed
+///   A range that runs past the largest size a file can have is an error
+/// \param fs The F16FS containing the file
+/// \param fd The file to read from
+/// \param dst The buffer to write to
+/// \param nbyte The number of bytes to read
+/// \param offset Offset from BOF to read from
+/// \return number of bytes read (< nbyte IFF read passes EOF), < 0 on error
+///
+ssize_t fs_pread(F16FS_t *fs, int fd, void *dst, size_t nbyte, off_t offset);
+
+///
+/// Writes data from given buffer to the file linked to the descriptor, starting at offset instead of the R/W position
+///   Works like fs_write otherwise, but the R/W position is neither used nor changed
+///   A range that runs past the largest size a file can have is an error
+/// \param fs The F16FS containing the file
+/// \param fd The file to write to
+/// \param src The buffer to read from
+/// \param nbyte The number of bytes to write
+/// \param offset Offset from BOF to write at
+/// \return number of bytes written (< nbyte IFF out of space), < 0 on error
+///
+ssize_t fs_pwrite(F16FS_t *fs, int fd, const void *src, size_t nbyte, off_t offset);
+
 ///
 /// Deletes the specified file
 ///   Directories can only be removed when empty
@@ -135,13 +264,21 @@ int fs_remove(F16FS_t *fs, const char *path);
 
 ///
 /// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 7 file_record_t structures
+///   Array contains a file_record_t for every entry, directories are not limited to one block
 /// \param fs The F16FS containing the file
 /// \param path Absolute path to the directory to inspect
 /// \return dyn_array of file records, NULL on error
 ///
 dyn_array_t *fs_get_dir(F16FS_t *fs, const char *path);
 
+///
+/// Reports how path components have been resolved since mount
+/// \param fs The F16FS object to inspect
+/// \param stats Filled in with the lookup counters
+/// \return 0 on success, < 0 on error
+///
+int fs_dcache_stats(F16FS_t *fs, dcache_stats_t *stats);
+
 int traverse_path(F16FS_t *fs, const char *path, bool fileExists, bool);
 int existing_traversal(F16FS_t *, const char *);
 int creation_traversal(F16FS_t *fs, const char *path);
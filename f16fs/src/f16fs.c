@@ -3,37 +3,307 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "f16fs.h"
 #include "block_store.h"
+#include "bitmap.h"
 
 #define INODE_SIZE 64
-#define INODE_COUNT 256 //this should be fine for formatting the first few blocks I think?
-	 				  //64 byte inode, 512 byte block, so 8 inodes per block? 
+//geometry fs_format uses, 512 byte blocks, 65536 of them and 256 inodes, so 8 inodes per block
+#define DEFAULT_BLOCK_SIZE 512
+#define DEFAULT_BLOCK_COUNT 65536
+#define DEFAULT_INODE_COUNT 256
+#define MAX_INODE_COUNT (1 << 20) //the whole table is cached, this keeps it to 64 MB
 
-#define INODE_BLOCK_COUNT 32
-#define BLOCK_BYTE_COUNT 512
+#define DIR_BLOCK_BYTES 512 //directory blocks are made of 512 byte directory_block_t pieces
 #define FS_NAME_MAX 64
+#define SUPERBLOCK_MAGIC 0x53463631 //"16FS"
+#define BATCH_BLOCKS 256 //block indexes looked up before each batched copy, one pointer block's worth
+#define DCACHE_SIZE 1024 //dentry cache slots, power of 2
+#define FD_TABLE_START 64 //descriptor slots to begin with, the table doubles as needed
+#define FD_LIMIT_DEFAULT 256
+#define FD_LIMIT_MAX (1 << 20)
+#define JOURNAL_MIN_BLOCKS 32
+#define JOURNAL_MAGIC 0x4C4E524A //"JRNL"
+#define JOURNAL_DESC 0x43534544 //"DESC"
+#define JOURNAL_COMMIT 0x54494D43 //"CMIT"
+#define TXN_MAX_BLOCKS 64 //blocks one transaction can change, their copies are allocated at mount
 
 bool write_inode(F16FS_t *, int, inode_t*); 
 
-typedef struct F16FS {
-	file_descriptor_t file_descriptor_table[256];
-	block_store_t *bs;	
-} F16FS_t;
+typedef struct block_map block_map_t;
+typedef struct dir_index dir_index_t;
+typedef struct extent_list extent_list_t;
+
+//one resolved path component, inode_index -1 means the name is known not to be there
+typedef struct {
+	int parent;		//directory searched, -1 if the slot is empty
+	uint32_t hash;
+	int inode_index;
+	char name[FS_NAME_MAX];
+} dentry_t;
+
+//a run of blocks, file blocks logical..logical+length-1 are device blocks start..start+length-1
+typedef struct {
+	uint32_t logical;
+	uint32_t start;
+	uint32_t length;
+} extent_t;
+
+#define INLINE_EXTENTS 2
 
 //int is size 4 bytes i checked
 //enum for file type is 4 bytes
+//block pointers are 0 when there's no block, block 0 is always free block map so it can't be a real one
+//the last 32 bytes are block pointers or extents, whichever the superblock says the fs was formatted with
 typedef struct inode {
-	char meta[36];
+	char meta[16];
 	int refCount;
-	unsigned int file_size;
 	file_t type;
-	short directPtrs[6];
-	short indirectOne; //index for inode
-	short indirectTwo; //index for inode
+	uint64_t file_size;
+	union {
+		struct {
+			uint32_t directPtrs[6];
+			uint32_t indirectOne; //index for inode
+			uint32_t indirectTwo; //index for inode
+		};
+		struct {
+			extent_t extents[INLINE_EXTENTS]; //first two extents, by logical block
+			uint32_t extent_count;	//all of them, the rest live in the extent tree
+			uint32_t extent_root;	//block of leaf block ids, each leaf is packed extent_ts, 0 until needed
+		};
+		uint32_t block_info[8]; //either one, for clearing it
+	};
 } inode_t;		//tested this, comes out to 64 bytes
+_Static_assert(sizeof(inode_t) == INODE_SIZE, "inode must be 64 bytes");
+
+//kept in the block store's user area, says how the rest of the device is laid out
+typedef struct {
+	uint32_t magic;
+	uint32_t block_size;
+	uint64_t block_count;
+	uint32_t inode_count;
+	uint32_t inode_start;	//first block of the inode table
+	uint32_t inode_blocks;
+	uint32_t pointer_width;	//bytes per pointer in pointer blocks, 2 while every block id fits in 16 bits
+	uint32_t flags;
+	uint32_t journal_start;	//these two only mean something with SB_JOURNAL
+	uint32_t journal_blocks;
+} superblock_t;
+
+#define SB_EXTENTS 0x1 //inodes map blocks with extents instead of pointers
+#define SB_JOURNAL 0x2 //metadata changes are logged to the journal before they go home
+
+//first block of the journal, sequence is the transaction the log starts with
+//clean is only set while unmounted, a mount that finds it clear knows the last one never finished
+typedef struct {
+	uint32_t magic;
+	uint32_t clean;
+	uint64_t sequence;
+} journal_header_t;
+
+//a transaction in the log is a descriptor record, the new contents of each block it lists, then a commit record
+//the commit's checksum covers those contents and the descriptor's list of where they go, see journal_record_sum
+//so a transaction that only partly reached the disk never replays
+typedef struct {
+	uint32_t magic;		//JOURNAL_DESC or JOURNAL_COMMIT
+	uint32_t count;		//blocks in the transaction
+	uint64_t sequence;
+	uint32_t checksum;	//commit only
+	uint32_t blocks[];	//descriptor only, where each logged block goes home to
+} journal_record_t;
+
+//a block the open transaction changed, data holds its new contents until the commit writes them home
+//inode table blocks don't use their copy, the commit takes them straight from the inode cache
+typedef struct {
+	unsigned block;
+	bool inode;
+	uint8_t *data;
+} txn_block_t;
+
+//file_blocks calls one of these for each run of blocks a file has
+typedef void (*block_visit_t)(F16FS_t *fs, size_t start, size_t count, void *arg);
+
+//blocks fs_fsync has seen but not synced yet, runs that pick up where the last left off are saved up into one
+typedef struct {
+	size_t start;
+	size_t count;
+	bool ok;
+} sync_run_t;
+
+//links a descriptor into the free list while it's closed, or its inode's open list while it's open
+typedef struct {
+	int next; //-1 ends either list
+	int prev; //open list only, so close can unlink without a search
+} fd_link_t;
+
+//several threads can share one, locks are always taken in this order:
+//ns_lock, fd_lock, a descriptor's map lock, inode_locks, txn_lock, extent_lock, inode_table_lock
+//the block store allocates and releases without locks, so it can be called under any of them
+typedef struct F16FS {
+	//paths, directories, the dcache, inode_map and scratch_map, so creating/removing/moving files takes turns
+	pthread_mutex_t ns_lock;
+	//the descriptor table, shared for reads and writes through a descriptor, exclusive to open/close/remove one
+	pthread_rwlock_t fd_lock;
+	pthread_rwlock_t *inode_locks; //per inode, shared to read a file or seek in it, exclusive to write it
+	pthread_mutex_t extent_lock; //loading extent lists, see extent_list_for
+	pthread_mutex_t inode_table_lock; //copies in and out of inodes, and the dirty flags
+	//the open transaction, a thread holds it from its first metadata change to the end of the call, see txn_join
+	pthread_mutex_t txn_lock;
+	int txn_waiting;			//threads waiting on txn_lock, atomic, see txn_split
+	//these three grow together, fd_capacity entries each, never past fd_limit
+	file_descriptor_t *file_descriptor_table;
+	block_map_t **block_maps; //per descriptor, made on first open of the slot, NULL until then
+	fd_link_t *fd_links;
+	int fd_capacity;
+	int fd_limit;
+	int fd_free;				//first closed descriptor, -1 if every slot is in use
+	int *open_fds;				//first descriptor open on each inode, -1 if none
+	block_store_t *bs;	
+	//geometry, from the superblock
+	size_t block_size;
+	size_t pointer_width;		//2 or 4
+	size_t pointers_per_block;
+	size_t max_file_blocks;		//6 direct + one indirect block + a double indirect block's worth
+	size_t dir_entries_per_block;
+	int inode_count;
+	int inodes_per_block;
+	unsigned inode_start;
+	unsigned inode_blocks;
+	bool extents;				//files are mapped with extents, see extent_list_t
+	size_t extents_per_leaf;
+	size_t max_extents;			//inline ones plus a full extent tree
+	block_map_t *scratch_map;	//for one off lookups that don't belong to a descriptor
+	//maps positional calls borrow when the descriptor's is busy, see io_begin
+	//spare_lock only covers the list, nothing else gets locked while it's held
+	block_map_t *spare_maps;
+	pthread_mutex_t spare_lock;
+	//metadata journal, journal_blocks is 0 on file systems formatted without one
+	unsigned journal_start;
+	unsigned journal_blocks;
+	unsigned journal_head;		//next free block of the log, from journal_start
+	uint64_t journal_sequence;	//the next transaction commits with this
+	txn_block_t *txn_blocks;	//txn_capacity of them, the first txn_count are in the open transaction
+	unsigned txn_count;
+	unsigned txn_capacity;
+	uint8_t *txn_copies;		//txn_capacity blocks, one per txn_blocks entry
+	//whole inode table lives in memory (16 KB by default), blocks only get written back at fs_sync/fs_unmount
+	inode_t *inodes;		//inode_blocks worth
+	bool *inode_dirty; 		//per inode table block
+	bitmap_t *inode_map; 	//set bit = inode in use, rebuilt from the table at mount
+	dir_index_t **dir_indexes; //per directory inode, built on first lookup, NULL until then
+	extent_list_t **extent_lists; //per inode on extent file systems, loaded on first lookup, NULL until then
+	//traverse_path checks here before the directory, the dir_* functions that change entries keep it current
+	dentry_t dcache[DCACHE_SIZE];
+	dcache_stats_t dcache_stats;
+} F16FS_t;
 
+//fs_remove hands blocks back in runs, so a contiguous file costs one release per extent
+typedef struct {
+	unsigned start;
+	unsigned count;
+} block_run_t;
+
+static unsigned allocate_block(F16FS_t *fs, block_map_t *map);
+static unsigned allocate_run(F16FS_t *fs, block_map_t *map, unsigned want, unsigned *got);
+static void reserve_blocks(F16FS_t *fs, block_map_t *map, size_t goal);
+static void release_reservation(F16FS_t *fs, block_map_t *map);
+static void release_run(F16FS_t *fs, block_run_t *run, unsigned block);
+static bool load_inodes(F16FS_t *fs);
+static F16FS_t *fs_setup(block_store_t *bs, bool prefetch);
+static bool fd_table_grow(F16FS_t *fs);
+static file_descriptor_t *fd_get(F16FS_t *fs, int fd);
+static void fd_release(F16FS_t *fs, int fd);
+static block_map_t *block_map_create(F16FS_t *fs);
+static void block_map_reset(F16FS_t *fs, block_map_t *map, int inode_index);
+static void open_count(F16FS_t *fs, int index, int delta);
+static block_map_t *io_begin(F16FS_t *fs, int fd, bool writing, bool positional);
+static bool io_end(F16FS_t *fs, int fd, block_map_t *map);
+static void block_map_drop(F16FS_t *fs, int fd);
+static void block_map_free(block_map_t *map);
+static block_map_t *spare_map_get(F16FS_t *fs);
+static void spare_map_put(F16FS_t *fs, block_map_t *map);
+static unsigned ptr_get(const F16FS_t *fs, const uint8_t *pointers, size_t slot);
+static void ptr_set(const F16FS_t *fs, uint8_t *pointers, size_t slot, unsigned block);
+static int map_block(F16FS_t *fs, block_map_t *map, size_t relativeIndex, bool isRead);
+static size_t map_blocks(F16FS_t *fs, block_map_t *map, size_t relativeIndex, size_t count, bool isRead, unsigned *batch);
+static int scratch_block(F16FS_t *fs, int inode_index, int relativeIndex, bool isRead);
+static ssize_t read_at(F16FS_t *fs, block_map_t *map, void *dst, size_t nbyte, size_t offset);
+static ssize_t write_at(F16FS_t *fs, block_map_t *map, const void *src, size_t nbyte, size_t offset);
+static int create_locked(F16FS_t *fs, const char *path, file_t type);
+static int remove_locked(F16FS_t *fs, const char *path);
+static int move_locked(F16FS_t *fs, const char *src, const char *dst);
+static dyn_array_t *get_dir_locked(F16FS_t *fs, const char *path);
+static int sync_all(F16FS_t *fs, bool clean);
+static bool txn_join(F16FS_t *fs);
+static txn_block_t *txn_add(F16FS_t *fs, unsigned block, bool inode);
+static void txn_split(F16FS_t *fs);
+static bool txn_commit(F16FS_t *fs);
+static bool txn_end(F16FS_t *fs);
+static const void *meta_get(F16FS_t *fs, unsigned block);
+static void *meta_mut(F16FS_t *fs, unsigned block);
+static bool meta_read(F16FS_t *fs, unsigned block, void *dst);
+static bool meta_write(F16FS_t *fs, unsigned block, const void *src);
+static void meta_release(F16FS_t *fs, unsigned block);
+static bool journal_recover(F16FS_t *fs, bool *unclean);
+static bool journal_checkpoint(F16FS_t *fs, bool clean);
+static void fbm_rebuild(F16FS_t *fs);
+static void file_blocks(F16FS_t *fs, const inode_t *node, block_visit_t visit, void *arg);
+static void sync_run(F16FS_t *fs, size_t start, size_t count, void *arg);
+
+
+//Remembers the pointer blocks a descriptor used last so sequential I/O reads one pointer block
+//per pointer block's worth of data blocks instead of walking the inode and indirect blocks for every data block.
+//Pointers never move while a file exists, so a cached entry is good until the file is removed.
+//A cached zero might just be stale though (another descriptor could have filled it in), so those get re-read.
+//A descriptor keeps its map from one open to the next, lock is held for the length of a call that uses it.
+struct block_map {
+	pthread_mutex_t lock;	//also covers the descriptor's offset
+	int inode_index;		//file this map is for
+	inode_t node;			//reloaded once per fs_read/fs_write
+	unsigned indirect_id;	//block in indirect, the last level of pointers (indirectOne or a double indirect child)
+	unsigned double_id;		//block in double_top, the double indirect block
+	uint8_t *indirect;		//a block each, allocated along with the map
+	uint8_t *double_top;
+	unsigned extent_hint;	//extent the last lookup landed in, sequential I/O keeps hitting it
+	//blocks for the current write come out of an extent instead of one allocate per block
+	unsigned reserve_start; //next block to hand out
+	unsigned reserve_count; //blocks left in the extent
+	unsigned reserve_goal; 	//blocks the write still expects to need beyond that
+	block_map_t *next_spare; //next on fs->spare_maps, while the map is one of them
+};
+
+//every extent of a file in logical order, the in-memory copy of the inline extents and the extent tree
+//lookups binary search it, changes are written through to the inode and tree right away
+struct extent_list {
+	extent_t *extents;
+	unsigned count;
+	unsigned capacity;
+};
+
+static extent_list_t *extent_list_for(F16FS_t *fs, int inode_index);
+static extent_list_t *extent_list_load(F16FS_t *fs, int inode_index);
+static void extent_list_drop(F16FS_t *fs, int inode_index);
+static int extent_map_block(F16FS_t *fs, block_map_t *map, size_t relativeIndex, bool isRead, size_t *run);
+static void extent_release_all(F16FS_t *fs, inode_t *node, int inode_index, block_run_t *run);
+
+//one component of a path, points into the caller's string, not terminated
+typedef struct {
+	const char *start;
+	size_t len;
+} path_slice_t;
+
+//walks the components of an absolute path without copying or allocating anything
+typedef struct {
+	const char *next; //start of the next component, NULL once the last one is handed out
+} path_iter_t;
+
+static void path_iter_init(path_iter_t *iter, const char *path);
+static bool path_next(path_iter_t *iter, path_slice_t *part);
+static bool path_done(const path_iter_t *iter);
+static bool path_basename(const char *path, char *name);
 
 typedef struct direct_entr {
 	char fname[64]; //sloppy
@@ -41,6 +311,59 @@ typedef struct direct_entr {
 } directory_entry_t;
 //limit to 7 directory entries per directory file data
 
+#define DIR_ENTRY_COUNT 7
+#define DIR_HASHED 0x48534844 //"DHSH", every directory block is made with it
+
+//what a directory's data block really holds, the 36 bytes the entries leave over carry a hash per name
+//so lookups compare hashes and only strcmp when one matches
+//images from before the hashes have no superblock either and don't mount, so every block has them
+typedef struct {
+	directory_entry_t entries[DIR_ENTRY_COUNT];
+	uint32_t hashes[DIR_ENTRY_COUNT];
+	uint32_t tag;
+	char unused[4];
+} directory_block_t;	//512 bytes, bigger blocks hold several
+_Static_assert(sizeof(directory_block_t) == DIR_BLOCK_BYTES, "directory block must be 512 bytes");
+
+//directories grow a block at a time through the same pointers a regular file uses
+//finding a name in one would mean reading every block, so each directory gets an in-memory hash index
+//(name hash -> entry position) the first time it is searched, and keeps it until unmount or removal
+typedef struct {
+	uint32_t hash;
+	int next;		//next node in the bucket (or the free list), -1 ends it
+	size_t pos;		//block * dir_entries_per_block + slot
+} dir_node_t;
+
+struct dir_index {
+	unsigned *block_ids;	//the directory's data blocks, in order
+	unsigned block_count;
+	unsigned used;			//live entries
+	unsigned free_hint;		//no free slot in any block before this one
+	int *buckets;			//first node per bucket, -1 if empty
+	unsigned bucket_count;	//power of 2, doubled whenever used passes it so chains stay short
+	dir_node_t *nodes;
+	unsigned node_count;	//nodes handed out so far
+	unsigned node_capacity;
+	int free_node;			//erased nodes get reused
+};
+
+static uint32_t name_hash(const char *name);
+static void dir_block_init(directory_block_t *dir);
+static int dir_free_slot(const directory_block_t *dir);
+static void dir_set(directory_block_t *dir, int slot, const char *name, int inode_index);
+static void dir_clear(directory_block_t *dir, int slot);
+static dir_index_t *dir_index_for(F16FS_t *fs, int dir_inode);
+static void dir_index_drop(F16FS_t *fs, int dir_inode);
+static int dir_lookup(F16FS_t *fs, int dir_inode, const char *name, size_t *pos);
+static bool dir_add(F16FS_t *fs, int dir_inode, const char *name, int inode_index);
+static void dir_remove_at(F16FS_t *fs, int dir_inode, size_t pos);
+static bool dir_rename_at(F16FS_t *fs, int dir_inode, size_t pos, const char *name);
+static bool dir_init_block(F16FS_t *fs, unsigned block_id);
+static directory_block_t *dir_piece(F16FS_t *fs, dir_index_t *index, size_t pos, bool mutable);
+static void dcache_init(F16FS_t *fs);
+static int dcache_lookup(F16FS_t *fs, int parent, const char *name);
+static void dcache_store(F16FS_t *fs, int parent, const char *name, int inode_index);
+
 void test_inode_size(){
 	printf("%d", (int)sizeof(inode_t));
 }	
@@ -49,103 +372,142 @@ void test_inode_size(){
 //of unnecessary logic I think
 
 F16FS_t *fs_format(const char *path){
+	fs_geometry_t geometry = {DEFAULT_BLOCK_SIZE, DEFAULT_BLOCK_COUNT, DEFAULT_INODE_COUNT, false, 0};
+	return fs_format_geometry(path, &geometry);
+}
+
+F16FS_t *fs_format_geometry(const char *path, const fs_geometry_t *geometry){
 	//printf("\nsize of enum: %d" , (int)sizeof(inode_t));
 	
-	if (path == NULL)
+	if (path == NULL || geometry == NULL)
 			return NULL;
 	size_t i = 0;
 	while(path[i] != '\0'){
 		if(path[i] == '\n')
 			return NULL;
-			i++;
-		
+		i++;
 	}
+	//block ids come back from the lookups as ints, so the device stops at INT_MAX blocks
+	if (geometry->inode_count < 1 || geometry->inode_count > MAX_INODE_COUNT || geometry->block_count > INT_MAX
+			|| (geometry->journal_blocks > 0 && geometry->journal_blocks < JOURNAL_MIN_BLOCKS)
+			|| geometry->journal_blocks > geometry->block_count)
+		return NULL;
 	
-	block_store_t *bs = block_store_create(path);
+	block_store_t *bs = block_store_create_geometry(path, geometry->block_size, geometry->block_count);
 	
 	if (bs == NULL)
 		return NULL;
+
+	//inode table goes right after the free block map, then the journal if there is one, then root's directory block
+	//with the default geometry that's blocks 16-47 for the table and 48 for root
+	size_t block_size = geometry->block_size;
+	size_t inodes_per_block = block_size / INODE_SIZE;
+	superblock_t super;
+	super.magic = SUPERBLOCK_MAGIC;
+	super.block_size = block_size;
+	super.block_count = geometry->block_count;
+	super.inode_blocks = (geometry->inode_count + inodes_per_block - 1) / inodes_per_block;
+	super.inode_count = super.inode_blocks * inodes_per_block; //whatever fits in the last table block too
+	super.inode_start = block_store_get_data_start(bs);
+	super.pointer_width = geometry->block_count <= 65536 ? 2 : 4;
+	super.flags = (geometry->extents ? SB_EXTENTS : 0) | (geometry->journal_blocks > 0 ? SB_JOURNAL : 0);
+	super.journal_start = super.inode_start + super.inode_blocks;
+	super.journal_blocks = geometry->journal_blocks;
+	if (super.inode_count > MAX_INODE_COUNT
+			|| (uint64_t)super.journal_start + super.journal_blocks >= geometry->block_count){
+		block_store_close(bs);
+		return NULL;
+	}
 	
-	//now we have a block store created at file, so, we must format the first 32 blocks to be inode
-	for ( i = 16; i < INODE_BLOCK_COUNT + 16; i++){ //start at 16 since we cant use the first 16(0-15) blocks 
-		inode_t block_format[8]; //8 inode per block
-		int j = 0;
-		
-		for (j = 0; j < 8; j++){
-				block_format[j].refCount = -1;
-				int k = 0;
-				for ( k = 0; k < 6; k++)
-					block_format[j].directPtrs[k] = -1;
-				block_format[j].indirectOne = -1;
-				block_format[j].indirectTwo = -1;
-		}
-		if( !block_store_request((block_store_t *const)bs, (const unsigned)i) ){
-			return NULL;		
-		} 
-
-		//so, if we get here, we have allocated a certain block, so if we write to it, we can format it to an inode?
-		//will write an array of 8 inodes to each block, then when referring to specific inodes, will use that index
-		//to determine which block and which inode within that block
-
-		//first create a buffer, will free it before we finish of course, just going to alloc before the loop
-		//since block store uses mem copy it creates it own copy of it so we dont need to alloc every time, just once in the right
-		//format then copy that format to each block
-		if ( ! block_store_write( (block_store_t *const)bs, (const unsigned) i, (const void *const)block_format) )
-			return NULL;
+	//now we have a block store created at file, so, we must format the inode table blocks
+	//every inode starts out free, pointers are already 0 since the device is a freshly truncated (sparse) file
+	//the first table block is the same as the rest but for root, and the whole table goes down in one writev
+	inode_t *block_format = (inode_t*)calloc(2, block_size);
+	inode_t *root_format = (inode_t*)((uint8_t*)block_format + block_size);
+	unsigned *table_ids = (unsigned*)malloc(super.inode_blocks * sizeof(unsigned));
+	struct iovec *table = (struct iovec*)malloc(super.inode_blocks * sizeof(struct iovec));
+	if (block_format == NULL || table_ids == NULL || table == NULL){
+		free(block_format);
+		free(table_ids);
+		free(table);
+		block_store_close(bs);
+		return NULL;
 	}
+	for (i = 0; i < inodes_per_block; i++)
+		block_format[i].refCount = -1;
+	memcpy(root_format, block_format, block_size);
 
 	//Make first inode the root directory 
-	//first inode is in block 17, first inode in that block
-	//The inode will point to an open datablock, maybe just 48
+	//The inode will point to the block right after the table
 	//block will contain directory entries
-	inode_t root;
-	root.type = FS_DIRECTORY;
-	root.file_size = 512; //only going to point to one block since it is directory
-	root.directPtrs[0] = 48; //points to first block because why not
-	root.refCount = 1;
-	inode_t temp[8]; //will be temp storage for formatted block
-	if(!block_store_read((block_store_t *const)bs, (const unsigned) 16, (void *const)temp))
-		return NULL;
-	temp[0] = root; //put inode 0 to be root directory inode 
-
-	if(!block_store_write( (block_store_t *const)bs, (const unsigned) 16, (const void *const)temp))
-		return NULL;			
+	unsigned root_block = super.journal_start + super.journal_blocks;
+	root_format[0].type = FS_DIRECTORY;
+	root_format[0].file_size = block_size; //only going to point to one block since it is directory
+	if (geometry->extents){
+		root_format[0].extents[0].logical = 0;
+		root_format[0].extents[0].start = root_block;
+		root_format[0].extents[0].length = 1;
+		root_format[0].extent_count = 1;
+	} else {
+		root_format[0].directPtrs[0] = root_block;
+	}
+	root_format[0].refCount = 1;
+
+	bool formatted = true;
+	for (i = 0; formatted && i < super.inode_blocks; i++){
+		table_ids[i] = super.inode_start + i;
+		table[i].iov_base = i == 0 ? (void*)root_format : (void*)block_format;
+		table[i].iov_len = block_size;
+		formatted = block_store_request(bs, table_ids[i]);
+	}
+	formatted = formatted && block_store_writev(bs, table_ids, super.inode_blocks, table, super.inode_blocks) == super.inode_blocks;
+	free(block_format);
+	free(table_ids);
+	free(table);
 	//inode written, now we have to format the block we pointed to in the inode to be array of directory entries
-
-	directory_entry_t directory_data[7];
-	
-	for (i = 0; i < 7; i++){
-		directory_data[i].inode_index = -1;
-		directory_data[i].fname[0] = '\0';
+	formatted = formatted && block_store_request(bs, root_block);
+	//the log starts out empty, which is the same as clean
+	for (i = super.journal_start; formatted && i < super.journal_start + super.journal_blocks; i++)
+		formatted = block_store_request(bs, i);
+	journal_header_t *header = super.journal_blocks > 0 ? block_store_get_ptr_mut(bs, super.journal_start) : NULL;
+	if (header != NULL){
+		header->magic = JOURNAL_MAGIC;
+		header->clean = 1;
+		header->sequence = 1;
 	}
-	void* temp_block = &directory_data;
-	if (!block_store_request(bs, 48) )
-		return NULL;
-	if (!block_store_write((block_store_t *const)bs, (const unsigned) 48, (const void *const)temp_block))
+	void *user_area = block_store_get_user_area(bs);
+	if (!formatted || user_area == NULL){
+		block_store_close(bs);
 		return NULL;
+	}
+	memcpy(user_area, &super, sizeof(super));
 	
 	//if we made it here, we have formatted the block store, so all that is left is to create the FS object, fill it, then return it
-	
-	F16FS_t *fs = (F16FS_t*)malloc(sizeof(F16FS_t) );
-
-	if (fs == NULL)
+	F16FS_t *fs = fs_setup(bs, false);
+	if (fs != NULL && !dir_init_block(fs, root_block)){
+		fs_unmount(fs);
 		return NULL;
-
-	fs->bs = bs;	
-	for (i = 0; i < 256; i++)
-		fs->file_descriptor_table[i].inode_index = -1;
+	}
+	if (fs != NULL && !txn_end(fs)){
+		fs_unmount(fs);
+		return NULL;
+	}
 	return fs;
 }
 
 F16FS_t *fs_mount(const char *path){
-	if (path == NULL)
+	return fs_mount_advised(path, FS_ADVISE_NORMAL);
+}
+
+F16FS_t *fs_mount_advised(const char *path, unsigned advice){
+	if (path == NULL || (advice & ~(FS_ADVISE_SEQUENTIAL | FS_ADVISE_RANDOM | FS_ADVISE_PREFETCH | FS_ADVISE_HUGEPAGE)) != 0)
 			return NULL;
 	
 	uint32_t i = 0;
 	
 	while(path[i] != '\0'){
-	if(path[i] == '\n')
-		return NULL;
+		if(path[i] == '\n')
+			return NULL;
 		i++;
 	}
 	int fileRef = open(path, O_RDONLY);
@@ -156,38 +518,210 @@ F16FS_t *fs_mount(const char *path){
 		close(fileRef);
 	}
 
-	block_store_t *bs = block_store_open(path);
+	//same hints the block store has, spelled out so neither header needs the other's
+	unsigned bs_advice = ((advice & FS_ADVISE_SEQUENTIAL) ? BLOCK_STORE_ADVISE_SEQUENTIAL : 0)
+		| ((advice & FS_ADVISE_RANDOM) ? BLOCK_STORE_ADVISE_RANDOM : 0)
+		| ((advice & FS_ADVISE_PREFETCH) ? BLOCK_STORE_ADVISE_PREFETCH : 0)
+		| ((advice & FS_ADVISE_HUGEPAGE) ? BLOCK_STORE_ADVISE_HUGEPAGE : 0);
+	block_store_t *bs = block_store_open_advised(path, bs_advice);
 	
 	if (bs == NULL)
 		return NULL;
 
-	F16FS_t *fs = (F16FS_t*)malloc(sizeof(F16FS_t) );
-	
-	if (fs == NULL)
-		return NULL;
+	//since the file itself should have been a block store that is formatted correctly, I think we are done? 
+	return fs_setup(bs, (advice & FS_ADVISE_PREFETCH) != 0);
+}
 
+//everything format and mount have in common once the block store is ready
+//the superblock has to check out, or this isn't something we formatted
+//prefetch starts the inode table on its way in before load_inodes copies it out
+static F16FS_t *fs_setup(block_store_t *bs, bool prefetch){
+	const superblock_t *super = block_store_get_user_area(bs);
+	if (super == NULL || super->magic != SUPERBLOCK_MAGIC || super->block_size != block_store_get_block_size(bs)
+			|| super->block_count != block_store_get_block_count(bs) || super->inode_count == 0
+			|| super->inode_count > MAX_INODE_COUNT || super->inode_count * INODE_SIZE > (uint64_t)super->inode_blocks * super->block_size
+			|| super->inode_start + super->inode_blocks > super->block_count
+			|| (super->pointer_width != 2 && super->pointer_width != 4) || (super->flags & ~(SB_EXTENTS | SB_JOURNAL)) != 0
+			|| ((super->flags & SB_JOURNAL) && (super->journal_blocks < JOURNAL_MIN_BLOCKS
+				|| super->journal_start < super->inode_start + super->inode_blocks
+				|| (uint64_t)super->journal_start + super->journal_blocks > super->block_count))){
+		block_store_close(bs);
+		return NULL;
+	}
+	F16FS_t *fs = (F16FS_t*)calloc(1, sizeof(F16FS_t));
+	if (fs == NULL){
+		block_store_close(bs);
+		return NULL;
+	}
 	fs->bs = bs;
-	for (i = 0; i < 256; i++){
-		fs->file_descriptor_table[i].inode_index = -1;
+	fs->block_size = super->block_size;
+	fs->pointer_width = super->pointer_width;
+	fs->pointers_per_block = fs->block_size / fs->pointer_width;
+	fs->max_file_blocks = 6 + fs->pointers_per_block + fs->pointers_per_block * fs->pointers_per_block;
+	fs->dir_entries_per_block = fs->block_size / DIR_BLOCK_BYTES * DIR_ENTRY_COUNT;
+	fs->inodes_per_block = fs->block_size / INODE_SIZE;
+	fs->inode_count = super->inode_count;
+	fs->inode_start = super->inode_start;
+	fs->inode_blocks = super->inode_blocks;
+	fs->extents = (super->flags & SB_EXTENTS) != 0;
+	fs->extents_per_leaf = fs->block_size / sizeof(extent_t);
+	fs->max_extents = INLINE_EXTENTS + fs->block_size / sizeof(uint32_t) * fs->extents_per_leaf;
+	if (fs->extents) //no pointer blocks to run out of, the device is the limit
+		fs->max_file_blocks = super->block_count;
+	if (super->flags & SB_JOURNAL){
+		fs->journal_start = super->journal_start;
+		fs->journal_blocks = super->journal_blocks;
+		//a descriptor, the blocks and a commit have to fit in the log behind the header
+		fs->txn_capacity = fs->journal_blocks - 3 < TXN_MAX_BLOCKS ? fs->journal_blocks - 3 : TXN_MAX_BLOCKS;
+		fs->txn_blocks = (txn_block_t*)calloc(fs->txn_capacity, sizeof(txn_block_t));
+		fs->txn_copies = (uint8_t*)malloc(fs->txn_capacity * fs->block_size);
 	}
-	//since the file itself should have been a block store that is formatted correctly, I think we are done? 
-	
+	fs->inodes = (inode_t*)malloc(fs->inode_blocks * fs->block_size);
+	fs->inode_dirty = (bool*)calloc(fs->inode_blocks, sizeof(bool));
+	fs->open_fds = (int*)malloc(fs->inode_count * sizeof(int));
+	fs->dir_indexes = (dir_index_t**)calloc(fs->inode_count, sizeof(dir_index_t*));
+	fs->extent_lists = (extent_list_t**)calloc(fs->inode_count, sizeof(extent_list_t*));
+	fs->inode_locks = (pthread_rwlock_t*)malloc(fs->inode_count * sizeof(pthread_rwlock_t));
+	fs->scratch_map = block_map_create(fs);
+	int i;
+	for (i = 0; fs->open_fds && i < fs->inode_count; i++){
+		fs->open_fds[i] = -1;
+	}
+	for (i = 0; fs->inode_locks && i < fs->inode_count; i++){
+		pthread_rwlock_init(&fs->inode_locks[i], NULL);
+	}
+	for (i = 0; fs->txn_blocks && fs->txn_copies && i < (int)fs->txn_capacity; i++){
+		fs->txn_blocks[i].data = fs->txn_copies + (size_t)i * fs->block_size;
+	}
+	fs->fd_free = -1;
+	fs->fd_limit = FD_LIMIT_DEFAULT;
+	if (prefetch)
+		block_store_prefetch(bs, fs->inode_start, fs->inode_blocks);
+	//the log goes home before anything is read out of the inode table
+	bool unclean = false;
+	if (!fs->inodes || !fs->inode_dirty || !fs->open_fds || !fs->dir_indexes || !fs->extent_lists || !fs->inode_locks
+			|| !fs->scratch_map || (fs->journal_blocks > 0 && (!fs->txn_blocks || !fs->txn_copies))
+			|| (fs->journal_blocks > 0 && !journal_recover(fs, &unclean)) || !load_inodes(fs) || !fd_table_grow(fs)){
+		bitmap_destroy(fs->inode_map);
+		for (i = 0; fs->inode_locks && i < fs->inode_count; i++){
+			pthread_rwlock_destroy(&fs->inode_locks[i]);
+		}
+		free(fs->inode_locks);
+		free(fs->file_descriptor_table);
+		free(fs->block_maps);
+		free(fs->fd_links);
+		free(fs->inodes);
+		free(fs->inode_dirty);
+		free(fs->open_fds);
+		free(fs->dir_indexes);
+		free(fs->extent_lists);
+		free(fs->txn_blocks);
+		free(fs->txn_copies);
+		block_map_free(fs->scratch_map);
+		block_store_close(bs);
+		free(fs);
+		return NULL;
+	}
+	if (unclean)
+		fbm_rebuild(fs);
+	dcache_init(fs);
+	pthread_mutex_init(&fs->ns_lock, NULL);
+	pthread_rwlock_init(&fs->fd_lock, NULL);
+	pthread_mutex_init(&fs->extent_lock, NULL);
+	pthread_mutex_init(&fs->inode_table_lock, NULL);
+	pthread_mutex_init(&fs->txn_lock, NULL);
+	pthread_mutex_init(&fs->spare_lock, NULL);
 	return fs;
 }
 
+//nothing else can be using fs by now, so no locks
 int fs_unmount(F16FS_t *fs){
 	if (fs == NULL)
 		return -1;
+	int i;
+	for (i = 0; i < fs->fd_capacity; i++)
+		block_map_drop(fs, i);
+	for (i = 0; i < fs->inode_count; i++){
+		dir_index_drop(fs, i);
+		extent_list_drop(fs, i);
+	}
+	//everything still gets freed when the sync fails, the caller just hears about it
+	int result = sync_all(fs, true);
+	bitmap_destroy(fs->inode_map);
 	block_store_close(fs->bs);		
+	free(fs->file_descriptor_table);
+	free(fs->block_maps);
+	free(fs->fd_links);
+	free(fs->inodes);
+	free(fs->inode_dirty);
+	free(fs->open_fds);
+	free(fs->dir_indexes);
+	free(fs->extent_lists);
+	free(fs->txn_blocks);
+	free(fs->txn_copies);
+	block_map_free(fs->scratch_map);
+	while (fs->spare_maps != NULL){
+		block_map_t *spare = fs->spare_maps;
+		fs->spare_maps = spare->next_spare;
+		block_map_free(spare);
+	}
+	for (i = 0; i < fs->inode_count; i++){
+		pthread_rwlock_destroy(&fs->inode_locks[i]);
+	}
+	free(fs->inode_locks);
+	pthread_mutex_destroy(&fs->ns_lock);
+	pthread_rwlock_destroy(&fs->fd_lock);
+	pthread_mutex_destroy(&fs->extent_lock);
+	pthread_mutex_destroy(&fs->inode_table_lock);
+	pthread_mutex_destroy(&fs->txn_lock);
+	pthread_mutex_destroy(&fs->spare_lock);
 	free(fs);
 
+	return result;
+}
+
+int fs_get_geometry(F16FS_t *fs, fs_geometry_t *geometry){
+	if (fs == NULL || geometry == NULL)
+		return -1;
+	geometry->block_size = fs->block_size;
+	geometry->block_count = block_store_get_block_count(fs->bs);
+	geometry->inode_count = fs->inode_count;
+	geometry->extents = fs->extents;
+	geometry->journal_blocks = fs->journal_blocks;
 	return 0;
 }
 
+int fs_set_fd_limit(F16FS_t *fs, size_t limit){
+	if (fs == NULL)
+		return -1;
+	pthread_rwlock_wrlock(&fs->fd_lock);
+	bool fits = limit >= (size_t)fs->fd_capacity && limit <= FD_LIMIT_MAX;
+	if (fits)
+		fs->fd_limit = limit;
+	pthread_rwlock_unlock(&fs->fd_lock);
+	return fits ? 0 : -1;
+}
+
+
+int fs_set_queue_depth(F16FS_t *fs, unsigned depth){
+	if (fs == NULL)
+		return -1;
+	return block_store_set_queue_depth(fs->bs, depth) ? 0 : -1;
+}
 
 int fs_create(F16FS_t *fs,  const char *path, file_t type){
 	if (path == NULL || fs == NULL)
 		return -1;	
+	pthread_mutex_lock(&fs->ns_lock);
+	int result = create_locked(fs, path, type);
+	if (!txn_end(fs))
+		result = -1;
+	pthread_mutex_unlock(&fs->ns_lock);
+	return result;
+}
+
+//fs_create with ns_lock held
+static int create_locked(F16FS_t *fs, const char *path, file_t type){
 	if( type != FS_DIRECTORY && type != FS_REGULAR )
 		return -1; 
 	
@@ -196,25 +730,9 @@ int fs_create(F16FS_t *fs,  const char *path, file_t type){
 		return -1;	
 	//here we SHOULD have the index of the parent inode, so we just need to make sure the file does not
 	//exist already before we create it
-	int i = 0;
-	int path_len = 0;
-	while (path[i] != (char)0)
-		i++;	
-	int j = 0;
-	path_len = i;
-	i = path_len - 1; //index of last char is length - 1
 	char fname[FS_NAME_MAX];
-	while (path[i] != '/'){
-		j++;
-		i--;
-	}
-	int fn_len = j;
-	//now j is fname length
-	
-	for (j = 0, i = path_len - fn_len; j < fn_len; j++, i++){
-		fname[j] = path[i];
-	}
-	fname[fn_len] = '\0';
+	if (!path_basename(path, fname))
+		return -1;
 	//Now we have the fname we want to create LOL
 	
 	//so, traverse path should have given parent dir, so we make sure that our directory does not have it
@@ -225,49 +743,23 @@ int fs_create(F16FS_t *fs,  const char *path, file_t type){
 	
 	if(node->type != FS_DIRECTORY)
 		return -1;
-	int block_ind = node->directPtrs[0];
-	//int offset = index % 8;	
-	directory_entry_t *entries;
-	char tmp_block[512];
-	block_store_read(fs->bs, block_ind, tmp_block);
-	entries = (directory_entry_t*)tmp_block;
-	int freeDir = -1;
-	for ( i = 0; i < 7; i++ ){
-		if(strcmp(entries[i].fname, fname) == 0)
-			return -1;
-		if( freeDir < 0 && entries[i].inode_index < 0) //free dir
-			 freeDir = i;		
-	}
-
-	if (freeDir < 0) //no free spots
+	if (dir_lookup(fs, index, fname, NULL) >= 0)
 		return -1;
 
 	//now let's create it 
 	
-	inode_t new_t, temp_t;
-	new_t.refCount = -1;
+	inode_t new_t;
 	inode_t *new = &new_t;
-	inode_t *temp = &temp_t;
-	int newInodeIndex = -1;
-	//find empty inode 
-	for(i = 1; i < 256; i++){
-		get_inode(fs, i, temp);	
-		if (temp->refCount < 0){
-			new = temp;
-			new->refCount = 1;
-			newInodeIndex = i;
-			i = 256;
-		}
-	}
+	//find empty inode, root is always taken so this never hands out 0
+	size_t newInodeIndex = bitmap_ffz(fs->inode_map);
+	if (newInodeIndex == SIZE_MAX)
+		return -1;
+	get_inode(fs, newInodeIndex, new);
+	new->refCount = 1;
 	//we have empty inode, so let's make it a file
 	// need to init its meta data, if its a dir then need to give it a block of dir entries
-	// need to set this new file inside old one, using freeDir will give index of direct entry of parent that
-	// can be used for new inode
+	// need to set this new file inside old one, dir_add finds (or makes) room for it in the parent
 	
-
-	if (new->refCount < 0)
-		return -1;
-
 	new->type = type;
 	
 	if (type == FS_REGULAR){
@@ -276,33 +768,43 @@ int fs_create(F16FS_t *fs,  const char *path, file_t type){
 		//done?
 		//call inode_write() which will place new inode into inode table
 		write_inode(fs, newInodeIndex, new);
+		bitmap_set(fs->inode_map, newInodeIndex);
 		//success, then we done
 	} else { //has to be directory, checked that at beginning
-		new->file_size = 512;
+		new->file_size = fs->block_size;
 		//need free block
-		int blockID = block_store_allocate(fs->bs);
-		if (blockID < 1)
+		unsigned blockID = block_store_allocate(fs->bs); //0 when out of blocks, it's never a data block
+		if (blockID == 0)
 			return -1; //out of blocks 
-		new->directPtrs[0] = blockID;
-		write_inode(fs, newInodeIndex, new);
-		
-		directory_entry_t directory_data[7];
-	
-		for (i = 0; i < 7; i++){
-			directory_data[i].inode_index = -1;
-			directory_data[i].fname[0] = '\0';
+		if (!dir_init_block(fs, blockID)){
+			meta_release(fs, blockID);
+			return -1;
 		}
-		block_store_write(fs->bs, blockID, &directory_data);
+		memset(new->block_info, 0, sizeof(new->block_info));
+		if (fs->extents){
+			new->extents[0].start = blockID;
+			new->extents[0].length = 1;
+			new->extent_count = 1;
+		} else {
+			new->directPtrs[0] = blockID;
+		}
+		write_inode(fs, newInodeIndex, new);
+		bitmap_set(fs->inode_map, newInodeIndex);
 		//set directpointer to free block
 		//write to inode table
 		//success 
 	}
 	//before we finish, need to add the new file/directory into the parent directory entries
-	//if we got here, we should have a spot for it
-	strcpy(entries[freeDir].fname, fname);
-	entries[freeDir].inode_index = newInodeIndex;
-
-	block_store_write(fs->bs, block_ind, entries);
+	//parent might need a new block for it, if there isn't one take the new file back out
+	if (!dir_add(fs, index, fname, newInodeIndex)){
+		if (type == FS_DIRECTORY)
+			meta_release(fs, fs->extents ? new->extents[0].start : new->directPtrs[0]);
+		memset(new->block_info, 0, sizeof(new->block_info));
+		new->refCount = -1;
+		write_inode(fs, newInodeIndex, new);
+		bitmap_reset(fs->inode_map, newInodeIndex);
+		return -1;
+	}
 	return 0;
 }
 
@@ -310,22 +812,37 @@ int fs_open(F16FS_t *fs, const char *path){
 	if (fs == NULL || path == NULL)
 		return -1;		
 
+	//the file can't be removed out from under us until the descriptor is in the table
+	pthread_mutex_lock(&fs->ns_lock);
 	int index = existing_traversal(fs, path);
 	
-	if (index < 0)
+	if (index < 0){
+		pthread_mutex_unlock(&fs->ns_lock);
 		return -1;
-
-	int open_fd_index = -1;
-	int i;
-	for (i = 0; i < 256; i++){
-		if (fs->file_descriptor_table[i].inode_index < 0){
-			open_fd_index = i;
-			i = 256;
-		}
-			
 	}
-	if (open_fd_index < 0)
+
+	pthread_rwlock_wrlock(&fs->fd_lock);
+	//take the first free descriptor, the table only grows when there isn't one
+	//its map sticks around from the last time the slot was open, it just has to start over on this file
+	int open_fd_index = fs->fd_free >= 0 || fd_table_grow(fs) ? fs->fd_free : -1;
+	if (open_fd_index >= 0 && fs->block_maps[open_fd_index] == NULL)
+		fs->block_maps[open_fd_index] = block_map_create(fs);
+	if (open_fd_index < 0 || fs->block_maps[open_fd_index] == NULL){
+		pthread_rwlock_unlock(&fs->fd_lock);
+		pthread_mutex_unlock(&fs->ns_lock);
 		return -1;
+	}
+	block_map_reset(fs, fs->block_maps[open_fd_index], index);
+	fd_link_t *link = &fs->fd_links[open_fd_index];
+	fs->fd_free = link->next;
+
+	//and put it on the front of the inode's open list
+	link->prev = -1;
+	link->next = fs->open_fds[index];
+	if (link->next >= 0)
+		fs->fd_links[link->next].prev = open_fd_index;
+	fs->open_fds[index] = open_fd_index;
+
 	size_t offset = 0;
 	file_descriptor_t temp;
 	temp.inode_index = index;
@@ -333,30 +850,28 @@ int fs_open(F16FS_t *fs, const char *path){
 	
 	fs->file_descriptor_table[open_fd_index] = temp;	
 
-	inode_t node;
-	get_inode(fs, index, &node);
-	node.refCount++;
-	write_inode(fs, index, &node);
+	open_count(fs, index, 1);
 
+	pthread_rwlock_unlock(&fs->fd_lock);
+	pthread_mutex_unlock(&fs->ns_lock);
 	return open_fd_index;
 }
 
 int fs_close(F16FS_t *fs, int fd){
-	if (fd < 0 || fd > 255 || fs == NULL)
+	if (fs == NULL)
 		return -1;
-	
-	if( fs->file_descriptor_table[fd].inode_index < 0)
+	pthread_rwlock_wrlock(&fs->fd_lock);
+	file_descriptor_t *desc = fd_get(fs, fd);
+	if (desc == NULL){
+		pthread_rwlock_unlock(&fs->fd_lock);
 		return -1;
+	}
 	
-	inode_t node;
-	get_inode(fs, fs->file_descriptor_table[fd].inode_index, &node);
-	node.refCount--;
-	write_inode(fs, fs->file_descriptor_table[fd].inode_index, &node);
-	
-	fs->file_descriptor_table[fd].inode_index = -1;
-	
+	open_count(fs, desc->inode_index, -1);
 	
+	fd_release(fs, fd);
 	
+	pthread_rwlock_unlock(&fs->fd_lock);
 	return 0;
 }
 
@@ -364,7 +879,14 @@ int fs_close(F16FS_t *fs, int fd){
 dyn_array_t *fs_get_dir(F16FS_t *fs, const char *path){
 	if (fs == NULL || path == NULL)
 		return NULL;
+	pthread_mutex_lock(&fs->ns_lock);
+	dyn_array_t *directories = get_dir_locked(fs, path);
+	pthread_mutex_unlock(&fs->ns_lock);
+	return directories;
+}
 
+//fs_get_dir with ns_lock held
+static dyn_array_t *get_dir_locked(F16FS_t *fs, const char *path){
 	int index = existing_traversal_directory(fs, path);
 	
 
@@ -379,16 +901,26 @@ dyn_array_t *fs_get_dir(F16FS_t *fs, const char *path){
 	get_inode(fs, index, &dir);
 	dyn_array_t *directories = dyn_array_create( 0, sizeof(char) * FS_NAME_MAX, NULL);	
 	int i;
-	int blockId = dir.directPtrs[0];
-	directory_entry_t *entries;
-	char tmp_block[512];
-	block_store_read(fs->bs, blockId, tmp_block);
-	entries = (directory_entry_t*)tmp_block;
+	dir_index_t *dir_index = dir_index_for(fs, index);
+	if (dir_index == NULL){
+		dyn_array_destroy(directories);
+		return NULL;
+	}
+	//every block the directory has, not just the first
+	unsigned b;
+	size_t piece;
 	char fname[64];
-	for (i = 0; i < 7; i++){
-		if ( entries[i].inode_index != -1){
-			memcpy(fname, entries[i].fname, 64);
-			dyn_array_push_front( directories, fname);
+	for (b = 0; b < dir_index->block_count; b++){
+		const directory_block_t *data = meta_get(fs, dir_index->block_ids[b]);
+		if (data == NULL)
+			continue;
+		for (piece = 0; piece < fs->block_size / DIR_BLOCK_BYTES; piece++, data++){
+			for (i = 0; i < DIR_ENTRY_COUNT; i++){
+				if ( data->entries[i].inode_index != -1){
+					memcpy(fname, data->entries[i].fname, 64);
+					dyn_array_push_front( directories, fname);
+				}
+			}
 		}
 	}
 	return directories;
@@ -410,119 +942,38 @@ dyn_array_t *fs_get_dir(F16FS_t *fs, const char *path){
 
 
 int traverse_path(F16FS_t *fs, const char *path, bool existingFile, bool getDir){
-	if (fs == NULL || path == NULL || path[0] != '/')
+	if (fs == NULL || path == NULL || path[0] != '/' || path[1] == '\0')
 		return -1;
 	//if we get here, starts with root, so lets move forward with that assumption.
 
-	//parse into ordered list, so we will push and pop into dyn_array
-	
-	//create temp pointer to adjust as we move through the path, so first get length
-	
-	int i = 1;
-	int j = 0;
-	dyn_array_t *ordered_list = dyn_array_create( 0, sizeof(char) * FS_NAME_MAX, NULL);
-	if (ordered_list == NULL)
-		printf("\nDyn array is NULL");
-	
-	while(path[i] != (char)0){
-		char *temp = (char*)malloc(sizeof(char) * FS_NAME_MAX);
-		j = 0;
-		while (path[i] != '/' && path[i] != (char)0){
-			temp[j] = path[i];
-			i++;
-			j++;
-			if (j > FS_NAME_MAX - 1){
-				free(temp);
-				dyn_array_destroy(ordered_list);
-				return -1;
-			}
-		}
-		if ( path[i] != (char)0 ){
-			i++;
-			temp[j] = '\0';
-			dyn_array_push_front(ordered_list, temp);	
-			free(temp);
-		} else if (existingFile){
-			temp[j] = '\0';	
-			dyn_array_push_front(ordered_list, temp);
-			free(temp);
-
-		} else {
-			free(temp);
-		}
-		
-	}
-	if (i <= 1){
-		dyn_array_destroy(ordered_list);	
-		return -1;
-	}
+	//components come straight out of path, each one is copied into fname just long enough to look it up
+	path_iter_t iter;
+	path_slice_t part;
+	char fname[FS_NAME_MAX];
 	int nodeIndex = 0;
-	char *fname;	
-	while (!dyn_array_empty(ordered_list)){	
-		fname = (char*)malloc(64);
-		dyn_array_extract_back(ordered_list, fname);
-		//printf("\n%s\n", fname);
-		//block = nodeIndex / 8;
-		//nodeOffset = nodeIndex % 8;
-		//node temp = get_inode()
-		//use inode to get to block data
-		//block data has dirEntries
-		//search those entries for 
-		inode_t *temp = calloc(1, sizeof(inode_t));
-		get_inode(fs, nodeIndex, temp);
-		//have node itself, if we are here we can check for directory or filename inside
-		//should be directory right?
-		
-		//if the array is empty, we should be at a directory or a file
-		//if fileExists, then we should be at a file, 
-		//if file does not exist, then we should be at a directory 
-		if( dyn_array_empty(ordered_list) ){
-		 	if ( !existingFile && temp->type != FS_DIRECTORY ) {
-					free(temp);
-					free(fname);
-					dyn_array_destroy(ordered_list);
-					return -1;
-			}
-
-		}
-		//should be directory, if not, error
-		//THINK THROUGH
-		//if we are creating, then the last element is left off the path, 
-		//so we should always have directory
-		//we may or may not be at last element, does it matter?
-		//if we are at last one, should only matter if we are going to existing file
-		//so if it is last element, and it is file, we still need to search the element
-		//that is popped inside the current inode
-		
-		int blockId = temp->directPtrs[0];
-		directory_entry_t *entries;
-		char tmp_block[512];
-		block_store_read(fs->bs, blockId, tmp_block);
-		entries = (directory_entry_t*)tmp_block;
-		nodeIndex = -1;
-		for (i = 0; i < 7; i++){
-			if ( entries[i].inode_index != -1){
-				if( strcmp(fname, entries[i].fname) == 0){ //found what we want
-					nodeIndex = entries[i].inode_index;
-				}
-			}
-		}
-		if (nodeIndex == -1){ //we never found the right directory
-			free(temp);
-			free(fname);
-			dyn_array_destroy(ordered_list);
+	path_iter_init(&iter, path);
+	while (path_next(&iter, &part)){
+		bool last = path_done(&iter);
+		if (part.len >= FS_NAME_MAX)
+			return -1;
+		//if we are creating, then the last element is left off the path, we want its parent
+		//a trailing slash leaves an empty last element, that's fine to skip for an existing file too
+		if (last && (!existingFile || part.len == 0))
+			break;
+		if (part.len == 0) // "//" in the middle
+			return -1;
+		memcpy(fname, part.start, part.len);
+		fname[part.len] = '\0';
+		nodeIndex = dcache_lookup(fs, nodeIndex, fname); //found what we want, or -1
+		if (nodeIndex == -1) //we never found the right directory
 			return -1;
-		} 
-		
-	free(fname);
-	free(temp);
 	}
 
 	inode_t testNode;
-
-	dyn_array_destroy(ordered_list);
 	get_inode(fs, nodeIndex, &testNode);
-	if(existingFile && !getDir && testNode.type == FS_DIRECTORY)
+	if (!existingFile && testNode.type != FS_DIRECTORY)
+		nodeIndex = -1; //parent has to be a directory to create in it
+	else if(existingFile && !getDir && testNode.type == FS_DIRECTORY)
 		nodeIndex = -1;
 	else if (existingFile && getDir && testNode.type == FS_REGULAR)
 		nodeIndex = -1;
@@ -551,236 +1002,838 @@ int existing_traversal_directory(F16FS_t *fs, const char *path){
 }
 
 bool get_inode(F16FS_t *fs, int index, inode_t *node){
-		//need block index and inode offset within block
-		int block = index / 8;
-		//block index + 17 for taken blocks.
-		//0 index + 17 = first block
-		//1 index + 17 = second block, 18th block number
-		int offset = index % 8;
-		
-		inode_t nodes[8];
-		block_store_read(fs->bs, block + 16, nodes);
-		memcpy( node, nodes+offset, sizeof(inode_t));
-		return true;
+	if (index < 0 || index >= fs->inode_count)
+		return false;
+	pthread_mutex_lock(&fs->inode_table_lock);
+	memcpy(node, &fs->inodes[index], sizeof(inode_t));
+	pthread_mutex_unlock(&fs->inode_table_lock);
+	return true;
+}
+
+//opens and closes move refCount in the cache without a transaction, even with a journal
+//an open count means nothing after a crash, only whether it's -1 (free) does, and that never changes here
+//the table block is still marked so sync_all writes the count back
+static void open_count(F16FS_t *fs, int index, int delta){
+	pthread_mutex_lock(&fs->inode_table_lock);
+	fs->inodes[index].refCount += delta;
+	fs->inode_dirty[index / fs->inodes_per_block] = true;
+	pthread_mutex_unlock(&fs->inode_table_lock);
 }
 
+//only touches the cache, the inode's table block is marked so fs_sync writes it back
 bool write_inode(F16FS_t *fs, int index, inode_t *new_node){
-	int block = index / 8 + 16;
-	int offset = index % 8;
-
-	inode_t nodes[8];
-	block_store_read(fs->bs, block, nodes);
-	memcpy( nodes+offset, new_node, sizeof(inode_t));
-	//now our block has our new inode so we write it
-	block_store_write(fs->bs, block, nodes);
+	if (index < 0 || index >= fs->inode_count)
+		return false;
+	//with a journal the table block is part of the caller's transaction too
+	if (txn_join(fs) && txn_add(fs, fs->inode_start + index / fs->inodes_per_block, true) == NULL)
+		return false;
+	pthread_mutex_lock(&fs->inode_table_lock);
+	memcpy(&fs->inodes[index], new_node, sizeof(inode_t));
+	fs->inode_dirty[index / fs->inodes_per_block] = true;
+	pthread_mutex_unlock(&fs->inode_table_lock);
 	return true;
 }
 
-off_t fs_seek(F16FS_t *fs, int fd, off_t offset, seek_t whence){
-	if (fs == NULL || fd < 0 || fs->file_descriptor_table[fd].inode_index < 0)
-		return -1;
-	if ( whence != FS_SEEK_SET && whence != FS_SEEK_CUR && whence != FS_SEEK_END)
+int fs_sync(F16FS_t *fs){
+	if (fs == NULL)
 		return -1;
+	return sync_all(fs, false);
+}
 
-	int inode_ind = fs->file_descriptor_table[fd].inode_index;
-	inode_t node;
-	get_inode(fs, inode_ind, &node);
-	int startFrom;
+//fs_sync, unmount passes clean so the next mount knows there's nothing to replay
+//with a journal, no transaction can be halfway through changing the cache while it's written out
+static int sync_all(F16FS_t *fs, bool clean){
+	int result = 0;
+	unsigned i;
+	if (fs->journal_blocks > 0)
+		pthread_mutex_lock(&fs->txn_lock);
+	pthread_mutex_lock(&fs->inode_table_lock);
+	for (i = 0; i < fs->inode_blocks; i++){
+		if (!fs->inode_dirty[i])
+			continue;
+		if (!block_store_write(fs->bs, fs->inode_start + i, &fs->inodes[i * fs->inodes_per_block])){
+			result = -1;
+			break;
+		}
+		fs->inode_dirty[i] = false;
+	}
+	pthread_mutex_unlock(&fs->inode_table_lock);
+	if (fs->journal_blocks > 0){
+		if (result == 0 && !journal_checkpoint(fs, clean))
+			result = -1;
+		pthread_mutex_unlock(&fs->txn_lock);
+	} else if (result == 0 && !block_store_sync(fs->bs)){
+		result = -1;
+	}
+	return result;
+}
 
-	if (whence == FS_SEEK_CUR)
-		startFrom = fs->file_descriptor_table[fd].offset;
-	else if (whence == FS_SEEK_END)
-		startFrom = node.file_size;
-	else 
-		//handle seek_set
-		startFrom = 0;
+//file data and pointer/extent blocks, then the inode's table block. with a journal the inode is already safe
+//in the log once the call that changed it returns, without one the table block has to go home first
+//the free block map goes along then too, a journal's mount would rebuild it but there's nothing to do that otherwise
+int fs_fsync(F16FS_t *fs, int fd){
+	block_map_t *map = io_begin(fs, fd, false, true);
+	if (map == NULL)
+		return -1;
+	sync_run_t run = { 0, 0, true };
+	file_blocks(fs, &map->node, sync_run, &run);
+	if (run.count > 0 && !block_store_sync_range(fs->bs, run.start, run.count))
+		run.ok = false;
+	if (fs->journal_blocks == 0){
+		unsigned b = map->inode_index / fs->inodes_per_block;
+		pthread_mutex_lock(&fs->inode_table_lock);
+		bool wrote = block_store_write(fs->bs, fs->inode_start + b, &fs->inodes[b * fs->inodes_per_block]);
+		if (wrote)
+			fs->inode_dirty[b] = false;
+		pthread_mutex_unlock(&fs->inode_table_lock);
+		run.ok = run.ok && wrote && block_store_sync_range(fs->bs, fs->inode_start + b, 1)
+			&& block_store_flush(fs->bs, 0, block_store_get_data_start(fs->bs));
+	}
+	if (!io_end(fs, fd, map))
+		run.ok = false;
+	return run.ok ? 0 : -1;
+}
 
-	if ( offset + startFrom > node.file_size ){
-		fs->file_descriptor_table[fd].offset = node.file_size;
-		return node.file_size;
-	} //go to end of file if too big
-	if ( offset + startFrom < 0){
-		fs->file_descriptor_table[fd].offset = 0;
-		return 0;
+//block_visit_t for fs_fsync, syncs what's saved up when a run doesn't continue it
+static void sync_run(F16FS_t *fs, size_t start, size_t count, void *arg){
+	sync_run_t *run = arg;
+	if (count == 0)
+		return;
+	if (run->count > 0 && start == run->start + run->count){
+		run->count += count;
+		return;
 	}
+	if (run->count > 0 && !block_store_sync_range(fs->bs, run->start, run->count))
+		run->ok = false;
+	run->start = start;
+	run->count = count;
+}
 
-	fs->file_descriptor_table[fd].offset = startFrom + offset;
-	return fs->file_descriptor_table[fd].offset;
-	
+//pulls the whole inode table (blocks 16-47 by default) into the cache, nothing dirty yet
+//and marks every inode with a refCount in the inode map
+static bool load_inodes(F16FS_t *fs){
+	unsigned b;
+	for (b = 0; b < fs->inode_blocks; b++){
+		if (!block_store_read(fs->bs, fs->inode_start + b, &fs->inodes[b * fs->inodes_per_block]))
+			return false;
+		fs->inode_dirty[b] = false;
+	}
+	fs->inode_map = bitmap_create(fs->inode_count);
+	if (fs->inode_map == NULL)
+		return false;
+	bitmap_set(fs->inode_map, 0); //root
+	int i;
+	for (i = 1; i < fs->inode_count; i++){
+		if (fs->inodes[i].refCount >= 0)
+			bitmap_set(fs->inode_map, i);
+	}
+	return true;
 }
 
-ssize_t fs_read(F16FS_t *fs, int fd, void *dst, size_t nbyte){
-	if (fs == NULL || fd < 0 || dst == NULL || fs->file_descriptor_table[fd].inode_index < 0)
-		return -1;
-	if (nbyte == 0)
-		return 0;
+//fs whose transaction the calling thread has open, NULL if none
+static _Thread_local F16FS_t *txn_fs;
+//a commit txn_split made for the calling thread couldn't be logged, its txn_end reports it
+static _Thread_local bool txn_lost;
+
+//puts the calling thread in the open transaction, waiting its turn if another thread has it, false without a journal
+//it stays the thread's until txn_end, so everything one call changes commits together, long writes split it up
+static bool txn_join(F16FS_t *fs){
+	if (fs->journal_blocks == 0)
+		return false;
+	if (txn_fs != fs){
+		__atomic_add_fetch(&fs->txn_waiting, 1, __ATOMIC_RELAXED);
+		pthread_mutex_lock(&fs->txn_lock);
+		__atomic_sub_fetch(&fs->txn_waiting, 1, __ATOMIC_RELAXED);
+		txn_fs = fs;
+	}
+	return true;
+}
 
-	char temp_block[512] ={0}; 	//this will be where we put memory to be read
-								//first read in a free block, memcpy to dest	
+//the calling thread's entry for block, NULL if it doesn't have one
+static txn_block_t *txn_find(F16FS_t *fs, unsigned block){
+	if (txn_fs != fs)
+		return NULL;
+	unsigned i;
+	for (i = 0; i < fs->txn_count; i++){
+		if (fs->txn_blocks[i].block == block)
+			return &fs->txn_blocks[i];
+	}
+	return NULL;
+}
 
-	size_t currByte = 0; 		//this will allow us to track how man bytes we have read so far, 
-	size_t currOffset = 0; 		//this will tell us where we are currently at within the file as we read
-	int relativeBlock = 0; 		//this will tell us what block we are at, relative to the blocks within a file
-	size_t bytesLeft = 0;
-	bytesLeft = nbyte;
+//entry for block in the transaction, a new one starts as a copy of the block, NULL if the transaction is full
+static txn_block_t *txn_add(F16FS_t *fs, unsigned block, bool inode){
+	txn_block_t *entry = txn_find(fs, block);
+	if (entry != NULL || fs->txn_count == fs->txn_capacity)
+		return entry;
+	entry = &fs->txn_blocks[fs->txn_count];
+	if (!inode && !block_store_read(fs->bs, block, entry->data))
+		return NULL;
+	entry->block = block;
+	entry->inode = inode;
+	fs->txn_count++;
+	return entry;
+}
 
+//commits the calling thread's transaction and lets the next thread have a turn
+static void txn_release(F16FS_t *fs){
+	if (!txn_commit(fs))
+		txn_lost = true;
+	txn_fs = NULL;
+	pthread_mutex_unlock(&fs->txn_lock);
+}
 
-	currOffset = fs->file_descriptor_table[fd].offset;
-	//now we need the inode for the file in the fd
-	int inode_ind = fs->file_descriptor_table[fd].inode_index;
-	int block_index = 0;
-	//check if we start in middle of block
-	int block_byte_offset = currOffset % 512; //any bytes over 512 means we are inside a block 
-	relativeBlock = currOffset / 512;
-	if (block_byte_offset > 0){
-		//we are starting inside a block, so read it in to the dest
+//long writes commit what they have mapped so far before copying data in, when another thread is waiting for the
+//transaction, so the copy doesn't hold that thread's metadata changes up. Otherwise only once the transaction is
+//half full, so a write never outgrows one, and a lone writer doesn't pay for a commit per batch
+//blocks are always filled in before anything points at them, so any commit point leaves the metadata consistent
+static void txn_split(F16FS_t *fs){
+	if (txn_fs == fs && (__atomic_load_n(&fs->txn_waiting, __ATOMIC_RELAXED) > 0 || fs->txn_count > fs->txn_capacity / 2))
+		txn_release(fs);
+}
 
-		block_index = get_actual_block_read(relativeBlock, inode_ind, fs);
-		
-		if (block_index < 0)
-			return -1;
-		
-		//we can read
-		block_store_read(fs->bs, block_index, temp_block);
-		memcpy(dst, temp_block + block_byte_offset, 512 - block_byte_offset);
-		currByte+=(512- block_byte_offset); 	
-		bytesLeft-=(512-block_byte_offset);
-		currOffset+=(512-block_byte_offset);
-		relativeBlock++;
+//FNV-1a again, over the logged blocks one after another
+static uint32_t journal_checksum(uint32_t hash, const uint8_t *data, size_t bytes){
+	size_t i;
+	for (i = 0; i < bytes; i++){
+		hash ^= data[i];
+		hash *= 16777619u;
 	}
+	return hash;
+}
 
-	//once here, we should always be starting with full block.
-	bool file_not_full = true;
-	while (bytesLeft > 511 && file_not_full){
-		block_index = get_actual_block_read(relativeBlock, inode_ind, fs);
-		
-		if (block_index < 0){
-			fs->file_descriptor_table[fd].offset+=currByte;	
-			return currByte;
-		}
-		block_store_read(fs->bs, block_index, temp_block);
-		memcpy(dst + currByte, temp_block, 512);
-	
-		currByte+=512;
-		bytesLeft-=512;
-		currOffset+=512;
-		relativeBlock++;
-
-		if (relativeBlock > 65797)
-			file_not_full = false;
+//puts a transaction entry's block at block, inode table blocks come straight from the in memory table
+static void txn_write(F16FS_t *fs, const txn_block_t *entry, unsigned block){
+	if (entry->inode){
+		pthread_mutex_lock(&fs->inode_table_lock);
+		block_store_write(fs->bs, block, &fs->inodes[(entry->block - fs->inode_start) * fs->inodes_per_block]);
+		pthread_mutex_unlock(&fs->inode_table_lock);
+	} else {
+		block_store_write(fs->bs, block, entry->data);
 	}
+}
 
-	if (bytesLeft > 0 && file_not_full){
-		block_index = get_actual_block_read(relativeBlock, inode_ind, fs);
-		
-		if (block_index < 0){
-			fs->file_descriptor_table[fd].offset+=currByte;
-			return currByte;
-		}
-
-		block_store_read(fs->bs, block_index, temp_block);
-		memcpy(dst + currByte, temp_block, bytesLeft);
-	
-		currByte += bytesLeft;
-		currOffset+=bytesLeft;
+//adds the descriptor's count and home blocks to a checksum over the logged contents
+//a torn descriptor could otherwise send good contents to the wrong blocks
+static uint32_t journal_record_sum(uint32_t hash, const journal_record_t *desc){
+	hash = journal_checksum(hash, (const uint8_t *)&desc->count, sizeof(desc->count));
+	return journal_checksum(hash, (const uint8_t *)desc->blocks, desc->count * sizeof(desc->blocks[0]));
+}
 
+//logs the transaction and waits for just the log to reach the disk, then writes the blocks home
+//nobody waits on the home copies, if a crash beats them there the next mount replays them from the log
+static bool txn_commit(F16FS_t *fs){
+	unsigned count = fs->txn_count;
+	if (count == 0)
+		return true;
+	unsigned i;
+	//no room left in the log and the checkpoint to make some failed, so the log is left alone
+	//the blocks still go home so the disk has what memory has, there's just no log to replay them from
+	if (fs->journal_head + count + 2 > fs->journal_blocks && !journal_checkpoint(fs, false)){
+		for (i = 0; i < count; i++)
+			txn_write(fs, &fs->txn_blocks[i], fs->txn_blocks[i].block);
+		fs->txn_count = 0;
+		return false;
 	}
-	fs->file_descriptor_table[fd].offset+=currByte;
-	return currByte;
+	unsigned first = fs->journal_start + fs->journal_head;
+	journal_record_t *desc = block_store_get_ptr_mut(fs->bs, first);
+	journal_record_t *commit = block_store_get_ptr_mut(fs->bs, first + count + 1);
+	uint32_t checksum = 2166136261u;
+	for (i = 0; i < count; i++){
+		txn_block_t *entry = &fs->txn_blocks[i];
+		txn_write(fs, entry, first + 1 + i);
+		desc->blocks[i] = entry->block;
+		checksum = journal_checksum(checksum, block_store_get_ptr(fs->bs, first + 1 + i), fs->block_size);
+	}
+	desc->magic = JOURNAL_DESC;
+	desc->count = count;
+	desc->sequence = fs->journal_sequence;
+	commit->magic = JOURNAL_COMMIT;
+	commit->count = count;
+	commit->sequence = fs->journal_sequence;
+	commit->checksum = journal_record_sum(checksum, desc);
+	//one sequential write, instead of waiting on every block this touched
+	bool logged = block_store_flush(fs->bs, first, count + 2);
+	for (i = 0; i < count; i++)
+		block_store_write(fs->bs, fs->txn_blocks[i].block, block_store_get_ptr(fs->bs, first + 1 + i));
+	fs->journal_head += count + 2;
+	fs->journal_sequence++;
+	fs->txn_count = 0;
+	return logged;
 }
 
-// 6 + 256 + 256*256 = 65,798 max block index is 65,797 then
-ssize_t fs_write(F16FS_t *fs, int fd, const void *src, size_t nbyte){
-	if (fs == NULL || fd < 0 || src == NULL || fs->file_descriptor_table[fd].inode_index < 0)
-		return -1;
-	if (nbyte == 0)
-		return 0;
+//commits the calling thread's transaction, if it has one, and lets the next thread have a turn
+//every call that can change metadata ends here before it lets go of its other locks
+//false if any part of the call's metadata couldn't be logged, the call should fail
+static bool txn_end(F16FS_t *fs){
+	if (txn_fs == fs)
+		txn_release(fs);
+	bool logged = !txn_lost;
+	txn_lost = false;
+	return logged;
+}
 
-	char temp_block[512] ={0}; 	//this will be where we put memory to be written
-								//first read in a free block, memcpy to it, then write that block back in
+//directories, pointer blocks and the extent tree are read and changed through these
+//without a journal they are the block store's own pointers, with one a change goes to the transaction's copy of the block
+//and the calling thread sees that copy until the commit writes it home
+static const void *meta_get(F16FS_t *fs, unsigned block){
+	txn_block_t *entry = txn_find(fs, block);
+	return entry != NULL ? entry->data : block_store_get_ptr(fs->bs, block);
+}
 
-	size_t currByte = 0; 		//this will allow us to track how man bytes we have written so far, 
-	size_t currOffset = 0; 		//this will tell us where we are currently at within the file as we write
-	int relativeBlock = 0; 		//this will tell us what block we are at, relative to the blocks within a file
-	size_t bytesLeft = 0;
-	bytesLeft = nbyte;
-	inode_t node;
+static void *meta_mut(F16FS_t *fs, unsigned block){
+	if (!txn_join(fs))
+		return block_store_get_ptr_mut(fs->bs, block);
+	txn_block_t *entry = txn_add(fs, block, false);
+	return entry == NULL ? NULL : entry->data;
+}
 
-	currOffset = fs->file_descriptor_table[fd].offset;
-	//now we need the inode for the file in the fd
-	int inode_ind = fs->file_descriptor_table[fd].inode_index;
-	int block_index = 0;
-	//check if we start in middle of block
-	int block_byte_offset = currOffset % 512; //any bytes over 512 means we are inside a block 
-	relativeBlock = currOffset / 512;
-	if (block_byte_offset > 0){
-		//we are starting inside a block, so read it in the we can write to it then write to block_store
+static bool meta_read(F16FS_t *fs, unsigned block, void *dst){
+	const void *src = meta_get(fs, block);
+	if (src == NULL)
+		return false;
+	memcpy(dst, src, fs->block_size);
+	return true;
+}
 
-		block_index = get_actual_block_write(relativeBlock, inode_ind, fs);
-		//printf("\nBLOCK INDEX: %d", block_index);		
-		if (block_index < 0)
-			return -1;
-		
-		//we can read
-		block_store_read(fs->bs, block_index, temp_block);
-		memcpy(temp_block + block_byte_offset, src, 512 - block_byte_offset);
-		block_store_write(fs->bs, block_index, temp_block); //should be ok
-		currByte+=(512- block_byte_offset); 	
-		bytesLeft-=(512-block_byte_offset);
-		currOffset+=(512-block_byte_offset);
-		relativeBlock++;
+static bool meta_write(F16FS_t *fs, unsigned block, const void *src){
+	void *dst = meta_mut(fs, block);
+	if (dst == NULL)
+		return false;
+	memcpy(dst, src, fs->block_size);
+	return true;
+}
+
+//a block the transaction changed is going back, its copy can't land on whoever gets the block next
+//the last entry takes its place, and the copy buffers trade places with it
+static void meta_release(F16FS_t *fs, unsigned block){
+	txn_block_t *entry = txn_find(fs, block);
+	if (entry != NULL){
+		txn_block_t *last = &fs->txn_blocks[--fs->txn_count];
+		uint8_t *data = entry->data;
+		*entry = *last;
+		last->data = data;
 	}
+	block_store_release(fs->bs, block);
+}
 
-	//once here, we should always be starting with full block.
-	bool file_not_full = true;
-	while (bytesLeft > 511 && file_not_full){
-		block_index = get_actual_block_write(relativeBlock, inode_ind, fs);
-		//printf("\nBLOCK INDEX: %d", block_index);
-		if (block_index < 0){
-			fs->file_descriptor_table[fd].offset+=currByte;	
-			get_inode(fs, inode_ind, &node);
-			node.file_size += currByte;
-			write_inode(fs, inode_ind, &node);
-			return currByte;
-		}
-		memcpy(temp_block, src + currByte, 512);
-		block_store_write(fs->bs, block_index, temp_block);
-		currByte+=512;
-		bytesLeft-=512;
-		currOffset+=512;
+//everything the log holds has been written home, once the blocks written since the last checkpoint are on disk
+//the log can start over
+//clean is for unmount, it tells the next mount there's nothing to replay
+static bool journal_checkpoint(F16FS_t *fs, bool clean){
+	journal_header_t *header = block_store_get_ptr_mut(fs->bs, fs->journal_start);
+	if (header == NULL || !block_store_sync(fs->bs))
+		return false;
+	header->sequence = fs->journal_sequence;
+	header->clean = clean;
+	fs->journal_head = 1;
+	return block_store_flush(fs->bs, fs->journal_start, 1);
+}
+
+//mount's half, writes every transaction in the log home in order, stopping at the first one that didn't make it
+//to disk whole, then empties the log. unclean is set if the file system wasn't unmounted, see fbm_rebuild
+static bool journal_recover(F16FS_t *fs, bool *unclean){
+	const journal_header_t *header = block_store_get_ptr(fs->bs, fs->journal_start);
+	if (header == NULL || header->magic != JOURNAL_MAGIC)
+		return false;
+	*unclean = !header->clean;
+	fs->journal_sequence = header->sequence;
+	size_t block_count = block_store_get_block_count(fs->bs);
+	size_t per_record = (fs->block_size - sizeof(journal_record_t)) / sizeof(uint32_t);
+	unsigned at = 1;
+	while (*unclean && at + 2 < fs->journal_blocks){
+		const journal_record_t *desc = block_store_get_ptr(fs->bs, fs->journal_start + at);
+		if (desc->magic != JOURNAL_DESC || desc->sequence != fs->journal_sequence || desc->count == 0
+				|| desc->count > per_record || at + desc->count + 2 > fs->journal_blocks)
+			break;
+		unsigned count = desc->count;
+		const journal_record_t *commit = block_store_get_ptr(fs->bs, fs->journal_start + at + count + 1);
+		uint32_t checksum = 2166136261u;
+		unsigned i;
+		bool whole = commit->magic == JOURNAL_COMMIT && commit->sequence == desc->sequence && commit->count == count;
+		for (i = 0; whole && i < count; i++){
+			unsigned home = desc->blocks[i];
+			whole = home >= fs->inode_start && home < block_count
+					&& (home < fs->journal_start || home >= fs->journal_start + fs->journal_blocks);
+			checksum = journal_checksum(checksum, block_store_get_ptr(fs->bs, fs->journal_start + at + 1 + i), fs->block_size);
+		}
+		if (!whole || journal_record_sum(checksum, desc) != commit->checksum)
+			break;
+		for (i = 0; i < count; i++)
+			block_store_write(fs->bs, desc->blocks[i], block_store_get_ptr(fs->bs, fs->journal_start + at + 1 + i));
+		at += count + 2;
+		fs->journal_sequence++;
+	}
+	return journal_checkpoint(fs, false);
+}
+
+//arg isn't used, it only takes one to be a block_visit_t
+static void fbm_mark(F16FS_t *fs, size_t start, size_t count, void *arg){
+	(void)arg;
+	if (start + count > block_store_get_block_count(fs->bs))
+		return;
+	size_t i;
+	for (i = start; i < start + count; i++)
+		block_store_request(fs->bs, i);
+}
+
+//hands visit every block the inode points at, data and pointer/tree blocks both, a run at a time
+//runs can be empty, count is 0 for pointers that aren't set
+static void file_blocks(F16FS_t *fs, const inode_t *node, block_visit_t visit, void *arg){
+	size_t i, j;
+	if (fs->extents){
+		const uint32_t *root = node->extent_root == 0 ? NULL : block_store_get_ptr(fs->bs, node->extent_root);
+		visit(fs, node->extent_root, root != NULL, arg);
+		for (i = 0; i < node->extent_count && i < fs->max_extents; i++){
+			if (i < INLINE_EXTENTS){
+				visit(fs, node->extents[i].start, node->extents[i].length, arg);
+				continue;
+			}
+			size_t leaf = (i - INLINE_EXTENTS) / fs->extents_per_leaf;
+			const extent_t *entries = root == NULL || root[leaf] == 0 ? NULL : block_store_get_ptr(fs->bs, root[leaf]);
+			if (entries == NULL)
+				break;
+			if ((i - INLINE_EXTENTS) % fs->extents_per_leaf == 0)
+				visit(fs, root[leaf], 1, arg);
+			const extent_t *e = &entries[(i - INLINE_EXTENTS) % fs->extents_per_leaf];
+			visit(fs, e->start, e->length, arg);
+		}
+		return;
+	}
+	for (i = 0; i < 6; i++)
+		visit(fs, node->directPtrs[i], node->directPtrs[i] != 0, arg);
+	const uint8_t *one = node->indirectOne == 0 ? NULL : block_store_get_ptr(fs->bs, node->indirectOne);
+	visit(fs, node->indirectOne, one != NULL, arg);
+	for (i = 0; one != NULL && i < fs->pointers_per_block; i++)
+		visit(fs, ptr_get(fs, one, i), ptr_get(fs, one, i) != 0, arg);
+	const uint8_t *two = node->indirectTwo == 0 ? NULL : block_store_get_ptr(fs->bs, node->indirectTwo);
+	visit(fs, node->indirectTwo, two != NULL, arg);
+	for (i = 0; two != NULL && i < fs->pointers_per_block; i++){
+		unsigned child = ptr_get(fs, two, i);
+		const uint8_t *pointers = child == 0 ? NULL : block_store_get_ptr(fs->bs, child);
+		visit(fs, child, pointers != NULL, arg);
+		for (j = 0; pointers != NULL && j < fs->pointers_per_block; j++)
+			visit(fs, ptr_get(fs, pointers, j), ptr_get(fs, pointers, j) != 0, arg);
+	}
+}
+
+//the free block map isn't journaled, after a crash it can be missing blocks committed transactions took
+//or still have ones that never got used, so it's rebuilt from the inode table and the journal
+static void fbm_rebuild(F16FS_t *fs){
+	size_t data_start = block_store_get_data_start(fs->bs);
+	block_store_release_range(fs->bs, data_start, block_store_get_block_count(fs->bs) - data_start);
+	fbm_mark(fs, fs->inode_start, fs->inode_blocks, NULL);
+	fbm_mark(fs, fs->journal_start, fs->journal_blocks, NULL);
+	int i;
+	for (i = 0; i < fs->inode_count; i++){
+		if (bitmap_test(fs->inode_map, i))
+			file_blocks(fs, &fs->inodes[i], fbm_mark, NULL);
+	}
+}
+
+//whether [offset, offset + nbyte) stays inside the biggest file there can be, max_file_blocks of them
+static bool in_file_range(F16FS_t *fs, off_t offset, size_t nbyte){
+	size_t max_size = fs->max_file_blocks * fs->block_size;
+	return offset >= 0 && (size_t)offset <= max_size && nbyte <= max_size - offset;
+}
+
+//where SEEK_DATA/SEEK_HOLE land, the first block at or after offset that is (or isn't) mapped
+//the end of the file counts as a hole, there's no data at or past it
+static off_t seek_data_hole(F16FS_t *fs, block_map_t *map, off_t offset, bool data){
+	off_t file_size = map->node.file_size;
+	if (offset < 0 || offset >= file_size)
+		return -1;
+	size_t block = offset / fs->block_size;
+	size_t end = (file_size + fs->block_size - 1) / fs->block_size;
+	while (block < end){
+		//extents say how much of a run or a hole is left, so either gets skipped all at once
+		size_t run = 1;
+		bool mapped = (fs->extents ? extent_map_block(fs, map, block, true, &run) : map_block(fs, map, block, true)) >= 0;
+		if (mapped == data){
+			off_t found = (off_t)block * fs->block_size;
+			return found > offset ? found : offset;
+		}
+		block += run;
+	}
+	return data ? -1 : file_size;
+}
+
+off_t fs_seek(F16FS_t *fs, int fd, off_t offset, seek_t whence){
+	if ( whence != FS_SEEK_SET && whence != FS_SEEK_CUR && whence != FS_SEEK_END
+			&& whence != FS_SEEK_DATA && whence != FS_SEEK_HOLE)
+		return -1;
+	block_map_t *map = io_begin(fs, fd, false, false);
+	if (map == NULL)
+		return -1;
+
+	file_descriptor_t *desc = &fs->file_descriptor_table[fd];
+	off_t startFrom;
+	off_t result;
+
+	if (whence == FS_SEEK_DATA || whence == FS_SEEK_HOLE){
+		result = seek_data_hole(fs, map, offset, whence == FS_SEEK_DATA);
+		if (result >= 0)
+			desc->offset = result;
+		io_end(fs, fd, map);
+		return result;
+	}
+
+	if (whence == FS_SEEK_CUR)
+		startFrom = desc->offset;
+	else if (whence == FS_SEEK_END)
+		startFrom = map->node.file_size;
+	else 
+		//handle seek_set
+		startFrom = 0;
+
+	//past EOF is fine, writing there leaves a hole behind
+	//so is past the biggest a file can get, write_at turns anything down that starts out there
+	if ( offset + startFrom < 0)
+		desc->offset = 0;
+	else
+		desc->offset = startFrom + offset;
+	result = desc->offset;
+	io_end(fs, fd, map);
+	return result;
+	
+}
+
+ssize_t fs_read(F16FS_t *fs, int fd, void *dst, size_t nbyte){
+	if (dst == NULL)
+		return -1;
+	block_map_t *map = io_begin(fs, fd, false, false);
+	if (map == NULL)
+		return -1;
+	ssize_t read = read_at(fs, map, dst, nbyte, fs->file_descriptor_table[fd].offset);
+	if (read > 0)
+		fs->file_descriptor_table[fd].offset+=read;
+	io_end(fs, fd, map);
+	return read;
+}
+
+ssize_t fs_pread(F16FS_t *fs, int fd, void *dst, size_t nbyte, off_t offset){
+	if (fs == NULL || dst == NULL || !in_file_range(fs, offset, nbyte))
+		return -1;
+	block_map_t *map = io_begin(fs, fd, false, true);
+	if (map == NULL)
+		return -1;
+	ssize_t read = read_at(fs, map, dst, nbyte, offset);
+	io_end(fs, fd, map);
+	return read;
+}
+
+//async reads that fail say so here, read_at only looks once it has waited for all of them
+static void read_done(void *arg, bool ok){
+	if (!ok)
+		*(bool *)arg = false;
+}
+
+//queues reads for a batch of blocks into one buffer, one request per run of consecutive blocks
+//returns how many blocks got queued, the rest are left for a synchronous read
+static size_t queue_reads(F16FS_t *fs, const unsigned *batch, size_t count, char *into, bool *ok){
+	size_t queued = 0;
+	while (queued < count){
+		size_t run = 1;
+		while (queued + run < count && batch[queued + run] == batch[queued] + run)
+			run++;
+		if (!block_store_read_async(fs->bs, batch[queued], run, into + queued * fs->block_size, read_done, ok))
+			break;
+		queued += run;
+	}
+	return queued;
+}
+
+//fs_read and fs_pread both end up here, reads from offset and leaves the descriptor's own offset alone
+static ssize_t read_at(F16FS_t *fs, block_map_t *map, void *dst, size_t nbyte, size_t offset){
+	if (nbyte == 0)
+		return 0;
+
+	const char *block_data; 	//points straight into the block store, so each byte is copied once
+								//right into dst
+	unsigned batch[BATCH_BLOCKS]; //full blocks get resolved first, then copied in one readv
+
+	size_t currByte = 0; 		//this will allow us to track how man bytes we have read so far, 
+	size_t currOffset = 0; 		//this will tell us where we are currently at within the file as we read
+	size_t relativeBlock = 0; 	//this will tell us what block we are at, relative to the blocks within a file
+	size_t bytesLeft = 0;
+	bytesLeft = nbyte;
+
+
+	currOffset = offset;
+	//nothing past EOF, anything unmapped before it is a hole and reads as zeros
+	if (currOffset >= map->node.file_size)
+		return 0;
+	if (bytesLeft > map->node.file_size - currOffset)
+		bytesLeft = map->node.file_size - currOffset;
+	//the map has the inode for the file in the fd
+	int block_index = 0;
+	//check if we start in middle of block
+	int block_byte_offset = currOffset % fs->block_size; //any bytes over a block means we are inside a block 
+	relativeBlock = currOffset / fs->block_size;
+
+	//with an async queue every block of the read is queued before any is waited on, so they go out together
+	//the partial blocks at either end come in whole to edges and get copied out after the wait
+	//anything that doesn't make it into the queue is just read the usual way
+	bool async = block_store_get_queue_depth(fs->bs) > 0;
+	bool async_ok = true;
+	bool failed = false; //a mapped block that couldn't be read, only unmapped ones read as zeros
+	char *edges = NULL;
+	bool head_queued = false, tail_queued = false;
+	size_t headBytes = 0;
+	if (async && (block_byte_offset > 0 || (currOffset + bytesLeft) % fs->block_size > 0)){
+		edges = (char*)malloc(2 * fs->block_size);
+		async = edges != NULL;
+	}
+
+	if (block_byte_offset > 0){
+		//we are starting inside a block, so read it in to the dest
+
+		block_index = map_block(fs, map, relativeBlock, true);
+		
+		//we can read, but only as far as the caller asked for
+		headBytes = fs->block_size - block_byte_offset;
+		if (headBytes > bytesLeft)
+			headBytes = bytesLeft;
+		head_queued = async && block_index >= 0
+			&& block_store_read_async(fs->bs, block_index, 1, edges, read_done, &async_ok);
+		if (block_index < 0)
+			memset(dst, 0, headBytes);
+		else if (!head_queued){
+			block_data = block_store_get_ptr(fs->bs, block_index);
+			if (block_data == NULL)
+				failed = true;
+			else
+				memcpy(dst, block_data + block_byte_offset, headBytes);
+		}
+		currByte+=headBytes; 	
+		bytesLeft-=headBytes;
+		currOffset+=headBytes;
 		relativeBlock++;
+	}
+
+	//once here, we should always be starting with full block.
+	//look up a batch worth of block indexes, then let the block store copy them all at once
+	//the batch ends at a hole, which gets zeroed and skipped
+	while (!failed && bytesLeft >= fs->block_size){
+		size_t want = bytesLeft / fs->block_size;
+		if (want > BATCH_BLOCKS)
+			want = BATCH_BLOCKS;
+		size_t found = map_blocks(fs, map, relativeBlock, want, true, batch);
+		char *into = (char *)dst + currByte;
+		size_t copied = async ? queue_reads(fs, batch, found, into, &async_ok) : 0;
+		if (copied < found){
+			struct iovec rest = { into + copied * fs->block_size, (found - copied) * fs->block_size };
+			copied += block_store_readv(fs->bs, batch + copied, found - copied, &rest, 1);
+			if (copied < found){
+				failed = true;
+				break;
+			}
+		}
+		if (copied < want){
+			memset((char *)dst + currByte + copied * fs->block_size, 0, fs->block_size);
+			copied++;
+		}
 
-		if (relativeBlock > 65797)
-			file_not_full = false;
+		currByte+=copied * fs->block_size;
+		bytesLeft-=copied * fs->block_size;
+		currOffset+=copied * fs->block_size;
+		relativeBlock+=copied;
 	}
 
-	if (bytesLeft > 0 && file_not_full){
-		block_index = get_actual_block_write(relativeBlock, inode_ind, fs);
-		//printf("\nBLOCK INDEX: %d", block_index);
-		if (block_index < 0){
-			fs->file_descriptor_table[fd].offset+=currByte;
-			get_inode(fs, inode_ind, &node);
-			node.file_size += currByte;
-			write_inode(fs, inode_ind, &node);
-			return currByte;
+	size_t tailByte = currByte;
+	if (!failed && bytesLeft > 0){
+		block_index = map_block(fs, map, relativeBlock, true);
+		tail_queued = async && block_index >= 0
+			&& block_store_read_async(fs->bs, block_index, 1, edges + fs->block_size, read_done, &async_ok);
+		if (block_index < 0)
+			memset((char *)dst + currByte, 0, bytesLeft);
+		else if (!tail_queued){
+			block_data = block_store_get_ptr(fs->bs, block_index);
+			if (block_data == NULL)
+				failed = true;
+			else
+				memcpy((char *)dst + currByte, block_data, bytesLeft);
 		}
+	
+		currByte += bytesLeft;
+		currOffset+=bytesLeft;
+
+	}
+
+	if (async){
+		//other threads' requests may get waited on too, that's fine, ours are done when this returns
+		//even when the read has already failed, nothing queued can still be landing in dst afterwards
+		block_store_wait(fs->bs, SIZE_MAX);
+		if (head_queued)
+			memcpy(dst, edges + block_byte_offset, headBytes);
+		if (tail_queued)
+			memcpy((char *)dst + tailByte, edges + fs->block_size, bytesLeft);
+		free(edges);
+		if (!async_ok)
+			failed = true;
+	}
+	return failed ? -1 : (ssize_t)currByte;
+}
+
+//block for a partial write, one that has to be allocated for it starts out zeroed
+//so the bytes the write doesn't cover read back the same as a hole would
+static char *partial_block(F16FS_t *fs, block_map_t *map, size_t relativeBlock){
+	int block_index = map_block(fs, map, relativeBlock, true);
+	bool fresh = block_index < 0;
+	if (fresh)
+		block_index = map_block(fs, map, relativeBlock, false);
+	char *block_data = block_index < 0 ? NULL : block_store_get_ptr_mut(fs->bs, block_index);
+	if (block_data != NULL && fresh)
+		memset(block_data, 0, fs->block_size);
+	return block_data;
+}
+
+//every way out of write_at ends here, grows the file to cover what was written
+//nothing written means not even the first block could be mapped, that's an error and the size stays put
+static ssize_t finish_write(F16FS_t *fs, block_map_t *map, size_t offset, size_t written){
+	release_reservation(fs, map);
+	if (written == 0)
+		return -1;
+	int inode_index = map->inode_index;
 
-		memcpy(temp_block, src + currByte, bytesLeft);
-		block_store_write(fs->bs, block_index, temp_block);
+	inode_t node;
+	get_inode(fs, inode_index, &node);
+	if (offset + written > node.file_size){
+		node.file_size = offset + written;
+		write_inode(fs, inode_index, &node);
+	}
+	return written;
+}
+
+ssize_t fs_write(F16FS_t *fs, int fd, const void *src, size_t nbyte){
+	if (src == NULL)
+		return -1;
+	block_map_t *map = io_begin(fs, fd, true, false);
+	if (map == NULL)
+		return -1;
+	ssize_t written = write_at(fs, map, src, nbyte, fs->file_descriptor_table[fd].offset);
+	if (written > 0)
+		fs->file_descriptor_table[fd].offset+=written;
+	if (!io_end(fs, fd, map))
+		return -1;
+	return written;
+}
+
+ssize_t fs_pwrite(F16FS_t *fs, int fd, const void *src, size_t nbyte, off_t offset){
+	if (fs == NULL || src == NULL || !in_file_range(fs, offset, nbyte))
+		return -1;
+	block_map_t *map = io_begin(fs, fd, true, true);
+	if (map == NULL)
+		return -1;
+	ssize_t written = write_at(fs, map, src, nbyte, offset);
+	if (!io_end(fs, fd, map))
+		return -1;
+	return written;
+}
+
+//fs_write and fs_pwrite both end up here, writes at offset and leaves the descriptor's own offset alone
+// 6 + 256 + 256*256 = 65,798 max block index is 65,797 then (default geometry)
+static ssize_t write_at(F16FS_t *fs, block_map_t *map, const void *src, size_t nbyte, size_t offset){
+	if (nbyte == 0)
+		return 0;
+
+	char *block_data; 			//partial blocks get patched right in the block store
+	unsigned batch[BATCH_BLOCKS]; //full blocks get resolved (and allocated) first, then copied in one writev
+
+	size_t currByte = 0; 		//this will allow us to track how man bytes we have written so far, 
+	size_t currOffset = 0; 		//this will tell us where we are currently at within the file as we write
+	size_t relativeBlock = 0; 	//this will tell us what block we are at, relative to the blocks within a file
+	size_t bytesLeft = 0;
+	bytesLeft = nbyte;
+
+	currOffset = offset;
+	//the map has the inode for the file in the fd
+	//nothing can be mapped at or past max_file_blocks, so a write starting there can't put anything anywhere
+	if (currOffset / fs->block_size >= fs->max_file_blocks)
+		return -1;
+
+	//blocks past the end of the file are the ones that need allocating, grab them as an extent up front
+	//pointer blocks come out of the same reservation, if it runs short allocate_block goes one at a time
+	size_t allocatedBlocks = (map->node.file_size + fs->block_size - 1) / fs->block_size;
+	size_t firstNewBlock = currOffset / fs->block_size > allocatedBlocks ? currOffset / fs->block_size : allocatedBlocks;
+	size_t endBlock = (currOffset + nbyte + fs->block_size - 1) / fs->block_size;
+	if (endBlock > fs->max_file_blocks)
+		endBlock = fs->max_file_blocks;
+	reserve_blocks(fs, map, endBlock > firstNewBlock ? endBlock - firstNewBlock : 0);
+
+	//check if we start in middle of block
+	int block_byte_offset = currOffset % fs->block_size; //any bytes over a block means we are inside a block 
+	relativeBlock = currOffset / fs->block_size;
+	if (block_byte_offset > 0){
+		//we are starting inside a block, so write the part of it we cover
+
+		block_data = partial_block(fs, map, relativeBlock);
+		if (block_data == NULL){
+			release_reservation(fs, map);
+			return -1;
+		}
+		size_t headBytes = fs->block_size - block_byte_offset;
+		if (headBytes > bytesLeft)
+			headBytes = bytesLeft;
+		memcpy(block_data + block_byte_offset, src, headBytes);
+		currByte+=headBytes; 	
+		bytesLeft-=headBytes;
+		currOffset+=headBytes;
+		relativeBlock++;
+	}
+
+	//once here, we should always be starting with full block.
+	while (bytesLeft >= fs->block_size){
+		size_t want = bytesLeft / fs->block_size;
+		if (want > BATCH_BLOCKS)
+			want = BATCH_BLOCKS;
+		size_t found = map_blocks(fs, map, relativeBlock, want, false, batch);
+		//the batch's mapping can commit here, so writers on other files get their turn while this one copies
+		txn_split(fs);
+		struct iovec from = { (char *)src + currByte, found * fs->block_size };
+		size_t copied = block_store_writev(fs->bs, batch, found, &from, 1);
+
+		currByte+=copied * fs->block_size;
+		bytesLeft-=copied * fs->block_size;
+		currOffset+=copied * fs->block_size;
+		relativeBlock+=copied;
+
+		if (copied < want) //out of space
+			return finish_write(fs, map, offset, currByte);
+	}
+
+	if (bytesLeft > 0){
+		block_data = partial_block(fs, map, relativeBlock);
+		if (block_data == NULL)
+			return finish_write(fs, map, offset, currByte);
+
+		memcpy(block_data, (const char *)src + currByte, bytesLeft);
 		currByte += bytesLeft;
 		currOffset+=bytesLeft;
 
 	}
-	fs->file_descriptor_table[fd].offset+=currByte;
-	get_inode(fs, inode_ind, &node);
-	node.file_size += currByte;
-	write_inode(fs, inode_ind, &node);
-	return currByte;
+	return finish_write(fs, map, offset, currByte);
 }
 
+//takes the descriptor table too, nothing can be reading or writing while the file's blocks go back
 int fs_remove(F16FS_t *fs, const char *path){
 	if (fs == NULL || path == NULL || path[0] != '/')
 		return -1;
+	pthread_mutex_lock(&fs->ns_lock);
+	pthread_rwlock_wrlock(&fs->fd_lock);
+	int result = remove_locked(fs, path);
+	if (!txn_end(fs))
+		result = -1;
+	pthread_rwlock_unlock(&fs->fd_lock);
+	pthread_mutex_unlock(&fs->ns_lock);
+	return result;
+}
+
+//fs_remove with ns_lock and fd_lock held
+static int remove_locked(F16FS_t *fs, const char *path){
+	char fname[FS_NAME_MAX];
+	if (!path_basename(path, fname)) //trailing slash would leave the entry in the parent
+		return -1;
 	
 	//so, first, we need to see if our path is valid, so lets get the inode it leads to.
 	int index = existing_traversal(fs, path);
@@ -799,114 +1852,139 @@ int fs_remove(F16FS_t *fs, const char *path){
 	
 	inode_t node;
 	get_inode(fs, index, &node);
-	uint16_t temp[256] = {0};
 
-	//can use get dir then check the dyn array size, test does it and it passes so yeah
+	//the directory's index knows how many entries it has
 	if (node.type == FS_DIRECTORY){
-		dyn_array_t *results = fs_get_dir(fs, path);
-		if ( dyn_array_size(results) != 0 ){
-		//directory not empty, remove fails
-		dyn_array_destroy(results);
-		return -1;
-		}
-	dyn_array_destroy(results);
+		dir_index_t *dir_index = dir_index_for(fs, index);
+		if (dir_index == NULL || dir_index->used != 0)
+			return -1; //directory not empty, remove fails
+		dir_index_drop(fs, index);
 	}
 	//directory is empty, so now, free the file. Just check what is there and release the taken blocks.
 	
 	int i; 
+	block_run_t run = {0, 0};
+	if (fs->extents)
+		extent_release_all(fs, &node, index, &run); //leaves every pointer below at 0
 	for (i = 0; i < 6; i++){
-		if (node.directPtrs[i] != -1){
-			block_store_release(fs->bs, node.directPtrs[i]);
-			node.directPtrs[i] = -1;
+		if (node.directPtrs[i] != 0){
+			release_run(fs, &run, node.directPtrs[i]);
+			node.directPtrs[i] = 0;
 			//free the blocks, and set the pointers to null (we will clear this inode when we remove, so it is clean for other stuff
 			//clean meaning same as when we formatted it in the original format
 		}
 	}
-	if (node.indirectOne != -1){	//now we check if there are indirect pointers.
-									//release all 256 if present, that block points to
+	size_t per_block = fs->pointers_per_block;
+	if (node.indirectOne != 0){	//now we check if there are indirect pointers.
+									//release all of them if present, that block points to
 									//then release pointer block
-									//then set to -1
+									//then set to 0
 
 		
-		//read in the pointer block
-		block_store_read(fs->bs, node.indirectOne, temp);
-		for (i = 0; i < 256; i++){
-			if (temp[i] != 0){ //if points to block
-				block_store_release(fs->bs, temp[i]);						
+		//the pointer block is right there in the block store
+		const uint8_t *temp = meta_get(fs, node.indirectOne);
+		for (i = 0; temp && (size_t)i < per_block; i++){
+			if (ptr_get(fs, temp, i) != 0){ //if points to block
+				release_run(fs, &run, ptr_get(fs, temp, i));
 			}
 		}
 		//now we free the pointer block
-		block_store_release(fs->bs, node.indirectOne);
-		node.indirectOne = -1;	
+		release_run(fs, &run, node.indirectOne);
+		node.indirectOne = 0;	
 	}	
 	//freed direct, indirect one, now second indirect if exists.
 	
-	if (node.indirectTwo != -1){				//so, for every block that our 1st pointer block points to
+	if (node.indirectTwo != 0){				//so, for every block that our 1st pointer block points to
 											//do what we did for the first indirect
-		uint16_t temp2[256] = {0};
-		block_store_read(fs->bs, node.indirectTwo, temp);
+		const uint8_t *temp = meta_get(fs, node.indirectTwo);
 		//now we have the block that points to blocks of pointers.
-		int j;
-		for( i = 0; i < 256; i++){
-			if (temp[i] != 0){
-				block_store_read(fs->bs, temp[i], temp2);
+		size_t j;
+		for( i = 0; temp && (size_t)i < per_block; i++){
+			unsigned child = ptr_get(fs, temp, i);
+			if (child != 0){
+				const uint8_t *temp2 = meta_get(fs, child);
 				//gotta loop thru it now
-				for (j = 0; j < 256; j++){
-					if (temp[j] != 0)
-						block_store_release(fs->bs, temp[j]);
+				for (j = 0; temp2 && j < per_block; j++){
+					if (ptr_get(fs, temp2, j) != 0)
+						release_run(fs, &run, ptr_get(fs, temp2, j));
 					
 				}
-				block_store_release(fs->bs, temp[i]); //release block of pointers
+				release_run(fs, &run, child); //release block of pointers
 
 			}
 
 		}
-		node.indirectTwo = -1;
+		release_run(fs, &run, node.indirectTwo);
+		node.indirectTwo = 0;
 		
 	}
+	block_store_release_range(fs->bs, run.start, run.count);
 	node.refCount = -1;
-	for (i = 0; i < 256; i++){
-		if (fs->file_descriptor_table[i].inode_index == index){
-			fs->file_descriptor_table[i].inode_index = -1;
-		}
-	}
+	bitmap_reset(fs->inode_map, index);
+	//only the descriptors actually open on it
+	while (fs->open_fds[index] >= 0)
+		fd_release(fs, fs->open_fds[index]);
 	write_inode(fs, index, &node);
 	//now, we have to remove the file name and reference from the parent directory. 
 	//gonna be kind of a hacky fix, but we have a creation path traversal, which gives parent inode,
 	//so got to parent inode, find the matching file name for our file, then delete that reference.
 	index = creation_traversal(fs, path);
-	get_inode(fs, index, &node);
-	
-	i = 0;
-	int path_len = 0;
-	while (path[i] != (char)0)
-		i++;	
-	int j = 0;
-	path_len = i;
-	i = path_len - 1; //index of last char is length - 1
-	char fname[FS_NAME_MAX];
-	while (path[i] != '/'){
-		j++;
-		i--;
+	size_t pos;
+	if (dir_lookup(fs, index, fname, &pos) >= 0)
+		dir_remove_at(fs, index, pos);
+	return 0;
+}
+
+//hands out the next block of the map's reservation, grabbing another extent when it runs dry
+//each write reserves through its own map, so concurrent writers never hand out each other's blocks
+static unsigned allocate_block(F16FS_t *fs, block_map_t *map){
+	if (map->reserve_count == 0 && map->reserve_goal > 0){
+		if (block_store_allocate_extent(fs->bs, map->reserve_goal, 1, &map->reserve_start, &map->reserve_count))
+			map->reserve_goal -= map->reserve_count;
+		else
+			map->reserve_goal = 0; //no free runs at all, single allocate will say so too
 	}
-	int fn_len = j;
-	//now j is fname length
-	
-	for (j = 0, i = path_len - fn_len; j < fn_len; j++, i++){
-		fname[j] = path[i];
-	}
-	fname[fn_len] = '\0';
-	char tmp_block[512];
-	block_store_read(fs->bs, node.directPtrs[0], tmp_block);
-	directory_entry_t *entries = (directory_entry_t*)tmp_block;
-	for (i = 0; i < 7; i++){
-		if (strcmp(entries[i].fname, fname) == 0){
-			memset(entries[i].fname, 0, 64);
-			entries[i].inode_index = -1;
-		}
+	if (map->reserve_count > 0){
+		map->reserve_count--;
+		return map->reserve_start++;
 	}
-	block_store_write(fs->bs, node.directPtrs[0], tmp_block);
-	return 0;
+	return block_store_allocate(fs->bs);
+}
+
+//allocate_block, then as many blocks after it as the reservation has, up to want
+static unsigned allocate_run(F16FS_t *fs, block_map_t *map, unsigned want, unsigned *got){
+	unsigned first = allocate_block(fs, map);
+	*got = first == 0 ? 0 : 1;
+	while (*got < want && map->reserve_count > 0 && map->reserve_start == first + *got){
+		map->reserve_start++;
+		map->reserve_count--;
+		(*got)++;
+	}
+	return first;
+}
+
+static void reserve_blocks(F16FS_t *fs, block_map_t *map, size_t goal){
+	//can never map more than max_file_blocks (65798 by default) in a file anyway
+	map->reserve_goal = goal > fs->max_file_blocks ? fs->max_file_blocks : goal;
+	map->reserve_count = 0;
+}
+
+//whatever the write didn't use goes back
+static void release_reservation(F16FS_t *fs, block_map_t *map){
+	block_store_release_range(fs->bs, map->reserve_start, map->reserve_count);
+	map->reserve_count = 0;
+	map->reserve_goal = 0;
+}
+
+//adds block to the run if it's next in line, otherwise releases the run and starts a new one
+static void release_run(F16FS_t *fs, block_run_t *run, unsigned block){
+	if (run->count > 0 && block == run->start + run->count){
+		run->count++;
+		return;
+	}
+	block_store_release_range(fs->bs, run->start, run->count);
+	run->start = block;
+	run->count = 1;
 }
 
 int get_actual_block_write(int relativeIndex, int inode_index, F16FS_t *fs){
@@ -918,202 +1996,501 @@ int get_actual_block_read(int relativeIndex, int inode_index, F16FS_t *fs){
 }
 
 
-//takes in relativeIndex for file block (0-5 for direct, 6-261 for 1stDirect, 262-65,797`
+//takes in relativeIndex for file block (0-5 for direct, 6-261 for 1stDirect, 262-65,797` with the default geometry
 int get_actual_block_index(int relativeIndex, int inode_index, F16FS_t *fs, bool isRead){
-	if (relativeIndex < 0 || relativeIndex > 65797)
+	if (fs == NULL)
 		return -1;
+	pthread_mutex_lock(&fs->ns_lock);
+	int block_index = scratch_block(fs, inode_index, relativeIndex, isRead);
+	if (!txn_end(fs))
+		block_index = -1;
+	pthread_mutex_unlock(&fs->ns_lock);
+	return block_index;
+}
 
-	int block_ind;
-	inode_t node;
-	get_inode(fs, inode_index, &node);
+//one off lookups go through the scratch map, starting it fresh each time, ns_lock has to be held
+static int scratch_block(F16FS_t *fs, int inode_index, int relativeIndex, bool isRead){
+	if (relativeIndex < 0)
+		return -1;
+	block_map_reset(fs, fs->scratch_map, inode_index);
+	return map_block(fs, fs->scratch_map, relativeIndex, isRead);
+}
+
+static void block_map_reset(F16FS_t *fs, block_map_t *map, int inode_index){
+	map->inode_index = inode_index;
+	map->indirect_id = 0; //block 0 is never a pointer block, so nothing matches
+	map->double_id = 0;
+	map->extent_hint = 0;
+	get_inode(fs, inode_index, &map->node);
+}
+
+//start of every call that goes through a descriptor, the map to use with everything it needs locked
+//the descriptor's own map is locked for the whole call, so fs_read/fs_write/fs_seek on one descriptor take turns
+//positional calls don't touch the offset, if the map is busy they borrow a spare one to look blocks up through instead
+//reads share the inode, writes get it to themselves, either way the map's copy of the inode is fresh
+static block_map_t *io_begin(F16FS_t *fs, int fd, bool writing, bool positional){
+	if (fs == NULL)
+		return NULL;
+	pthread_rwlock_rdlock(&fs->fd_lock);
+	if (fd_get(fs, fd) == NULL){
+		pthread_rwlock_unlock(&fs->fd_lock);
+		return NULL;
+	}
+	int inode_index = fs->file_descriptor_table[fd].inode_index;
+	block_map_t *map = fs->block_maps[fd];
+	bool own = true;
+	if (!positional)
+		pthread_mutex_lock(&map->lock);
+	else if (pthread_mutex_trylock(&map->lock) != 0){
+		map = spare_map_get(fs);
+		own = false;
+		if (map == NULL){
+			pthread_rwlock_unlock(&fs->fd_lock);
+			return NULL;
+		}
+	}
+	if (writing)
+		pthread_rwlock_wrlock(&fs->inode_locks[inode_index]);
+	else
+		pthread_rwlock_rdlock(&fs->inode_locks[inode_index]);
+	if (own)
+		get_inode(fs, inode_index, &map->node);
+	else
+		block_map_reset(fs, map, inode_index);
+	return map;
+}
+
+//undoes io_begin, a map that isn't the descriptor's goes back to the spares
+//false if the call's metadata changes couldn't be committed, see txn_end
+static bool io_end(F16FS_t *fs, int fd, block_map_t *map){
+	bool committed = txn_end(fs);
+	pthread_rwlock_unlock(&fs->inode_locks[map->inode_index]);
+	if (map == fs->block_maps[fd])
+		pthread_mutex_unlock(&map->lock);
+	else
+		spare_map_put(fs, map);
+	pthread_rwlock_unlock(&fs->fd_lock);
+	return committed;
+}
+
+//the map and its two pointer block buffers
+static block_map_t *block_map_create(F16FS_t *fs){
+	block_map_t *map = (block_map_t*)malloc(sizeof(block_map_t));
+	if (map == NULL)
+		return NULL;
+	map->indirect = (uint8_t*)malloc(fs->block_size);
+	map->double_top = (uint8_t*)malloc(fs->block_size);
+	if (map->indirect == NULL || map->double_top == NULL){
+		free(map->indirect);
+		free(map->double_top);
+		free(map);
+		return NULL;
+	}
+	map->reserve_count = 0;
+	map->reserve_goal = 0;
+	pthread_mutex_init(&map->lock, NULL);
+	return map;
+}
+
+static void block_map_free(block_map_t *map){
+	if (map == NULL)
+		return;
+	pthread_mutex_destroy(&map->lock);
+	free(map->indirect);
+	free(map->double_top);
+	free(map);
+}
+
+//a spare map for one call, a new one only when every spare is already lent out
+static block_map_t *spare_map_get(F16FS_t *fs){
+	pthread_mutex_lock(&fs->spare_lock);
+	block_map_t *map = fs->spare_maps;
+	if (map != NULL)
+		fs->spare_maps = map->next_spare;
+	pthread_mutex_unlock(&fs->spare_lock);
+	return map != NULL ? map : block_map_create(fs);
+}
+
+//kept until unmount, there are only ever as many as calls that found their descriptor's map busy at once
+static void spare_map_put(F16FS_t *fs, block_map_t *map){
+	pthread_mutex_lock(&fs->spare_lock);
+	map->next_spare = fs->spare_maps;
+	fs->spare_maps = map;
+	pthread_mutex_unlock(&fs->spare_lock);
+}
+
+static void block_map_drop(F16FS_t *fs, int fd){
+	block_map_free(fs->block_maps[fd]);
+	fs->block_maps[fd] = NULL;
+}
+
+//pointer blocks hold 16-bit ids while every block fits in 16 bits, 32-bit ones past that
+static unsigned ptr_get(const F16FS_t *fs, const uint8_t *pointers, size_t slot){
+	if (fs->pointer_width == 2)
+		return ((const uint16_t *)pointers)[slot];
+	return ((const uint32_t *)pointers)[slot];
+}
+
+static void ptr_set(const F16FS_t *fs, uint8_t *pointers, size_t slot, unsigned block){
+	if (fs->pointer_width == 2)
+		((uint16_t *)pointers)[slot] = block;
+	else
+		((uint32_t *)pointers)[slot] = block;
+}
+
+//brings pointer block id into the cache slot, re-reading it if asked
+static uint8_t *load_pointers(F16FS_t *fs, unsigned *cached_id, uint8_t *cache, unsigned id, bool reload){
+	if (*cached_id != id || reload){
+		meta_read(fs, id, cache);
+		*cached_id = id;
+	}
+	return cache;
+}
+
+//new pointer blocks have to start out all zeros, whatever was in the block before is garbage
+static int new_pointer_block(F16FS_t *fs, block_map_t *map, unsigned *cached_id, uint8_t *cache){
+	int block_ind = allocate_block(fs, map);
+	if (block_ind <= 0)
+		return -1;
+	memset(cache, 0, fs->block_size);
+	meta_write(fs, block_ind, cache);
+	*cached_id = block_ind;
+	return block_ind;
+}
+
+//entry slot of pointer block id, allocating what it points to if we're writing and it's missing
+//if childCache is given, a newly allocated child is a pointer block and gets zeroed into it
+static int map_pointer(F16FS_t *fs, block_map_t *map, unsigned *cached_id, uint8_t *cache, unsigned id, size_t slot,
+		bool isRead, unsigned *child_id, uint8_t *child_cache){
+	uint8_t *pointers = load_pointers(fs, cached_id, cache, id, false);
+	if (ptr_get(fs, pointers, slot) == 0)
+		pointers = load_pointers(fs, cached_id, cache, id, true); //might be stale
+	if (ptr_get(fs, pointers, slot) == 0){
+		if (isRead)
+			return -1;
+		int newBlock = child_cache ? new_pointer_block(fs, map, child_id, child_cache) : (int)allocate_block(fs, map);
+		if (newBlock <= 0)
+			return -1;
+		ptr_set(fs, pointers, slot, newBlock);
+		meta_write(fs, id, pointers);
+	}
+	return ptr_get(fs, pointers, slot);
+}
+
+//the real translation, goes through the map's cached inode and pointer blocks
+//P pointers per block: 6 direct, then P through indirectOne, then P*P through indirectTwo
+static int map_block(F16FS_t *fs, block_map_t *map, size_t relativeIndex, bool isRead){
+	if (relativeIndex >= fs->max_file_blocks)
+		return -1;
+	if (fs->extents)
+		return extent_map_block(fs, map, relativeIndex, isRead, NULL);
+
+	size_t per_block = fs->pointers_per_block;
+	inode_t *node = &map->node;
 	if (relativeIndex < 6){
-		block_ind = node.directPtrs[relativeIndex];
-		if (block_ind == -1){ 	//this means no block allocated to this block pointer
-			if(isRead){ //if we are reading, but the pointer points no where, nothing to read
+		if (node->directPtrs[relativeIndex] == 0){ 	//this means no block allocated to this block pointer
+			if (isRead) //if we are reading, but the pointer points no where, nothing to read
 				return -1;
-			}
-			block_ind = block_store_allocate(fs->bs);
+			int block_ind = allocate_block(fs, map);
 			if (block_ind <= 0) //if allocate failed
 				return -1;
-			node.directPtrs[relativeIndex] = block_ind;
-			write_inode(fs, inode_index, &node); //now node is updated with new pointer	
-		}
-		return block_ind;	
-	}	else if (relativeIndex < 262){ //first Indirect
-		block_ind = node.indirectOne;
-
-		if (block_ind == -1){ 	//this means no indirect block for the indirect block pointer, 
-								//so we must get free block, make it pointers, set it the indirect
-								//then get another free block, point the first indirect block pointer in the new block
-								//to that allocated block, then return that index
-			if( isRead )
-				return -1;
-			
-			block_ind = block_store_allocate(fs->bs);
-			if (block_ind <= 0)
-				return -1;
-			node.indirectOne = block_ind;
-			write_inode(fs, inode_index, &node);
-			int NewBlockInd = block_store_allocate(fs->bs);
-			if (NewBlockInd <= 0)
-				return -1;
-			uint16_t block[256] = {0}; //block of pointers fam
-		
-			block[relativeIndex - 6] = NewBlockInd;
-			//This allows for gaps in the block of block pointers, in theory, this should be okay, because when we later ask for 
-			//things that do not have spots, we will know. Since this function is relative to actual tranlsation, we do not want
-			//to make any assumptions about the block pointers, but we also dont want to start sequentially, because the would defeat
-			//the translations purpose
-			//if we find some errors due to this behavior, that will suck
-
-			block_store_write(fs->bs, block_ind, block);
-			//now we have the indirect block pointing to a block of pointers, so we use the free block to be given back
-			//as the block index to be used for a write, it is allocated, but we don't need to do anything other than keep track of it
-			//which we did when we put it into the indirectBlock pointer
-			//return the new pointer?
-			return NewBlockInd;
-		} else { 	//if we get here, then the indirectOne has a block set up already, so find the relative block,
-					//if it exists, great, return its real index
-					//if it is 0, meaning it doesn't exist, get a free block, point to it, then return it
-			uint16_t block[256] = {0};
-			block_store_read(fs->bs, block_ind, block);
-
-			if (block[relativeIndex - 6] == 0){
-				
-				if (isRead)
-					return -1;
-
-				int NewBlockInd = block_store_allocate(fs->bs);
-				if (NewBlockInd <= 0)
-					return -1;
-				block[relativeIndex - 6] = NewBlockInd;
-				block_store_write(fs->bs, block_ind, block);
-				return NewBlockInd;
-			} else {	//if here, then block should be allocated for use, so just return its index
-				return block[relativeIndex - 6];
-			}
+			node->directPtrs[relativeIndex] = block_ind;
+			write_inode(fs, map->inode_index, node); //now node is updated with new pointer	
 		}
-	
-	} else { 	//can do else, we know it is not beyond scope, and it isnt in the other 2, so has to be second indirect
-		block_ind = node.indirectTwo;
-		
-		if (block_ind < 0) { 	//this means, we have no second indirect block, so gotta get that
-								//Then we gotta allocate a block of pointers point to
-								//then allocate another block of pointers to  point to
-								//finally, point the relative spot in the previous block to a free block
-								//then return that free block
-		
+		return node->directPtrs[relativeIndex];
+	}
+
+	if (relativeIndex < 6 + per_block){ //first Indirect
+		if (node->indirectOne == 0){ //no block of pointers yet, make one
 			if (isRead)
 				return -1;
-				
-			block_ind = block_store_allocate(fs->bs);
+			int block_ind = new_pointer_block(fs, map, &map->indirect_id, map->indirect);
 			if (block_ind <= 0)
 				return -1;
-			node.indirectTwo = block_ind;
-			write_inode(fs, inode_index, &node);
-			uint16_t block[256] = {0};
-	
-			//now need a block of pointers to point to
-			int NewPointerBlock = block_store_allocate(fs->bs);
-			if (NewPointerBlock <= 0)
-				return -1;
-			//so we have a relative block num. 
-			//First take off 262
-			//Now, divide by 256 to get the block inside we need
-			//then the remainder can be used to get the index within that block
-			relativeIndex = relativeIndex - 262;
-			
-			//Level one block = block pointing to blocks of pointers
-			//level two block = pointer to by level one, points to real block
-			int levelOneBlockIndex = relativeIndex / 256; //0 means first block of pointers
-			int levelTwoBlockIndex = relativeIndex % 256; //0 means first block pointed to by the second level block
-
-			//we know neither exist because we just made it
-			block[levelOneBlockIndex] = NewPointerBlock;
-			block_store_write(fs->bs, block_ind, block);
-			//now we point to block, which points to another block
-			//that other block will be pointers too
-			block[levelOneBlockIndex] = 0; //now all zeros
-			
-			
-			int NewBlockForStorage = block_store_allocate(fs->bs);
-			if (NewBlockForStorage <= 0)
-				return -1;
-				
-			block[levelTwoBlockIndex] = NewBlockForStorage; 
-			block_store_write(fs->bs, NewPointerBlock, block);
-			return NewBlockForStorage;	
-		} else {		//indrect points to block, so now we need to see if we can get the block we need....
-
-			relativeIndex = relativeIndex - 262;
-
-			int levelOneBlockIndex = relativeIndex / 256;
-
-			uint16_t temp[256] = {0};
+			node->indirectOne = block_ind;
+			write_inode(fs, map->inode_index, node);
+		}
+		return map_pointer(fs, map, &map->indirect_id, map->indirect, node->indirectOne, relativeIndex - 6, isRead,
+				NULL, NULL);
+	}
 
-			block_store_read(fs->bs, block_ind, temp); //we gotta check this block
+	//has to be second indirect
+	//Level one block = block pointing to blocks of pointers
+	//level two block = pointer to by level one, points to real block
+	size_t doubleIndex = relativeIndex - 6 - per_block;
+	if (node->indirectTwo == 0){
+		if (isRead)
+			return -1;
+		int block_ind = new_pointer_block(fs, map, &map->double_id, map->double_top);
+		if (block_ind <= 0)
+			return -1;
+		node->indirectTwo = block_ind;
+		write_inode(fs, map->inode_index, node);
+	}
+	int levelTwoBlock = map_pointer(fs, map, &map->double_id, map->double_top, node->indirectTwo,
+			doubleIndex / per_block, isRead, &map->indirect_id, map->indirect);
+	if (levelTwoBlock <= 0)
+		return -1;
+	return map_pointer(fs, map, &map->indirect_id, map->indirect, levelTwoBlock, doubleIndex % per_block, isRead,
+			NULL, NULL);
+}
 
-			if( temp[levelOneBlockIndex] == 0 ){ //we have a block, points to nothing, so two allocs for pointer block and actual block
-				
-				if (isRead)
-					return -1;
+//looks up (or allocates) count file blocks starting at relativeIndex into batch, stops at the first one that fails
+//extents hand back the rest of a run per lookup, so a contiguous file costs one search per extent
+static size_t map_blocks(F16FS_t *fs, block_map_t *map, size_t relativeIndex, size_t count, bool isRead, unsigned *batch){
+	size_t found = 0;
+	while (found < count){
+		size_t run = fs->extents ? count - found : 1;
+		int block_index = fs->extents ? extent_map_block(fs, map, relativeIndex + found, isRead, &run)
+				: map_block(fs, map, relativeIndex + found, isRead);
+		if (block_index < 0)
+			break;
+		for (; run > 0 && found < count; run--)
+			batch[found++] = block_index++;
+	}
+	return found;
+}
 
-				int newPointerBlock = block_store_allocate(fs->bs);
-				if (newPointerBlock <= 0)
-					return -1;
+//new block for the extent tree, kept out of the write's reservation so the data run stays contiguous
+static unsigned extent_tree_block(F16FS_t *fs){
+	unsigned block_id = block_store_allocate(fs->bs);
+	void *data = block_id == 0 ? NULL : meta_mut(fs, block_id);
+	if (data == NULL)
+		return 0;
+	memset(data, 0, fs->block_size);
+	return block_id;
+}
 
-				temp[levelOneBlockIndex] = newPointerBlock;
-				block_store_write(fs->bs, block_ind, temp);
+//list of the inode's extents, read out of the inode and extent tree the first time
+//readers sharing an inode can get here together, so the list is only put in extent_lists once it's complete
+static extent_list_t *extent_list_for(F16FS_t *fs, int inode_index){
+	if (inode_index < 0 || inode_index >= fs->inode_count)
+		return NULL;
+	extent_list_t *list = __atomic_load_n(&fs->extent_lists[inode_index], __ATOMIC_ACQUIRE);
+	if (list != NULL)
+		return list;
+
+	pthread_mutex_lock(&fs->extent_lock);
+	list = extent_list_load(fs, inode_index);
+	pthread_mutex_unlock(&fs->extent_lock);
+	return list;
+}
 
-				int levelTwoBlockIndex = relativeIndex % 256;
+//extent_list_for's slow half, extent_lock held
+static extent_list_t *extent_list_load(F16FS_t *fs, int inode_index){
+	extent_list_t *list = fs->extent_lists[inode_index];
+	if (list != NULL) //someone else loaded it first
+		return list;
+	inode_t node;
+	get_inode(fs, inode_index, &node);
+	if (node.extent_count > fs->max_extents)
+		return NULL;
+	list = (extent_list_t*)calloc(1, sizeof(extent_list_t));
+	if (list == NULL)
+		return NULL;
+	list->capacity = node.extent_count > 4 ? node.extent_count : 4;
+	list->extents = (extent_t*)malloc(sizeof(extent_t) * list->capacity);
+	if (list->extents == NULL){
+		free(list);
+		return NULL;
+	}
+	const uint32_t *root = node.extent_count > INLINE_EXTENTS ? meta_get(fs, node.extent_root) : NULL;
+	for (list->count = 0; list->count < node.extent_count; list->count++){
+		unsigned i = list->count;
+		if (i < INLINE_EXTENTS){
+			list->extents[i] = node.extents[i];
+			continue;
+		}
+		size_t leaf = (i - INLINE_EXTENTS) / fs->extents_per_leaf;
+		const extent_t *entries = root == NULL || root[leaf] == 0 ? NULL : meta_get(fs, root[leaf]);
+		if (entries == NULL){
+			free(list->extents);
+			free(list);
+			return NULL;
+		}
+		list->extents[i] = entries[(i - INLINE_EXTENTS) % fs->extents_per_leaf];
+	}
+	__atomic_store_n(&fs->extent_lists[inode_index], list, __ATOMIC_RELEASE);
+	return list;
+}
 
-				int newBlockForStorage = block_store_allocate(fs->bs);
+static void extent_list_drop(F16FS_t *fs, int inode_index){
+	extent_list_t *list = fs->extent_lists[inode_index];
+	if (list == NULL)
+		return;
+	free(list->extents);
+	free(list);
+	__atomic_store_n(&fs->extent_lists[inode_index], NULL, __ATOMIC_RELEASE);
+}
 
-				if (newBlockForStorage <= 0)
-					return -1;
+//makes sure the tree has a leaf for extent slot, so storing into it can't fail halfway
+static bool extent_slot_ready(F16FS_t *fs, inode_t *node, unsigned slot){
+	if (slot < INLINE_EXTENTS)
+		return true;
+	if (slot >= fs->max_extents)
+		return false;
+	if (node->extent_root == 0 && (node->extent_root = extent_tree_block(fs)) == 0)
+		return false;
+	uint32_t *root = meta_mut(fs, node->extent_root);
+	size_t leaf = (slot - INLINE_EXTENTS) / fs->extents_per_leaf;
+	if (root == NULL || (root[leaf] == 0 && (root[leaf] = extent_tree_block(fs)) == 0))
+		return false;
+	return true;
+}
 
-				int i;
-				for (i = 0; i < 255; i++)
-					temp[i] = 0;
+//writes list entries from..to-1 back to where they live, inline or in a leaf, then the inode
+static void extent_store(F16FS_t *fs, int inode_index, inode_t *node, const extent_list_t *list, unsigned from, unsigned to){
+	const uint32_t *root = node->extent_root == 0 ? NULL : meta_get(fs, node->extent_root);
+	unsigned i;
+	for (i = from; i < to; i++){
+		if (i < INLINE_EXTENTS){
+			node->extents[i] = list->extents[i];
+			continue;
+		}
+		size_t leaf = (i - INLINE_EXTENTS) / fs->extents_per_leaf;
+		extent_t *entries = root == NULL ? NULL : meta_mut(fs, root[leaf]);
+		if (entries != NULL)
+			entries[(i - INLINE_EXTENTS) % fs->extents_per_leaf] = list->extents[i];
+	}
+	node->extent_count = list->count;
+	write_inode(fs, inode_index, node);
+}
 
-				temp[levelTwoBlockIndex] = newBlockForStorage;
-				block_store_write(fs->bs, newPointerBlock, temp);
-				return newBlockForStorage;
-			} else {	//We have a block, points to a block of pointers, see if the block of pointers has the block we want
-				uint16_t pointers[256] = {0};
+//index of the first extent that ends past block, count if none do
+//the hint (and the one after it) are checked first, that's where sequential access lands
+static unsigned extent_search(const extent_list_t *list, unsigned block, unsigned hint){
+	unsigned i;
+	for (i = hint; i < list->count && i <= hint + 1; i++){
+		const extent_t *e = &list->extents[i];
+		if (e->logical + e->length > block && (i == 0 || list->extents[i - 1].logical + list->extents[i - 1].length <= block))
+			return i;
+	}
+	unsigned lo = 0, hi = list->count;
+	while (lo < hi){
+		unsigned mid = lo + (hi - lo) / 2;
+		if (list->extents[mid].logical + list->extents[mid].length <= block)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
 
-				block_store_read(fs->bs, temp[levelOneBlockIndex], pointers);
+//puts file blocks relativeIndex.. at device blocks block_id.., length of them, growing a neighbouring extent when it lines up
+//at is where extent_search said the blocks would go
+static bool extent_add(F16FS_t *fs, block_map_t *map, extent_list_t *list, unsigned at, unsigned relativeIndex,
+		unsigned block_id, unsigned length){
+	extent_t *prev = at > 0 ? &list->extents[at - 1] : NULL;
+	extent_t *next = at < list->count ? &list->extents[at] : NULL;
+	bool after_prev = prev && prev->logical + prev->length == relativeIndex && prev->start + prev->length == block_id;
+	bool before_next = next && next->logical == relativeIndex + length && next->start == block_id + length;
+	if (after_prev && before_next){ //fills the gap between them, two become one
+		prev->length += length + next->length;
+		memmove(next, next + 1, sizeof(extent_t) * (list->count - at - 1));
+		list->count--;
+		extent_store(fs, map->inode_index, &map->node, list, at - 1, list->count);
+		return true;
+	}
+	if (after_prev){
+		prev->length += length;
+		extent_store(fs, map->inode_index, &map->node, list, at - 1, at);
+		return true;
+	}
+	if (before_next){
+		next->logical -= length;
+		next->start -= length;
+		next->length += length;
+		extent_store(fs, map->inode_index, &map->node, list, at, at + 1);
+		return true;
+	}
 
-				int levelTwoIndex = relativeIndex % 256;
+	//a new extent, everything after it shifts down a slot
+	if (!extent_slot_ready(fs, &map->node, list->count))
+		return false;
+	if (list->count == list->capacity){
+		extent_t *extents = (extent_t*)realloc(list->extents, sizeof(extent_t) * list->capacity * 2);
+		if (extents == NULL)
+			return false;
+		list->extents = extents;
+		list->capacity *= 2;
+	}
+	memmove(&list->extents[at + 1], &list->extents[at], sizeof(extent_t) * (list->count - at));
+	list->extents[at].logical = relativeIndex;
+	list->extents[at].start = block_id;
+	list->extents[at].length = length;
+	list->count++;
+	extent_store(fs, map->inode_index, &map->node, list, at, list->count);
+	return true;
+}
 
-				//either we have a block, or not, we do, return its index, we dont allocate for it
-				if ( pointers[levelTwoIndex] == 0){
-					
-					if (isRead)
-						return -1;
-
-					int newBlock = block_store_allocate(fs->bs);
-					if (newBlock <= 0)
-						return -1;
-
-					pointers[levelTwoIndex] = newBlock;
-					block_store_write(fs->bs, temp[levelOneBlockIndex], pointers);
-					return newBlock;
-				} else {
-					int index = pointers[levelTwoIndex];
-					return index;
-				}
+//map_block for extent file systems, run gets how many blocks from here on are contiguous, if asked for
+//a read that lands in a hole gets how many blocks are left before the next extent instead
+//when writing, run also says how many blocks the caller could use, so new ones come out of the reservation together
+static int extent_map_block(F16FS_t *fs, block_map_t *map, size_t relativeIndex, bool isRead, size_t *run){
+	extent_list_t *list = relativeIndex < fs->max_file_blocks ? extent_list_for(fs, map->inode_index) : NULL;
+	if (list == NULL)
+		return -1;
+	unsigned at = extent_search(list, relativeIndex, map->extent_hint);
+	if (at < list->count && list->extents[at].logical <= relativeIndex){
+		const extent_t *e = &list->extents[at];
+		map->extent_hint = at;
+		if (run != NULL)
+			*run = e->logical + e->length - relativeIndex;
+		return e->start + (relativeIndex - e->logical);
+	}
+	if (isRead){
+		if (run != NULL)
+			*run = (at < list->count ? list->extents[at].logical : fs->max_file_blocks) - relativeIndex;
+		return -1;
+	}
+	//can't run into the next extent
+	unsigned want = run == NULL ? 1 : *run;
+	if (at < list->count && list->extents[at].logical - relativeIndex < want)
+		want = list->extents[at].logical - relativeIndex;
+	unsigned got;
+	int block_ind = allocate_run(fs, map, want, &got);
+	if (block_ind <= 0)
+		return -1;
+	if (!extent_add(fs, map, list, at, relativeIndex, block_ind, got)){
+		block_store_release_range(fs->bs, block_ind, got);
+		return -1;
+	}
+	if (run != NULL)
+		*run = got;
+	return block_ind;
+}
 
-			}
-		}
+//fs_remove's half for extent file systems, every run goes back whole, then the tree
+static void extent_release_all(F16FS_t *fs, inode_t *node, int inode_index, block_run_t *run){
+	extent_list_t *list = extent_list_for(fs, inode_index);
+	unsigned i;
+	for (i = 0; list != NULL && i < list->count; i++)
+		block_store_release_range(fs->bs, list->extents[i].start, list->extents[i].length);
+	if (node->extent_root != 0){
+		const uint32_t *root = meta_get(fs, node->extent_root);
+		size_t leaf;
+		for (leaf = 0; root != NULL && leaf < fs->block_size / sizeof(uint32_t) && root[leaf] != 0; leaf++)
+			release_run(fs, run, root[leaf]);
+		release_run(fs, run, node->extent_root);
 	}
-	return -1;		
+	extent_list_drop(fs, inode_index);
+	memset(node->block_info, 0, sizeof(node->block_info));
 }
 
 int fs_move(F16FS_t *fs, const char *src, const char *dst){	
 		if ( fs == NULL || src == NULL || dst == NULL ){
 			return -1;
 		}	
+		pthread_mutex_lock(&fs->ns_lock);
+		int result = move_locked(fs, src, dst);
+		if (!txn_end(fs))
+			result = -1;
+		pthread_mutex_unlock(&fs->ns_lock);
+		return result;
+}
+
+//fs_move with ns_lock held
+static int move_locked(F16FS_t *fs, const char *src, const char *dst){
 		char root[2] = {'/', '\0'};
 		if (strcmp(root, src) == 0)
 			return -1;
@@ -1124,79 +2501,21 @@ int fs_move(F16FS_t *fs, const char *src, const char *dst){
 		if (srcNode < 0 || dstNode < 0)
 			return -1;
 		
-		int i = 0;
-		int path_len = 0;
-		while (src[i] != (char)0)
-			i++;	
-		int j = 0;
-		path_len = i;
-		i = path_len - 1; //index of last char is length - 1
 		char oldName[FS_NAME_MAX];
-		while (src[i] != '/'){
-			j++;
-			i--;
-		}
-		int fn_len = j;
-		//now j is fname length
-
-		for (j = 0, i = path_len - fn_len; j < fn_len; j++, i++){
-			oldName[j] = src[i];
-		}
-		oldName[fn_len] = '\0';	
-		
-		i = 0;
-		path_len = 0;
-		while (dst[i] != (char)0)
-			i++;	
-		j = 0;
-		path_len = i;
-		i = path_len - 1; //index of last char is length - 1
 		char newName[FS_NAME_MAX];
-		while (dst[i] != '/'){
-			j++;
-			i--;
-		}
-		fn_len = j;
-		//now j is fname length
-	
-		for (j = 0, i = path_len - fn_len; j < fn_len; j++, i++){
-			newName[j] = dst[i];
-		}
-		newName[fn_len] = '\0';
-		char dstPathDirectory[64];
-		for (j = 0; j < path_len - fn_len; j++)
-				dstPathDirectory[j] = dst[j];
-		
-		dstPathDirectory[path_len - fn_len] = (char)0;
-		
+		if (!path_basename(src, oldName) || !path_basename(dst, newName))
+			return -1;
 		if ( srcNode == dstNode){ 	//so first check if its just a rename, if so
 									//just rename and return
-			char temp[512];
-			inode_t node;
-			get_inode(fs, dstNode, &node);
-			block_store_read(fs->bs, node.directPtrs[0], temp);
-			directory_entry_t *entries = (directory_entry_t*)temp;
-			
-			
-
-			//find this fname in parent node, change it to new fname
-			for (i = 0; i < 7; i++){
-				if ( strcmp(entries[i].fname, oldName) == 0 ){
-					memcpy(entries[i].fname, newName, 64);
-					block_store_write(fs->bs, node.directPtrs[0], temp);
-					return 0;
-				}
+			size_t pos;
+			if (dir_lookup(fs, dstNode, oldName, &pos) >= 0){
+				if (dir_lookup(fs, dstNode, newName, NULL) >= 0)
+					return -1; //something already has the new name
+				//find this fname in parent node, change it to new fname
+				return dir_rename_at(fs, dstNode, pos, newName) ? 0 : -1;
 			}
-		
-		}
-		//check if parentDir is full
-
-		dyn_array_t *result = fs_get_dir(fs, dstPathDirectory);
-		if (dyn_array_size(result) >= 7){
-			dyn_array_destroy(result);
-			return -1; //full directory and not a rename
 		}
-		dyn_array_destroy(result);
+		//directories grow, so the destination can't be full, only out of blocks
 		//first, lets get the inode index for the file.
 		int fileIndex = existing_traversal(fs, src);
 		
@@ -1208,59 +2527,466 @@ int fs_move(F16FS_t *fs, const char *src, const char *dst){
 		if (fileIndex == dstNode) //we have to node, if it matches its parent directory then error
 			return -1;
 				
-		if (fileIndex < 0){ //could be directory
-				fileIndex = existing_traversal_directory(fs, src);
-				if (fileIndex < 0)
-					return -1;
-		}
 		//check if new file already exists at the destination
-		int newPrnt = creation_traversal(fs, dst);
-		inode_t node;
-		get_inode(fs, newPrnt, &node);
-
-		char test[512];
-		block_store_read(fs->bs, node.directPtrs[0], test);
-		directory_entry_t *entries = (directory_entry_t*)test;
-		
-		for (i = 0; i < 7; i++){
-			if (strcmp(entries[i].fname, newName) == 0)
-				return -1;
-		}
+		if (dir_lookup(fs, dstNode, newName, NULL) >= 0)
+			return -1;
 		//so we have the file inode, it does not matter if a file or a directory, we just need
 		//to move it the new place and remove its ref from the old
-		
-		int oldParent = creation_traversal(fs, src);
-		get_inode(fs, oldParent, &node);
-
-		char tmp[512];
+		if (!dir_add(fs, dstNode, newName, fileIndex))
+			return -1;
 
 		//have to find it in old to remove it
-		block_store_read(fs->bs, node.directPtrs[0], tmp);
-		entries = (directory_entry_t*)tmp;
-		
-		for (i = 0; i < 7; i++){
-			if (strcmp(entries[i].fname, oldName) == 0){
-				entries[i].inode_index = -1;
-				memset(entries[i].fname, 0, 64);
-			}
+		size_t pos;
+		if (dir_lookup(fs, srcNode, oldName, &pos) >= 0)
+			dir_remove_at(fs, srcNode, pos);
+		return 0;
+}
+
+//FNV-1a, names are short so nothing fancier is worth it
+static uint32_t name_hash(const char *name){
+	uint32_t hash = 2166136261u;
+	while (*name != '\0'){
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void dir_block_init(directory_block_t *dir){
+	memset(dir, 0, sizeof(directory_block_t));
+	int i;
+	for (i = 0; i < DIR_ENTRY_COUNT; i++)
+		dir->entries[i].inode_index = -1;
+	dir->tag = DIR_HASHED;
+}
+
+static int dir_free_slot(const directory_block_t *dir){
+	int i;
+	for (i = 0; i < DIR_ENTRY_COUNT; i++){
+		if (dir->entries[i].inode_index < 0)
+			return i;
+	}
+	return -1;
+}
+
+static void dir_set(directory_block_t *dir, int slot, const char *name, int inode_index){
+	memset(dir->entries[slot].fname, 0, FS_NAME_MAX);
+	strncpy(dir->entries[slot].fname, name, FS_NAME_MAX - 1);
+	dir->entries[slot].inode_index = inode_index;
+	dir->hashes[slot] = name_hash(dir->entries[slot].fname);
+}
+
+static void dir_clear(directory_block_t *dir, int slot){
+	memset(dir->entries[slot].fname, 0, FS_NAME_MAX);
+	dir->entries[slot].inode_index = -1;
+	dir->hashes[slot] = 0;
+}
+
+static void dir_index_drop(F16FS_t *fs, int dir_inode){
+	dir_index_t *index = fs->dir_indexes[dir_inode];
+	if (index == NULL)
+		return;
+	free(index->block_ids);
+	free(index->buckets);
+	free(index->nodes);
+	free(index);
+	fs->dir_indexes[dir_inode] = NULL;
+}
+
+//puts every live node into a fresh table of bucket_count buckets
+static bool dir_index_rehash(dir_index_t *index, unsigned bucket_count){
+	int *buckets = (int*)malloc(sizeof(int) * bucket_count);
+	if (buckets == NULL)
+		return false;
+	unsigned i;
+	for (i = 0; i < bucket_count; i++)
+		buckets[i] = -1;
+	//walk the old chains, the free list isn't reachable from them
+	for (i = 0; i < index->bucket_count; i++){
+		int n = index->buckets[i];
+		while (n >= 0){
+			int next = index->nodes[n].next;
+			unsigned b = index->nodes[n].hash & (bucket_count - 1);
+			index->nodes[n].next = buckets[b];
+			buckets[b] = n;
+			n = next;
 		}
-		block_store_write(fs->bs, node.directPtrs[0], tmp);
-		//old entry does not have it anymore, so put it in new one
-		
-		int newParent = creation_traversal(fs, dst);
-		get_inode(fs, newParent, &node);
+	}
+	free(index->buckets);
+	index->buckets = buckets;
+	index->bucket_count = bucket_count;
+	return true;
+}
 
-		block_store_read(fs->bs, node.directPtrs[0], tmp);
+static bool dir_index_insert(dir_index_t *index, uint32_t hash, size_t pos){
+	if (index->used + 1 > index->bucket_count && !dir_index_rehash(index, index->bucket_count * 2))
+		return false;
+	int n = index->free_node;
+	if (n >= 0){
+		index->free_node = index->nodes[n].next;
+	} else {
+		if (index->node_count == index->node_capacity){
+			unsigned capacity = index->node_capacity * 2;
+			dir_node_t *nodes = (dir_node_t*)realloc(index->nodes, sizeof(dir_node_t) * capacity);
+			if (nodes == NULL)
+				return false;
+			index->nodes = nodes;
+			index->node_capacity = capacity;
+		}
+		n = index->node_count++;
+	}
+	unsigned b = hash & (index->bucket_count - 1);
+	index->nodes[n].hash = hash;
+	index->nodes[n].pos = pos;
+	index->nodes[n].next = index->buckets[b];
+	index->buckets[b] = n;
+	index->used++;
+	return true;
+}
 
-		entries = (directory_entry_t*)tmp;
-		
-		for (i = 0; i < 7; i++){
-			if (entries[i].inode_index < 0){ //free spot for it
-				entries[i].inode_index = fileIndex;
-				memcpy(entries[i].fname, newName, 64);
-				block_store_write(fs->bs, node.directPtrs[0], tmp);
-				return 0;
+static void dir_index_erase(F16FS_t *fs, dir_index_t *index, uint32_t hash, size_t pos){
+	int *link = &index->buckets[hash & (index->bucket_count - 1)];
+	while (*link >= 0){
+		int n = *link;
+		if (index->nodes[n].pos == pos){
+			*link = index->nodes[n].next;
+			index->nodes[n].next = index->free_node;
+			index->free_node = n;
+			index->used--;
+			if (pos / fs->dir_entries_per_block < index->free_hint)
+				index->free_hint = pos / fs->dir_entries_per_block;
+			return;
+		}
+		link = &index->nodes[n].next;
+	}
+}
+
+static bool dir_index_add_block(dir_index_t *index, unsigned block_id){
+	unsigned *block_ids = (unsigned*)realloc(index->block_ids, sizeof(unsigned) * (index->block_count + 1));
+	if (block_ids == NULL)
+		return false;
+	index->block_ids = block_ids;
+	index->block_ids[index->block_count++] = block_id;
+	return true;
+}
+
+//index for the directory, reads every block of it the first time
+static dir_index_t *dir_index_for(F16FS_t *fs, int dir_inode){
+	if (dir_inode < 0 || dir_inode >= fs->inode_count)
+		return NULL;
+	if (fs->dir_indexes[dir_inode] != NULL)
+		return fs->dir_indexes[dir_inode];
+
+	block_map_t *map = fs->scratch_map;
+	block_map_reset(fs, map, dir_inode);
+	if (map->node.type != FS_DIRECTORY || map->node.refCount < 0)
+		return NULL;
+
+	dir_index_t *index = (dir_index_t*)calloc(1, sizeof(dir_index_t));
+	if (index == NULL)
+		return NULL;
+	fs->dir_indexes[dir_inode] = index;
+	index->free_node = -1;
+	index->node_capacity = 8;
+	index->nodes = (dir_node_t*)malloc(sizeof(dir_node_t) * index->node_capacity);
+	if (index->nodes == NULL || !dir_index_rehash(index, 8)){
+		dir_index_drop(fs, dir_inode);
+		return NULL;
+	}
+
+	unsigned blocks = map->node.file_size / fs->block_size;
+	unsigned b;
+	size_t i;
+	for (b = 0; b < blocks; b++){
+		int block_id = map_block(fs, map, b, true);
+		if (block_id < 0 || !dir_index_add_block(index, block_id)){
+			dir_index_drop(fs, dir_inode);
+			return NULL;
+		}
+		for (i = 0; i < fs->dir_entries_per_block; i++){
+			size_t pos = (size_t)b * fs->dir_entries_per_block + i;
+			const directory_block_t *dir = dir_piece(fs, index, pos, false);
+			if (dir == NULL){
+				dir_index_drop(fs, dir_inode);
+				return NULL;
+			}
+			const directory_entry_t *entry = &dir->entries[pos % DIR_ENTRY_COUNT];
+			if (entry->inode_index < 0)
+				continue;
+			if (!dir_index_insert(index, dir->hashes[pos % DIR_ENTRY_COUNT], pos)){
+				dir_index_drop(fs, dir_inode);
+				return NULL;
 			}
 		}
-		return 0;
+	}
+	return index;
+}
+
+//the 512 byte piece of the directory that entry pos is in, straight from the block store
+//mutable is for changing it in place
+static directory_block_t *dir_piece(F16FS_t *fs, dir_index_t *index, size_t pos, bool mutable){
+	size_t b = pos / fs->dir_entries_per_block;
+	size_t piece = pos % fs->dir_entries_per_block / DIR_ENTRY_COUNT;
+	if (b >= index->block_count)
+		return NULL;
+	char *data = mutable ? meta_mut(fs, index->block_ids[b]) : (char *)meta_get(fs, index->block_ids[b]);
+	return data == NULL ? NULL : (directory_block_t *)(data + piece * DIR_BLOCK_BYTES);
+}
+
+//every piece of a fresh directory block starts out empty
+static bool dir_init_block(F16FS_t *fs, unsigned block_id){
+	directory_block_t *dir = meta_mut(fs, block_id);
+	if (dir == NULL)
+		return false;
+	size_t piece;
+	for (piece = 0; piece < fs->block_size / DIR_BLOCK_BYTES; piece++)
+		dir_block_init(&dir[piece]);
+	return true;
+}
+
+//inode the name points to in the directory, -1 if it isn't there (or dir_inode isn't a directory)
+//pos gets where the entry lives, if asked for
+static int dir_lookup(F16FS_t *fs, int dir_inode, const char *name, size_t *pos){
+	dir_index_t *index = dir_index_for(fs, dir_inode);
+	if (index == NULL)
+		return -1;
+	uint32_t hash = name_hash(name);
+	int n;
+	for (n = index->buckets[hash & (index->bucket_count - 1)]; n >= 0; n = index->nodes[n].next){
+		if (index->nodes[n].hash != hash)
+			continue;
+		size_t at = index->nodes[n].pos;
+		const directory_block_t *dir = dir_piece(fs, index, at, false);
+		if (dir == NULL)
+			continue;
+		const directory_entry_t *entry = &dir->entries[at % DIR_ENTRY_COUNT];
+		if (strncmp(entry->fname, name, FS_NAME_MAX) == 0){
+			if (pos != NULL)
+				*pos = at;
+			return entry->inode_index;
+		}
+	}
+	return -1;
+}
+
+//first free slot in the directory, adds a block to the end of it when all of them are full
+static bool dir_add(F16FS_t *fs, int dir_inode, const char *name, int inode_index){
+	dir_index_t *index = dir_index_for(fs, dir_inode);
+	if (index == NULL)
+		return false;
+	directory_block_t *dir = NULL;
+	unsigned b = index->free_hint;
+	size_t pos = 0;
+	int slot = -1;
+	for (; slot < 0 && b < index->block_count; b++){
+		for (pos = (size_t)b * fs->dir_entries_per_block; pos < (size_t)(b + 1) * fs->dir_entries_per_block; pos += DIR_ENTRY_COUNT){
+			dir = dir_piece(fs, index, pos, false);
+			slot = dir == NULL ? -1 : dir_free_slot(dir);
+			if (slot >= 0)
+				break;
+		}
+	}
+	if (slot >= 0)
+		b--; //loop stepped past the block it found room in
+	index->free_hint = b;
+
+	if (slot < 0){
+		//every block is full, directory gets a new one
+		int block_id = scratch_block(fs, dir_inode, index->block_count, false);
+		if (block_id < 0 || !dir_init_block(fs, block_id) || !dir_index_add_block(index, block_id))
+			return false;
+		inode_t node;
+		get_inode(fs, dir_inode, &node);
+		node.file_size = (uint64_t)index->block_count * fs->block_size;
+		write_inode(fs, dir_inode, &node);
+		pos = (size_t)b * fs->dir_entries_per_block;
+		slot = 0;
+	}
+	pos += slot;
+	dir = dir_piece(fs, index, pos, true);
+	if (dir == NULL || !dir_index_insert(index, name_hash(name), pos))
+		return false;
+	dir_set(dir, slot, name, inode_index);
+	dcache_store(fs, dir_inode, name, inode_index);
+	return true;
+}
+
+static void dir_remove_at(F16FS_t *fs, int dir_inode, size_t pos){
+	dir_index_t *index = dir_index_for(fs, dir_inode);
+	if (index == NULL)
+		return;
+	directory_block_t *dir = dir_piece(fs, index, pos, true);
+	if (dir == NULL)
+		return;
+	directory_entry_t *entry = &dir->entries[pos % DIR_ENTRY_COUNT];
+	dir_index_erase(fs, index, name_hash(entry->fname), pos);
+	dcache_store(fs, dir_inode, entry->fname, -1);
+	dir_clear(dir, pos % DIR_ENTRY_COUNT);
+}
+
+//entry stays where it is, only its name (and so its hash) changes
+static bool dir_rename_at(F16FS_t *fs, int dir_inode, size_t pos, const char *name){
+	dir_index_t *index = dir_index_for(fs, dir_inode);
+	if (index == NULL)
+		return false;
+	directory_block_t *dir = dir_piece(fs, index, pos, true);
+	if (dir == NULL)
+		return false;
+	directory_entry_t *entry = &dir->entries[pos % DIR_ENTRY_COUNT];
+	dir_index_erase(fs, index, name_hash(entry->fname), pos);
+	if (!dir_index_insert(index, name_hash(name), pos))
+		return false;
+	int inode_index = entry->inode_index;
+	dcache_store(fs, dir_inode, entry->fname, -1);
+	dir_set(dir, pos % DIR_ENTRY_COUNT, name, inode_index);
+	dcache_store(fs, dir_inode, name, inode_index);
+	return true;
+}
+
+static void dcache_init(F16FS_t *fs){
+	int i;
+	for (i = 0; i < DCACHE_SIZE; i++)
+		fs->dcache[i].parent = -1;
+	memset(&fs->dcache_stats, 0, sizeof(dcache_stats_t));
+}
+
+//slot (parent, name) lives in, direct mapped so a colliding name just evicts the old one
+static dentry_t *dcache_slot(F16FS_t *fs, int parent, uint32_t hash){
+	return &fs->dcache[(hash ^ ((uint32_t)parent * 2654435761u)) & (DCACHE_SIZE - 1)];
+}
+
+//inode name points to in parent, or -1, cached either way for next time
+//parents that aren't directories (or are gone) come back -1 from dir_lookup too, and that holds until
+//something gets created under that inode, which replaces the entry
+static int dcache_lookup(F16FS_t *fs, int parent, const char *name){
+	uint32_t hash = name_hash(name);
+	dentry_t *entry = dcache_slot(fs, parent, hash);
+	if (entry->parent == parent && entry->hash == hash && strncmp(entry->name, name, FS_NAME_MAX) == 0){
+		if (entry->inode_index < 0)
+			fs->dcache_stats.negative_hits++;
+		else
+			fs->dcache_stats.hits++;
+		return entry->inode_index;
+	}
+	fs->dcache_stats.misses++;
+	int inode_index = dir_lookup(fs, parent, name, NULL);
+	dcache_store(fs, parent, name, inode_index);
+	return inode_index;
+}
+
+static void dcache_store(F16FS_t *fs, int parent, const char *name, int inode_index){
+	if (strlen(name) >= FS_NAME_MAX)
+		return;
+	uint32_t hash = name_hash(name);
+	dentry_t *entry = dcache_slot(fs, parent, hash);
+	entry->parent = parent;
+	entry->hash = hash;
+	entry->inode_index = inode_index;
+	strcpy(entry->name, name);
+}
+
+int fs_dcache_stats(F16FS_t *fs, dcache_stats_t *stats){
+	if (fs == NULL || stats == NULL)
+		return -1;
+	pthread_mutex_lock(&fs->ns_lock);
+	*stats = fs->dcache_stats;
+	pthread_mutex_unlock(&fs->ns_lock);
+	return 0;
+}
+
+//path has to start with '/', the first component is right after it
+static void path_iter_init(path_iter_t *iter, const char *path){
+	iter->next = path + 1;
+}
+
+//next component in part, false when there are no more
+//"/a/b/" gives a, b and then an empty last one
+static bool path_next(path_iter_t *iter, path_slice_t *part){
+	if (iter->next == NULL)
+		return false;
+	const char *end = strchr(iter->next, '/');
+	part->start = iter->next;
+	if (end == NULL){
+		part->len = strlen(iter->next);
+		iter->next = NULL;
+	} else {
+		part->len = end - iter->next;
+		iter->next = end + 1;
+	}
+	return true;
+}
+
+//true once the last component has been handed out
+static bool path_done(const path_iter_t *iter){
+	return iter->next == NULL;
+}
+
+//copies the last component into name (FS_NAME_MAX bytes), false if it's empty or too long
+static bool path_basename(const char *path, char *name){
+	const char *slash = strrchr(path, '/');
+	const char *start = slash == NULL ? path : slash + 1;
+	size_t len = strlen(start);
+	if (len == 0 || len >= FS_NAME_MAX)
+		return false;
+	memcpy(name, start, len + 1);
+	return true;
+}
+
+//doubles the descriptor table (up to fd_limit), the new slots go on the free list lowest first
+static bool fd_table_grow(F16FS_t *fs){
+	int capacity = fs->fd_capacity == 0 ? FD_TABLE_START : fs->fd_capacity * 2;
+	if (capacity > fs->fd_limit)
+		capacity = fs->fd_limit;
+	if (capacity <= fs->fd_capacity)
+		return false;
+
+	file_descriptor_t *table = (file_descriptor_t*)realloc(fs->file_descriptor_table,
+			sizeof(file_descriptor_t) * capacity);
+	if (table == NULL)
+		return false;
+	fs->file_descriptor_table = table;
+	block_map_t **maps = (block_map_t**)realloc(fs->block_maps, sizeof(block_map_t*) * capacity);
+	if (maps == NULL)
+		return false;
+	fs->block_maps = maps;
+	fd_link_t *links = (fd_link_t*)realloc(fs->fd_links, sizeof(fd_link_t) * capacity);
+	if (links == NULL)
+		return false;
+	fs->fd_links = links;
+
+	int i;
+	for (i = capacity - 1; i >= fs->fd_capacity; i--){
+		table[i].inode_index = -1;
+		table[i].offset = 0;
+		maps[i] = NULL;
+		links[i].next = fs->fd_free;
+		links[i].prev = -1;
+		fs->fd_free = i;
+	}
+	fs->fd_capacity = capacity;
+	return true;
+}
+
+//descriptor entry if fd is open, NULL otherwise
+static file_descriptor_t *fd_get(F16FS_t *fs, int fd){
+	if (fs == NULL || fd < 0 || fd >= fs->fd_capacity || fs->file_descriptor_table[fd].inode_index < 0)
+		return NULL;
+	return &fs->file_descriptor_table[fd];
+}
+
+//takes fd off its inode's open list and puts it back on the free list
+static void fd_release(F16FS_t *fs, int fd){
+	fd_link_t *link = &fs->fd_links[fd];
+	int inode_index = fs->file_descriptor_table[fd].inode_index;
+	if (link->prev >= 0)
+		fs->fd_links[link->prev].next = link->next;
+	else
+		fs->open_fds[inode_index] = link->next;
+	if (link->next >= 0)
+		fs->fd_links[link->next].prev = link->prev;
+
+	fs->file_descriptor_table[fd].inode_index = -1;
+	link->prev = -1;
+	link->next = fs->fd_free;
+	fs->fd_free = fd;
 }
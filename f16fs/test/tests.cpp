@@ -1,6 +1,8 @@
 #include <cstdlib>
 #include <iostream>
+#include <atomic>
 #include <new>
+#include <thread>
 #include <vector>
 #include <dyn_array.h>
 using std::vector;
@@ -119,7 +121,7 @@ int fs_create(F16FS_t *const fs, const char *const fname, const ftype_t ftype);
     16. Error, path has trailing slash (no name for desired file)
     17. Error, bad path, path part too long
     18. Error, bad path, desired filename too long
-    19. Error, directory full.
+    19. Normal, directory grows past its first block
     20. Error, out of inodes.
     21. Error, out of data blocks & file is directory (requires functional write)
 
@@ -242,7 +244,9 @@ TEST(b_tests, file_creation_two) {
     }
 
     // CREATE_FILE 19
-    ASSERT_LT(fs_create(fs, "/a/z", FS_REGULAR), 0);
+    // /a has 7 entries, an eighth goes in a new block. Take it back out so the inode count below still works
+    ASSERT_EQ(fs_create(fs, "/a/z", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/a/z"), 0);
 
 
     // Start making files
@@ -727,6 +731,7 @@ TEST(d_tests, write_file_fill) {
     8. Error, NULL fs
     9. Error, NULL fname
     10. Error, Empty fname (same as file does not exist?)
+    11. Error, trailing slash (entry stays in its parent, directory still usable)
 */
 TEST(e_tests, remove_file) {
     vector<const char *> b_fnames{
@@ -738,7 +743,7 @@ TEST(e_tests, remove_file) {
 
     vector<const char *> a_fnames{"/file_a", "/file_b", "/file_c", "/file_d"};
 
-    const char *(test_fname[2]) = {"e_tests_a.f16fs", "e_tests_b.f16fs"};
+    const char *test_fname[2] = {"e_tests_a.f16fs", "e_tests_b.f16fs"};
 
     ASSERT_EQ(system("cp d_tests_full.f16fs e_tests_a.f16fs"), 0);
     ASSERT_EQ(system("cp c_tests.f16fs e_tests_b.f16fs"), 0);
@@ -777,6 +782,23 @@ TEST(e_tests, remove_file) {
     dyn_array_destroy(record_results);
 
 
+    // FS_REMOVE 11
+    ASSERT_LT(fs_remove(fs, "/folder/with_folder/"), 0);
+
+    record_results = fs_get_dir(fs, b_fnames[1]);
+    ASSERT_NE(record_results, nullptr);
+
+    ASSERT_TRUE(find_in_directory(record_results, "with_folder"));
+    ASSERT_EQ(dyn_array_size(record_results), 1);
+
+    dyn_array_destroy(record_results);
+
+    record_results = fs_get_dir(fs, b_fnames[3]);
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), 0);
+    dyn_array_destroy(record_results);
+
+
     ASSERT_EQ(fs_remove(fs, b_fnames[3]), 0);
 
     // FS_REMOVE 3
@@ -867,8 +889,9 @@ TEST(g_tests, seek) {
     ASSERT_EQ(position, 0);
 
     // FS_SEEK 3
+    // past EOF is allowed, it's how holes get made
     position = fs_seek(fs, fd_one, 98675309, FS_SEEK_CUR);
-    ASSERT_EQ(position, 33398272);
+    ASSERT_EQ(position, 98675309);
 
     // while we're at it, make sure seek didn't break the other one
     position = fs_seek(fs, fd_two, 0, FS_SEEK_CUR);
@@ -989,7 +1012,8 @@ TEST(h_tests, read) {
     ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_CUR), 519 * 512);
 
     // FS_READ 11
-    ASSERT_EQ(fs_seek(fs, fd, 98675309, FS_SEEK_CUR), 33398272);
+    // seeking past EOF doesn't stop at it anymore
+    ASSERT_EQ(fs_seek(fs, fd, 98675309, FS_SEEK_CUR), 519 * 512 + 98675309);
     ASSERT_EQ(fs_seek(fs, fd, -500, FS_SEEK_END), 33397772);
     nbyte = fs_read(fs, fd, write_space, 1024);
     ASSERT_EQ(nbyte, 500);
@@ -1201,6 +1225,1197 @@ TEST(j_tests, link) {
 
 #endif
 
+/*
+    Descriptors keep their own block maps, make sure they don't step on each other
+    1. Two descriptors extend the same file in turns through the indirect and double indirect blocks
+    2. A third descriptor reads all of it back
+*/
+
+TEST(k_tests, shared_file_descriptors) {
+    const char *test_fname = "k_tests.f16fs";
+
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/shared", FS_REGULAR), 0);
+
+    int fd_a = fs_open(fs, "/shared");
+    int fd_b = fs_open(fs, "/shared");
+    ASSERT_GE(fd_a, 0);
+    ASSERT_GE(fd_b, 0);
+
+    // 1
+    // 3 blocks at a time, alternating, runs well into the double indirects
+    uint8_t chunk[512 * 3];
+    const int rounds = 200;
+    for (int i = 0; i < rounds; ++i) {
+        int fd = i % 2 ? fd_b : fd_a;
+        memset(chunk, i, sizeof(chunk));
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t)(i * sizeof(chunk)));
+        ASSERT_EQ(fs_write(fs, fd, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+    }
+
+    // 2
+    int fd_c = fs_open(fs, "/shared");
+    ASSERT_GE(fd_c, 0);
+    for (int i = 0; i < rounds; ++i) {
+        ASSERT_EQ(fs_read(fs, fd_c, chunk, sizeof(chunk)), (ssize_t) sizeof(chunk));
+        for (size_t j = 0; j < sizeof(chunk); ++j) {
+            ASSERT_EQ(chunk[j], (uint8_t) i);
+        }
+    }
+
+    fs_unmount(fs);
+}
+
+/*
+    int fs_sync(F16FS_t *fs);
+    1. Inodes changed while mounted reach the file after a sync, a second mount sees them
+    2. NULL
+*/
+
+TEST(k_tests, sync_inodes) {
+    const char *test_fname = "k_tests_sync.f16fs";
+
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/synced", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/synced");
+    ASSERT_GE(fd, 0);
+    uint8_t data[512 * 8];
+    memset(data, 0x5A, sizeof(data));
+    ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+
+    // 1
+    ASSERT_EQ(fs_sync(fs), 0);
+    F16FS_t *second = fs_mount(test_fname);
+    ASSERT_NE(second, nullptr);
+    int second_fd = fs_open(second, "/synced");
+    ASSERT_GE(second_fd, 0);
+    ASSERT_EQ(fs_seek(second, second_fd, 0, FS_SEEK_END), (off_t) sizeof(data));
+    ASSERT_EQ(fs_close(second, second_fd), 0);
+    // already clean, nothing to write
+    ASSERT_EQ(fs_sync(fs), 0);
+    fs_unmount(second);
+
+    // 2
+    ASSERT_LT(fs_sync(NULL), 0);
+
+    fs_close(fs, fd);
+    fs_unmount(fs);
+}
+
+/*
+    F16FS_t *fs_mount_advised(const char *path, unsigned advice);
+    1. Every mode mounts and reads back what was written, and can write more
+    2. Fail, both access patterns, unknown flags, NULL path
+*/
+TEST(k_tests, mount_advised) {
+    const char *test_fname = "k_tests_advised.f16fs";
+    uint8_t data[512 * 20], back[512 * 20];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (i * 13) & 0xFF;
+    }
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t) sizeof(data));
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // 1
+    const unsigned modes[5] = {FS_ADVISE_NORMAL, FS_ADVISE_SEQUENTIAL, FS_ADVISE_RANDOM | FS_ADVISE_PREFETCH,
+                               FS_ADVISE_PREFETCH, FS_ADVISE_SEQUENTIAL | FS_ADVISE_PREFETCH | FS_ADVISE_HUGEPAGE};
+    for (int m = 0; m < 5; ++m) {
+        fs = fs_mount_advised(test_fname, modes[m]);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_pread(fs, fd, back, sizeof(back), 0), (ssize_t) sizeof(back));
+        ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+        ASSERT_EQ(fs_pwrite(fs, fd, data, 512, sizeof(data) + m * 512), 512);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t)(sizeof(data) + 5 * 512));
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // 2
+    ASSERT_EQ(fs_mount_advised(test_fname, FS_ADVISE_SEQUENTIAL | FS_ADVISE_RANDOM), nullptr);
+    ASSERT_EQ(fs_mount_advised(test_fname, 0x10), nullptr);
+    ASSERT_EQ(fs_mount_advised(NULL, FS_ADVISE_NORMAL), nullptr);
+}
+
+/*
+    Free inodes come out of the inode map, which gets rebuilt from the table at mount
+    1. Full table, removing a file frees exactly one inode for the next create
+    2. Remount of a full table, still full, freeing one works the same
+*/
+
+TEST(k_tests, inode_reuse) {
+    const char *test_fname = "k_tests_inodes.f16fs";
+    ASSERT_EQ(system("cp b_tests_full_table.f16fs k_tests_inodes.f16fs"), 0);
+
+    F16FS_t *fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+
+    // 1
+    ASSERT_LT(fs_create(fs, "/e/c/f", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/e/c/a"), 0);
+    ASSERT_EQ(fs_create(fs, "/e/c/f", FS_REGULAR), 0);
+    ASSERT_LT(fs_create(fs, "/e/c/g", FS_REGULAR), 0);
+    fs_unmount(fs);
+
+    // 2
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_LT(fs_create(fs, "/e/c/g", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/e/c/f"), 0);
+    ASSERT_EQ(fs_create(fs, "/e/c/g", FS_DIRECTORY), 0);
+    ASSERT_LT(fs_create(fs, "/e/c/a", FS_REGULAR), 0);
+    fs_unmount(fs);
+}
+
+/*
+    Directories past one block
+    1. Fill a directory well into its indirect block, everything listed and reachable
+    2. Remove every other entry, the rest still resolve and the names can be reused
+    3. Remount, the directory is read back from disk
+    4. Empty it out, then it can be removed
+*/
+
+TEST(k_tests, large_directory) {
+    const char *test_fname = "k_tests_dir.f16fs";
+    const int entries = 250;
+    char path[32];
+
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+
+    // 1
+    for (int i = 0; i < entries; ++i) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        ASSERT_EQ(fs_create(fs, path, i % 5 ? FS_REGULAR : FS_DIRECTORY), 0);
+    }
+    ASSERT_LT(fs_create(fs, "/big/file_042", FS_REGULAR), 0);
+    dyn_array_t *record_results = fs_get_dir(fs, "/big");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), (size_t) entries);
+    ASSERT_TRUE(find_in_directory(record_results, "file_000"));
+    ASSERT_TRUE(find_in_directory(record_results, "file_249"));
+    dyn_array_destroy(record_results);
+    for (int i = 1; i < entries; i += 5) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        int fd = fs_open(fs, path);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+
+    // 2
+    for (int i = 0; i < entries; i += 2) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    for (int i = 0; i < entries; ++i) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR) < 0, i % 2 == 1);
+    }
+    ASSERT_EQ(fs_move(fs, "/big/file_249", "/big/renamed"), 0);
+    ASSERT_LT(fs_move(fs, "/big/renamed", "/big/file_248"), 0);
+    fs_unmount(fs);
+
+    // 3
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    record_results = fs_get_dir(fs, "/big");
+    ASSERT_NE(record_results, nullptr);
+    ASSERT_EQ(dyn_array_size(record_results), (size_t) entries);
+    ASSERT_TRUE(find_in_directory(record_results, "renamed"));
+    ASSERT_FALSE(find_in_directory(record_results, "file_249"));
+    dyn_array_destroy(record_results);
+    ASSERT_GE(fs_open(fs, "/big/renamed"), 0);
+    ASSERT_LT(fs_open(fs, "/big/file_249"), 0);
+
+    // 4
+    ASSERT_LT(fs_remove(fs, "/big"), 0);
+    ASSERT_EQ(fs_remove(fs, "/big/renamed"), 0);
+    for (int i = 0; i < entries - 1; ++i) {
+        snprintf(path, sizeof(path), "/big/file_%03d", i);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    ASSERT_EQ(fs_remove(fs, "/big"), 0);
+    ASSERT_LT(fs_open(fs, "/big/file_001"), 0);
+    fs_unmount(fs);
+}
+
+/*
+    int fs_dcache_stats(F16FS_t *fs, dcache_stats_t *stats);
+    1. Repeat opens are answered from the cache, misses too
+    2. Create, move and remove show up in the next lookup
+    3. NULL
+*/
+
+TEST(k_tests, dentry_cache) {
+    const char *test_fname = "k_tests_dcache.f16fs";
+    dcache_stats_t before, after;
+
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/dir/file", FS_REGULAR), 0);
+
+    // 1
+    int fd = fs_open(fs, "/dir/file");
+    ASSERT_GE(fd, 0);
+    fs_close(fs, fd);
+    ASSERT_LT(fs_open(fs, "/dir/nope"), 0);
+    ASSERT_EQ(fs_dcache_stats(fs, &before), 0);
+    fd = fs_open(fs, "/dir/file");
+    ASSERT_GE(fd, 0);
+    fs_close(fs, fd);
+    ASSERT_LT(fs_open(fs, "/dir/nope"), 0);
+    ASSERT_EQ(fs_dcache_stats(fs, &after), 0);
+    ASSERT_EQ(after.hits - before.hits, 3);
+    ASSERT_EQ(after.negative_hits - before.negative_hits, 1);
+    ASSERT_EQ(after.misses, before.misses);
+
+    // 2
+    ASSERT_EQ(fs_create(fs, "/dir/nope", FS_REGULAR), 0);
+    fd = fs_open(fs, "/dir/nope");
+    ASSERT_GE(fd, 0);
+    fs_close(fs, fd);
+    ASSERT_EQ(fs_move(fs, "/dir/nope", "/moved"), 0);
+    ASSERT_LT(fs_open(fs, "/dir/nope"), 0);
+    fd = fs_open(fs, "/moved");
+    ASSERT_GE(fd, 0);
+    fs_close(fs, fd);
+    ASSERT_EQ(fs_move(fs, "/dir/file", "/dir/renamed"), 0);
+    ASSERT_LT(fs_open(fs, "/dir/file"), 0);
+    ASSERT_EQ(fs_remove(fs, "/dir/renamed"), 0);
+    ASSERT_LT(fs_open(fs, "/dir/renamed"), 0);
+    ASSERT_EQ(fs_remove(fs, "/dir"), 0);
+    ASSERT_EQ(fs_create(fs, "/dir", FS_REGULAR), 0);
+    ASSERT_LT(fs_open(fs, "/dir/file"), 0);
+
+    // 3
+    ASSERT_LT(fs_dcache_stats(NULL, &after), 0);
+    ASSERT_LT(fs_dcache_stats(fs, NULL), 0);
+
+    fs_unmount(fs);
+}
+
+/*
+    int fs_set_fd_limit(F16FS_t *fs, size_t limit);
+    1. Raised limit, the table grows past 256
+    2. Remove closes only the descriptors on that file, the slots get reused
+    3. Error, limit below what the table already has, NULL fs
+*/
+
+TEST(k_tests, descriptor_table) {
+    const char *test_fname = "k_tests_fds.f16fs";
+    const int limit = 1000;
+    vector<int> fds;
+
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/one", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/two", FS_REGULAR), 0);
+
+    // 1
+    ASSERT_EQ(fs_set_fd_limit(fs, limit), 0);
+    for (int i = 0; i < limit; ++i) {
+        int fd = fs_open(fs, i % 2 ? "/one" : "/two");
+        ASSERT_GE(fd, 0);
+        ASSERT_LT(fd, limit);
+        fds.push_back(fd);
+    }
+    ASSERT_LT(fs_open(fs, "/one"), 0);
+
+    // 2
+    ASSERT_EQ(fs_remove(fs, "/one"), 0);
+    for (int i = 0; i < limit; ++i) {
+        if (i % 2) {
+            ASSERT_LT(fs_close(fs, fds[i]), 0);
+        } else {
+            ASSERT_EQ(fs_seek(fs, fds[i], 0, FS_SEEK_SET), 0);
+        }
+    }
+    for (int i = 0; i < limit / 2; ++i) {
+        ASSERT_GE(fs_open(fs, "/two"), 0);
+    }
+    ASSERT_LT(fs_open(fs, "/two"), 0);
+    ASSERT_LT(fs_seek(fs, limit, 0, FS_SEEK_SET), 0);
+
+    // 3
+    ASSERT_LT(fs_set_fd_limit(fs, 256), 0);
+    ASSERT_LT(fs_set_fd_limit(NULL, 256), 0);
+
+    fs_unmount(fs);
+}
+
+/*
+    geometry
+    1. 4K blocks, inode count rounded up to a full table block, file reaching the double indirect block
+    2. more than 65536 blocks, 32-bit pointers, files landing on blocks past 65535
+    3. Bad geometry, legacy fs_format geometry
+    4. Directory on a full device fails and leaves nothing behind, with extents and a journal too
+*/
+TEST(k_tests, geometry) {
+    const char *test_fname = "k_tests_geometry.f16fs";
+    fs_geometry_t geometry;
+
+    // 1
+    fs_geometry_t big_blocks = {4096, 4096, 100, false, 0};
+    F16FS_t *fs = fs_format_geometry(test_fname, &big_blocks);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_geometry(fs, &geometry), 0);
+    ASSERT_EQ(geometry.block_size, 4096u);
+    ASSERT_EQ(geometry.block_count, 4096u);
+    ASSERT_EQ(geometry.inode_count, 128u);
+    char name[32];
+    for (int i = 1; i < 128; ++i) {
+        snprintf(name, sizeof(name), "/file_%d", i);
+        ASSERT_EQ(fs_create(fs, name, FS_REGULAR), 0);
+    }
+    ASSERT_LT(fs_create(fs, "/one_too_many", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/file_127"), 0);
+    ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_remove(fs, "/file_126"), 0);
+    ASSERT_EQ(fs_create(fs, "/dir/big", FS_REGULAR), 0);
+
+    const size_t big_size = 10 << 20;
+    vector<uint8_t> data(big_size), back(big_size);
+    for (size_t i = 0; i < big_size; ++i) {
+        data[i] = (i * 7 + i / 4096) & 0xFF;
+    }
+    int fd = fs_open(fs, "/dir/big");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data.data(), big_size), (ssize_t) big_size);
+    fs_unmount(fs);
+
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_geometry(fs, &geometry), 0);
+    ASSERT_EQ(geometry.block_size, 4096u);
+    ASSERT_EQ(geometry.inode_count, 128u);
+    fd = fs_open(fs, "/dir/big");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_read(fs, fd, back.data(), big_size), (ssize_t) big_size);
+    ASSERT_EQ(memcmp(data.data(), back.data(), big_size), 0);
+    ASSERT_EQ(fs_remove(fs, "/dir/big"), 0);
+    ASSERT_EQ(fs_remove(fs, "/dir"), 0);
+    fs_unmount(fs);
+
+    // 2
+    fs_geometry_t many_blocks = {512, 70000, 256, false, 0};
+    fs = fs_format_geometry(test_fname, &many_blocks);
+    ASSERT_NE(fs, nullptr);
+    const size_t file_size = 8 << 20;
+    data.resize(file_size);
+    back.resize(file_size);
+    for (int f = 0; f < 4; ++f) {
+        snprintf(name, sizeof(name), "/file_%d", f);
+        ASSERT_EQ(fs_create(fs, name, FS_REGULAR), 0);
+        fd = fs_open(fs, name);
+        ASSERT_GE(fd, 0);
+        for (size_t i = 0; i < file_size; ++i) {
+            data[i] = (i * 13 + i / 512 + f) & 0xFF;
+        }
+        ASSERT_EQ(fs_write(fs, fd, data.data(), file_size), (ssize_t) file_size);
+    }
+    fs_unmount(fs);
+
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_geometry(fs, &geometry), 0);
+    ASSERT_EQ(geometry.block_count, 70000u);
+    for (int f = 0; f < 4; ++f) {
+        snprintf(name, sizeof(name), "/file_%d", f);
+        fd = fs_open(fs, name);
+        ASSERT_GE(fd, 0);
+        for (size_t i = 0; i < file_size; ++i) {
+            data[i] = (i * 13 + i / 512 + f) & 0xFF;
+        }
+        ASSERT_EQ(fs_read(fs, fd, back.data(), file_size), (ssize_t) file_size);
+        ASSERT_EQ(memcmp(data.data(), back.data(), file_size), 0);
+    }
+    fs_unmount(fs);
+
+    // 3
+    fs_geometry_t bad_size = {1000, 4096, 256, false, 0};
+    ASSERT_EQ(fs_format_geometry(test_fname, &bad_size), nullptr);
+    fs_geometry_t no_inodes = {512, 4096, 0, false, 0};
+    ASSERT_EQ(fs_format_geometry(test_fname, &no_inodes), nullptr);
+    fs_geometry_t no_room = {512, 32, 256, false, 0};
+    ASSERT_EQ(fs_format_geometry(test_fname, &no_room), nullptr);
+    ASSERT_EQ(fs_format_geometry(test_fname, NULL), nullptr);
+    ASSERT_LT(fs_get_geometry(NULL, &geometry), 0);
+
+    fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_geometry(fs, &geometry), 0);
+    ASSERT_EQ(geometry.block_size, 512u);
+    ASSERT_EQ(geometry.block_count, 65536u);
+    ASSERT_EQ(geometry.inode_count, 256u);
+    fs_unmount(fs);
+
+    // 4
+    data.assign(1 << 20, 0x3C);
+    for (int variant = 0; variant < 2; ++variant) {
+        fs_geometry_t small = {512, 2048, 64, variant != 0, variant ? 32u : 0u};
+        fs = fs_format_geometry(test_fname, &small);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/fill", FS_REGULAR), 0);
+        fd = fs_open(fs, "/fill");
+        ASSERT_GE(fd, 0);
+        ssize_t filled = fs_write(fs, fd, data.data(), data.size());
+        ASSERT_GT(filled, 0);
+        ASSERT_LT(filled, (ssize_t) data.size());
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_LT(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+        dyn_array_t *entries = fs_get_dir(fs, "/");
+        ASSERT_NE(entries, nullptr);
+        ASSERT_EQ(dyn_array_size(entries), 1u);
+        dyn_array_destroy(entries);
+        ASSERT_LT(fs_create(fs, "/dir/file", FS_REGULAR), 0);
+        // a regular file needs no block, and the failed directory didn't use up its inode
+        ASSERT_EQ(fs_create(fs, "/reg", FS_REGULAR), 0);
+        ASSERT_EQ(fs_remove(fs, "/fill"), 0);
+        ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+        ASSERT_EQ(fs_create(fs, "/dir/file", FS_REGULAR), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        fs = fs_mount(test_fname);
+        ASSERT_NE(fs, nullptr);
+        entries = fs_get_dir(fs, "/dir");
+        ASSERT_NE(entries, nullptr);
+        ASSERT_EQ(dyn_array_size(entries), 1u);
+        dyn_array_destroy(entries);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+}
+
+/*
+    extents
+    1. Contiguous file takes a handful of extents, survives remount
+    2. Interleaved writes fragment two files past the inline extents into the extent tree
+    3. Removing them hands everything back, directories grow through extents too
+*/
+TEST(k_tests, extents) {
+    const char *test_fname = "k_tests_extents.f16fs";
+    fs_geometry_t geometry = {512, 70000, 256, true, 0};
+    F16FS_t *fs = fs_format_geometry(test_fname, &geometry);
+    ASSERT_NE(fs, nullptr);
+    fs_geometry_t check;
+    ASSERT_EQ(fs_get_geometry(fs, &check), 0);
+    ASSERT_TRUE(check.extents);
+
+    // 1
+    // bigger than the 65798 blocks pointers could reach
+    const size_t big_size = 66000 * 512;
+    vector<uint8_t> data(big_size), back(big_size);
+    for (size_t i = 0; i < big_size; ++i) {
+        data[i] = (i * 11 + i / 512) & 0xFF;
+    }
+    ASSERT_EQ(fs_create(fs, "/big", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/big");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data.data(), big_size), (ssize_t) big_size);
+    fs_unmount(fs);
+
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fd = fs_open(fs, "/big");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_read(fs, fd, back.data(), big_size), (ssize_t) big_size);
+    ASSERT_EQ(memcmp(data.data(), back.data(), big_size), 0);
+    ASSERT_EQ(fs_remove(fs, "/big"), 0);
+
+    // 2
+    const size_t chunk = 512 * 3;
+    const int rounds = 400;
+    ASSERT_EQ(fs_create(fs, "/x", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/y", FS_REGULAR), 0);
+    int fd_x = fs_open(fs, "/x");
+    int fd_y = fs_open(fs, "/y");
+    for (int r = 0; r < rounds; ++r) {
+        ASSERT_EQ(fs_write(fs, fd_x, data.data() + r * chunk, chunk), (ssize_t) chunk);
+        ASSERT_EQ(fs_write(fs, fd_y, data.data() + (rounds + r) * chunk, chunk), (ssize_t) chunk);
+    }
+    fs_unmount(fs);
+
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fd_x = fs_open(fs, "/x");
+    fd_y = fs_open(fs, "/y");
+    ASSERT_EQ(fs_read(fs, fd_x, back.data(), chunk * rounds + 1), (ssize_t)(chunk * rounds));
+    ASSERT_EQ(memcmp(data.data(), back.data(), chunk * rounds), 0);
+    ASSERT_EQ(fs_read(fs, fd_y, back.data(), chunk * rounds), (ssize_t)(chunk * rounds));
+    ASSERT_EQ(memcmp(data.data() + rounds * chunk, back.data(), chunk * rounds), 0);
+    // overwrite in the middle doesn't touch the mapping
+    ASSERT_EQ(fs_seek(fs, fd_x, 1000, FS_SEEK_SET), 1000);
+    ASSERT_EQ(fs_write(fs, fd_x, data.data(), 5000), 5000);
+    ASSERT_EQ(fs_seek(fs, fd_x, 1000, FS_SEEK_SET), 1000);
+    ASSERT_EQ(fs_read(fs, fd_x, back.data(), 5000), 5000);
+    ASSERT_EQ(memcmp(data.data(), back.data(), 5000), 0);
+
+    // 3
+    ASSERT_EQ(fs_remove(fs, "/x"), 0);
+    ASSERT_EQ(fs_remove(fs, "/y"), 0);
+    ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+    char name[32];
+    for (int i = 0; i < 100; ++i) {
+        snprintf(name, sizeof(name), "/dir/file_%d", i);
+        ASSERT_EQ(fs_create(fs, name, FS_REGULAR), 0);
+    }
+    dyn_array_t *records = fs_get_dir(fs, "/dir");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), 100u);
+    dyn_array_destroy(records);
+    ASSERT_EQ(fs_create(fs, "/big", FS_REGULAR), 0);
+    fd = fs_open(fs, "/big");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, data.data(), big_size - 100 * 512), (ssize_t)(big_size - 100 * 512));
+    fs_unmount(fs);
+}
+
+/*
+    sparse files
+    1. Writing past EOF leaves a hole that reads as zeros
+    2. SEEK_DATA/SEEK_HOLE find the data and the holes
+    3. Holes take no blocks, more sparse files than the device could hold if they were full
+    4. Filling a hole later, partial blocks around the write stay zero
+*/
+TEST(k_tests, sparse_files) {
+    const char *test_fname = "k_tests_sparse.f16fs";
+    const char *data = "sparse data!";
+    const size_t data_len = strlen(data);
+    const off_t hole = 1 << 20;
+
+    for (int extents = 0; extents < 2; ++extents) {
+        fs_geometry_t geometry = {512, 65536, 256, extents != 0, 0};
+        F16FS_t *fs = fs_format_geometry(test_fname, &geometry);
+        ASSERT_NE(fs, nullptr);
+
+        // 1
+        ASSERT_EQ(fs_create(fs, "/sparse", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/sparse");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_seek(fs, fd, hole, FS_SEEK_SET), hole);
+        ASSERT_EQ(fs_write(fs, fd, data, data_len), (ssize_t) data_len);
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t)(hole + data_len));
+        vector<char> back(hole + data_len + 100, 'x');
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+        ASSERT_EQ(fs_read(fs, fd, back.data(), back.size()), (ssize_t)(hole + data_len));
+        for (off_t i = 0; i < hole; ++i) {
+            ASSERT_EQ(back[i], 0);
+        }
+        ASSERT_EQ(memcmp(back.data() + hole, data, data_len), 0);
+        ASSERT_EQ(fs_read(fs, fd, back.data(), 10), 0);
+
+        // 2
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_HOLE), 0);
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_DATA), hole);
+        ASSERT_EQ(fs_seek(fs, fd, hole + 5, FS_SEEK_DATA), hole + 5);
+        ASSERT_EQ(fs_seek(fs, fd, hole, FS_SEEK_HOLE), (off_t)(hole + data_len));
+        ASSERT_LT(fs_seek(fs, fd, hole + data_len, FS_SEEK_DATA), 0);
+        ASSERT_LT(fs_seek(fs, fd, -1, FS_SEEK_HOLE), 0);
+
+        // 3
+        // 60 of these would be 60 MB, the device is 32
+        char name[32];
+        for (int i = 0; i < 60; ++i) {
+            snprintf(name, sizeof(name), "/many_%d", i);
+            ASSERT_EQ(fs_create(fs, name, FS_REGULAR), 0);
+            int many = fs_open(fs, name);
+            ASSERT_GE(many, 0);
+            ASSERT_EQ(fs_seek(fs, many, hole - 3, FS_SEEK_SET), hole - 3);
+            ASSERT_EQ(fs_write(fs, many, data, data_len), (ssize_t) data_len);
+            ASSERT_EQ(fs_close(fs, many), 0);
+        }
+
+        // 4
+        ASSERT_EQ(fs_seek(fs, fd, 1000, FS_SEEK_SET), 1000);
+        ASSERT_EQ(fs_write(fs, fd, data, data_len), (ssize_t) data_len);
+        fs_unmount(fs);
+
+        fs = fs_mount(test_fname);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/sparse");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, back.data(), back.size()), (ssize_t)(hole + data_len));
+        for (off_t i = 0; i < hole; ++i) {
+            if (i < 1000 || i >= (off_t)(1000 + data_len)) {
+                ASSERT_EQ(back[i], 0);
+            }
+        }
+        ASSERT_EQ(memcmp(back.data() + 1000, data, data_len), 0);
+        ASSERT_EQ(memcmp(back.data() + hole, data, data_len), 0);
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_DATA), 512);
+        ASSERT_EQ(fs_seek(fs, fd, 512, FS_SEEK_HOLE), 1024);
+        fs_unmount(fs);
+    }
+}
+
+/*
+    positional I/O
+    1. pwrite/pread don't use or move the descriptor's position
+    2. pwrite past EOF grows the file and leaves a hole, pread stops at EOF
+    3. Bad values
+    4. Offsets past the largest file there can be, nothing gets written and the size stays put
+*/
+TEST(k_tests, positional_io) {
+    const char *test_fname = "k_tests_pio.f16fs";
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+
+    vector<uint8_t> data(8192), back(8192);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (i * 17 + 3) & 0xFF;
+    }
+
+    // 1
+    ASSERT_EQ(fs_write(fs, fd, data.data(), 4096), 4096);
+    ASSERT_EQ(fs_seek(fs, fd, 100, FS_SEEK_SET), 100);
+    ASSERT_EQ(fs_pwrite(fs, fd, data.data() + 4096, 700, 1000), 700);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_CUR), 100);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), 700, 1000), 700);
+    ASSERT_EQ(memcmp(back.data(), data.data() + 4096, 700), 0);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), 100, 0), 100);
+    ASSERT_EQ(memcmp(back.data(), data.data(), 100), 0);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_CUR), 100);
+    // and a plain read picks up where the descriptor was
+    ASSERT_EQ(fs_read(fs, fd, back.data(), 100), 100);
+    ASSERT_EQ(memcmp(back.data(), data.data() + 100, 100), 0);
+
+    // 2
+    ASSERT_EQ(fs_pwrite(fs, fd, data.data(), 10, 6000), 10);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), 6010);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), 8192, 4000), 2010);
+    for (int i = 96; i < 2000; ++i) {
+        ASSERT_EQ(back[i], 0);
+    }
+    ASSERT_EQ(memcmp(back.data() + 2000, data.data(), 10), 0);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), 10, 6010), 0);
+
+    // 3
+    ASSERT_LT(fs_pread(NULL, fd, back.data(), 10, 0), 0);
+    ASSERT_LT(fs_pread(fs, fd + 1, back.data(), 10, 0), 0);
+    ASSERT_LT(fs_pread(fs, fd, NULL, 10, 0), 0);
+    ASSERT_LT(fs_pread(fs, fd, back.data(), 10, -1), 0);
+    ASSERT_LT(fs_pwrite(NULL, fd, data.data(), 10, 0), 0);
+    ASSERT_LT(fs_pwrite(fs, fd, NULL, 10, 0), 0);
+    ASSERT_LT(fs_pwrite(fs, fd, data.data(), 10, -1), 0);
+    ASSERT_EQ(fs_pwrite(fs, fd, data.data(), 0, 0), 0);
+
+    // 4
+    const off_t max_size = (6 + 256 + 256 * 256) * 512;
+    ASSERT_LT(fs_pwrite(fs, fd, data.data() + 4096, 512, 1LL << 42), 0);
+    ASSERT_LT(fs_pwrite(fs, fd, data.data() + 4096, 512, 1LL << 35), 0);
+    ASSERT_LT(fs_pwrite(fs, fd, data.data() + 4096, 10, max_size - 5), 0);
+    ASSERT_LT(fs_pread(fs, fd, back.data(), 512, 1LL << 42), 0);
+    ASSERT_EQ(fs_seek(fs, fd, 1LL << 42, FS_SEEK_SET), 1LL << 42);
+    ASSERT_LT(fs_write(fs, fd, data.data() + 4096, 512), 0);
+    ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), 6010);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), 512, 0), 512);
+    ASSERT_EQ(memcmp(back.data(), data.data(), 512), 0);
+
+    fs_unmount(fs);
+}
+
+/*
+    Threads
+    1. Threads writing and reading back their own files, creating them at the same time
+    2. Threads reading one descriptor with fs_pread while another opens and closes the file
+    3. Threads appending through one shared descriptor, no record gets split or lost
+*/
+TEST(k_tests, threads) {
+    const char *test_fname = "k_tests_threads.f16fs";
+    const int thread_count = 4;
+    const size_t file_size = 96 * 1024;
+    const size_t record = 512;
+    const int records = 200;
+
+    for (int extents = 0; extents < 2; ++extents) {
+        fs_geometry_t geometry = {512, 65536, 256, extents != 0, 0};
+        F16FS_t *fs = fs_format_geometry(test_fname, &geometry);
+        ASSERT_NE(fs, nullptr);
+        std::atomic<int> errors(0);
+
+        // 1
+        vector<std::thread> threads;
+        for (int t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t]() {
+                string path = "/file" + std::to_string(t);
+                if (fs_create(fs, path.c_str(), FS_REGULAR) != 0) {
+                    errors++;
+                    return;
+                }
+                int fd = fs_open(fs, path.c_str());
+                vector<uint8_t> data(file_size), back(file_size);
+                for (size_t i = 0; i < file_size; ++i) {
+                    data[i] = (i * 7 + t * 13) & 0xFF;
+                }
+                for (size_t done = 0; done < file_size; done += 3000) {
+                    size_t want = file_size - done < 3000 ? file_size - done : 3000;
+                    if (fs_write(fs, fd, data.data() + done, want) != (ssize_t) want) {
+                        errors++;
+                    }
+                }
+                if (fs_pread(fs, fd, back.data(), file_size, 0) != (ssize_t) file_size || back != data) {
+                    errors++;
+                }
+                if (fs_close(fs, fd) != 0) {
+                    errors++;
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        ASSERT_EQ(errors, 0);
+        dyn_array_t *dir = fs_get_dir(fs, "/");
+        ASSERT_NE(dir, nullptr);
+        ASSERT_EQ(dyn_array_size(dir), (size_t) thread_count);
+        dyn_array_destroy(dir);
+
+        // 2
+        int shared = fs_open(fs, "/file0");
+        ASSERT_GE(shared, 0);
+        for (int t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t]() {
+                vector<uint8_t> back(1000);
+                for (int i = 0; i < 200; ++i) {
+                    size_t offset = (i * 997 + t * 4099) % (file_size - back.size());
+                    if (fs_pread(fs, shared, back.data(), back.size(), offset) != (ssize_t) back.size()) {
+                        errors++;
+                        continue;
+                    }
+                    for (size_t j = 0; j < back.size(); ++j) {
+                        if (back[j] != (((offset + j) * 7) & 0xFF)) {
+                            errors++;
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 200; ++i) {
+                int fd = fs_open(fs, "/file0");
+                if (fd < 0 || fd == shared || fs_close(fs, fd) != 0) {
+                    errors++;
+                }
+            }
+        });
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        ASSERT_EQ(errors, 0);
+        ASSERT_EQ(fs_seek(fs, shared, 0, FS_SEEK_CUR), 0);
+        ASSERT_EQ(fs_close(fs, shared), 0);
+
+        // 3
+        ASSERT_EQ(fs_create(fs, "/log", FS_REGULAR), 0);
+        shared = fs_open(fs, "/log");
+        ASSERT_GE(shared, 0);
+        for (int t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t]() {
+                vector<uint8_t> data(record, 'a' + t);
+                for (int i = 0; i < records; ++i) {
+                    if (fs_write(fs, shared, data.data(), record) != (ssize_t) record) {
+                        errors++;
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        ASSERT_EQ(errors, 0);
+        const size_t log_size = record * records * thread_count;
+        ASSERT_EQ(fs_seek(fs, shared, 0, FS_SEEK_END), (off_t) log_size);
+        vector<uint8_t> back(log_size);
+        ASSERT_EQ(fs_pread(fs, shared, back.data(), log_size, 0), (ssize_t) log_size);
+        vector<int> counts(thread_count, 0);
+        for (size_t r = 0; r < log_size / record; ++r) {
+            int t = back[r * record] - 'a';
+            ASSERT_GE(t, 0);
+            ASSERT_LT(t, thread_count);
+            for (size_t j = 1; j < record; ++j) {
+                ASSERT_EQ(back[r * record + j], back[r * record]);
+            }
+            counts[t]++;
+        }
+        for (int t = 0; t < thread_count; ++t) {
+            ASSERT_EQ(counts[t], records);
+        }
+
+        fs_unmount(fs);
+    }
+}
+
+// whole image file, as whatever is reading it would find it right now
+vector<uint8_t> read_image(const char *fname) {
+    vector<uint8_t> image;
+    FILE *file = fopen(fname, "rb");
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        image.resize(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        if (fread(image.data(), 1, image.size(), file) != image.size()) {
+            image.clear();
+        }
+        fclose(file);
+    }
+    return image;
+}
+
+bool write_image(const char *fname, const vector<uint8_t> &image) {
+    FILE *file = fopen(fname, "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+    fclose(file);
+    return written;
+}
+
+/*
+    Journal
+    1. Journaled file system works like any other, and comes back from a clean remount
+    2. Crash that kept every metadata block from getting home, only the log made it, mount replays it
+    3. Threads creating and writing files take turns with the transaction, all of it survives a remount
+    4. Journals that are too small or don't fit are refused
+    5. A log whose first descriptor sends a block to the wrong home doesn't replay at all
+*/
+TEST(k_tests, journal) {
+    const char *test_fname = "k_tests_journal.f16fs";
+    const char *crash_fname = "k_tests_journal_crash.f16fs";
+    const char *torn_fname = "k_tests_journal_torn.f16fs";
+    // 512 byte blocks after a 4096 byte header, FBM 0-15, inode table 16-47, journal 48-111, root 112
+    const size_t header = 4096;
+    const size_t block = 512;
+    const size_t a_size = 100 * 1024, b_size = 10 * 1024, c_size = 20 * 1024, d_size = 200 * 1024;
+    vector<uint8_t> a_data(a_size), c_data(c_size), d_data(d_size), back(d_size);
+    for (size_t i = 0; i < a_size; ++i) {
+        a_data[i] = (i * 3 + i / 512) & 0xFF;
+    }
+    for (size_t i = 0; i < c_size; ++i) {
+        c_data[i] = (i * 11 + 5) & 0xFF;
+    }
+    for (size_t i = 0; i < d_size; ++i) {
+        d_data[i] = (i * 17 + i / 1000) & 0xFF;
+    }
+
+    for (int extents = 0; extents < 2; ++extents) {
+        // 1
+        fs_geometry_t geometry = {512, 65536, 256, extents != 0, 64};
+        F16FS_t *fs = fs_format_geometry(test_fname, &geometry);
+        ASSERT_NE(fs, nullptr);
+        fs_geometry_t check;
+        ASSERT_EQ(fs_get_geometry(fs, &check), 0);
+        ASSERT_EQ(check.journal_blocks, 64u);
+        ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+        ASSERT_EQ(fs_create(fs, "/dir/a", FS_REGULAR), 0);
+        ASSERT_EQ(fs_create(fs, "/b", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/dir/a");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, a_data.data(), a_size), (ssize_t) a_size);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        fd = fs_open(fs, "/b");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, d_data.data(), b_size), (ssize_t) b_size);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        fs = fs_mount(test_fname);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/dir/a");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, back.data(), a_size), (ssize_t) a_size);
+        ASSERT_EQ(memcmp(back.data(), a_data.data(), a_size), 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+
+        // 2
+        // everything up to here is home, mount checkpoints
+        dyn_array_t *record_results;
+        vector<uint8_t> before = read_image(test_fname);
+        ASSERT_FALSE(before.empty());
+        ASSERT_EQ(fs_create(fs, "/c", FS_REGULAR), 0);
+        fd = fs_open(fs, "/c");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, c_data.data(), c_size), (ssize_t) c_size);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_remove(fs, "/b"), 0);
+        ASSERT_EQ(fs_move(fs, "/dir/a", "/a"), 0);
+        // file data and the log got to disk, the FBM, inode table and directories are still what they were
+        vector<uint8_t> crash = read_image(test_fname);
+        ASSERT_EQ(crash.size(), before.size());
+        memcpy(crash.data() + header, before.data() + header, 48 * block);
+        memcpy(crash.data() + header + 112 * block, before.data() + header + 112 * block, 8 * block);
+        ASSERT_TRUE(write_image(crash_fname, crash));
+        // 5
+        // the first descriptor is journal block 1, its home blocks start 20 bytes in
+        vector<uint8_t> torn = crash;
+        uint32_t home;
+        memcpy(&home, torn.data() + header + 49 * block + 20, sizeof(home));
+        home = home == 113 ? 114 : 113;
+        memcpy(torn.data() + header + 49 * block + 20, &home, sizeof(home));
+        ASSERT_TRUE(write_image(torn_fname, torn));
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        fs = fs_mount(torn_fname);
+        ASSERT_NE(fs, nullptr);
+        record_results = fs_get_dir(fs, "/");
+        ASSERT_NE(record_results, nullptr);
+        ASSERT_TRUE(find_in_directory(record_results, "b"));
+        ASSERT_TRUE(find_in_directory(record_results, "dir"));
+        ASSERT_FALSE(find_in_directory(record_results, "c"));
+        dyn_array_destroy(record_results);
+        fd = fs_open(fs, "/dir/a");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_pread(fs, fd, back.data(), d_size, 0), (ssize_t) a_size);
+        ASSERT_EQ(memcmp(back.data(), a_data.data(), a_size), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        fs = fs_mount(crash_fname);
+        ASSERT_NE(fs, nullptr);
+        record_results = fs_get_dir(fs, "/");
+        ASSERT_NE(record_results, nullptr);
+        ASSERT_TRUE(find_in_directory(record_results, "a"));
+        ASSERT_TRUE(find_in_directory(record_results, "c"));
+        ASSERT_TRUE(find_in_directory(record_results, "dir"));
+        ASSERT_FALSE(find_in_directory(record_results, "b"));
+        dyn_array_destroy(record_results);
+        record_results = fs_get_dir(fs, "/dir");
+        ASSERT_NE(record_results, nullptr);
+        ASSERT_EQ(dyn_array_size(record_results), 0u);
+        dyn_array_destroy(record_results);
+        int fd_a = fs_open(fs, "/a");
+        int fd_c = fs_open(fs, "/c");
+        ASSERT_GE(fd_a, 0);
+        ASSERT_GE(fd_c, 0);
+        ASSERT_EQ(fs_pread(fs, fd_a, back.data(), d_size, 0), (ssize_t) a_size);
+        ASSERT_EQ(memcmp(back.data(), a_data.data(), a_size), 0);
+        ASSERT_EQ(fs_pread(fs, fd_c, back.data(), d_size, 0), (ssize_t) c_size);
+        ASSERT_EQ(memcmp(back.data(), c_data.data(), c_size), 0);
+        // the FBM was rebuilt, so nothing new lands on top of them
+        ASSERT_EQ(fs_create(fs, "/d", FS_REGULAR), 0);
+        fd = fs_open(fs, "/d");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, d_data.data(), d_size), (ssize_t) d_size);
+        ASSERT_EQ(fs_pread(fs, fd_a, back.data(), d_size, 0), (ssize_t) a_size);
+        ASSERT_EQ(memcmp(back.data(), a_data.data(), a_size), 0);
+        ASSERT_EQ(fs_pread(fs, fd_c, back.data(), d_size, 0), (ssize_t) c_size);
+        ASSERT_EQ(memcmp(back.data(), c_data.data(), c_size), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        fs = fs_mount(crash_fname);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/d");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, back.data(), d_size), (ssize_t) d_size);
+        ASSERT_EQ(back, d_data);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+
+    // 3
+    const int thread_count = 4;
+    fs_geometry_t geometry = {512, 65536, 256, true, 32};
+    F16FS_t *fs = fs_format_geometry(test_fname, &geometry);
+    ASSERT_NE(fs, nullptr);
+    std::atomic<int> errors(0);
+    vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int f = 0; f < 8; ++f) {
+                string path = "/t" + std::to_string(t) + "_" + std::to_string(f);
+                if (fs_create(fs, path.c_str(), FS_REGULAR) != 0) {
+                    errors++;
+                    continue;
+                }
+                int fd = fs_open(fs, path.c_str());
+                size_t size = (f + 1) * 3000;
+                if (fs_write(fs, fd, d_data.data() + t, size) != (ssize_t) size || fs_close(fs, fd) != 0) {
+                    errors++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    for (int t = 0; t < thread_count; ++t) {
+        for (int f = 0; f < 8; ++f) {
+            string path = "/t" + std::to_string(t) + "_" + std::to_string(f);
+            int fd = fs_open(fs, path.c_str());
+            ASSERT_GE(fd, 0);
+            size_t size = (f + 1) * 3000;
+            ASSERT_EQ(fs_read(fs, fd, back.data(), d_size), (ssize_t) size);
+            ASSERT_EQ(memcmp(back.data(), d_data.data() + t, size), 0);
+        }
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // 4
+    fs_geometry_t tiny = {512, 65536, 256, false, 16};
+    ASSERT_EQ(fs_format_geometry(test_fname, &tiny), nullptr);
+    fs_geometry_t too_big = {512, 4096, 256, false, 4096};
+    ASSERT_EQ(fs_format_geometry(test_fname, &too_big), nullptr);
+    fs_geometry_t no_room = {512, 60, 256, false, 40};
+    ASSERT_EQ(fs_format_geometry(test_fname, &no_room), nullptr);
+}
+
+/*
+    Fsync
+    1. A synced file comes back whole from a copy of the image taken without unmounting, journal or not
+    2. Syncing again with nothing new written, and after an overwrite
+    3. Fail, bad descriptor, closed descriptor, NULL fs
+*/
+TEST(k_tests, fsync) {
+    const char *test_fname = "k_tests_fsync.f16fs";
+    const char *copy_fname = "k_tests_fsync_copy.f16fs";
+    // past the direct and single indirect blocks, and a tail that ends partway into a block
+    const size_t size = 150 * 1024 + 100;
+    vector<uint8_t> data(size), back(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = (i * 7 + i / 512) & 0xFF;
+    }
+
+    for (int journal = 0; journal < 2; ++journal) {
+        for (int extents = 0; extents < 2; ++extents) {
+            // 1
+            fs_geometry_t geometry = {512, 65536, 256, extents != 0, journal ? 64u : 0u};
+            F16FS_t *fs = fs_format_geometry(test_fname, &geometry);
+            ASSERT_NE(fs, nullptr);
+            ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+            ASSERT_EQ(fs_create(fs, "/dir/f", FS_REGULAR), 0);
+            // the directory entry isn't the file's to sync
+            ASSERT_EQ(fs_sync(fs), 0);
+            int fd = fs_open(fs, "/dir/f");
+            ASSERT_GE(fd, 0);
+            ASSERT_EQ(fs_write(fs, fd, data.data(), size), (ssize_t) size);
+            ASSERT_EQ(fs_fsync(fs, fd), 0);
+            // without a journal the inode was only in the cache until now
+            ASSERT_TRUE(write_image(copy_fname, read_image(test_fname)));
+            F16FS_t *copy = fs_mount(copy_fname);
+            ASSERT_NE(copy, nullptr);
+            int copy_fd = fs_open(copy, "/dir/f");
+            ASSERT_GE(copy_fd, 0);
+            ASSERT_EQ(fs_read(copy, copy_fd, back.data(), size), (ssize_t) size);
+            ASSERT_EQ(back, data);
+            ASSERT_EQ(fs_unmount(copy), 0);
+
+            // 2
+            ASSERT_EQ(fs_fsync(fs, fd), 0);
+            ASSERT_EQ(fs_pwrite(fs, fd, data.data() + 1000, 2000, 70000), 2000);
+            ASSERT_EQ(fs_fsync(fs, fd), 0);
+            ASSERT_EQ(fs_pread(fs, fd, back.data(), 2000, 70000), 2000);
+            ASSERT_EQ(memcmp(back.data(), data.data() + 1000, 2000), 0);
+
+            // 3
+            ASSERT_LT(fs_fsync(fs, fd + 1), 0);
+            ASSERT_LT(fs_fsync(fs, -1), 0);
+            ASSERT_LT(fs_fsync(NULL, fd), 0);
+            ASSERT_EQ(fs_close(fs, fd), 0);
+            ASSERT_LT(fs_fsync(fs, fd), 0);
+            ASSERT_EQ(fs_unmount(fs), 0);
+        }
+    }
+}
+
+/*
+    int fs_set_queue_depth(F16FS_t *fs, unsigned depth);
+    1. Reads through the queue match reads in place, aligned or not, across holes, past EOF, io_uring and not
+    2. Several threads reading through one queue at once
+    3. Back to no queue, and writes still read back through it
+    4. Fail, too deep, NULL fs
+*/
+TEST(k_tests, queue_depth) {
+    const char *test_fname = "k_tests_queue.f16fs";
+    const size_t size = 512 * 700;
+    vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = (i * 7 + i / 512) & 0xFF;
+    }
+    F16FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+    // a hole in the middle, which reads as zeros
+    ASSERT_EQ(fs_pwrite(fs, fd, data.data(), 512 * 300, 0), 512 * 300);
+    ASSERT_EQ(fs_pwrite(fs, fd, data.data() + 512 * 310, size - 512 * 310, 512 * 310), (ssize_t)(size - 512 * 310));
+    memset(data.data() + 512 * 300, 0, 512 * 10);
+
+    const size_t reads[][2] = {{0, size}, {100, 5000}, {512 * 299 + 7, 512 * 12}, {3, 20}, {size - 100, 1000}};
+    vector<uint8_t> back(size);
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            setenv("BLOCK_STORE_NO_URING", "1", 1);
+        }
+        // 1
+        ASSERT_EQ(fs_set_queue_depth(fs, 8), 0);
+        for (size_t r = 0; r < sizeof(reads) / sizeof(reads[0]); ++r) {
+            const size_t length = reads[r][0] + reads[r][1] > size ? size - reads[r][0] : reads[r][1];
+            ASSERT_EQ(fs_pread(fs, fd, back.data(), reads[r][1], reads[r][0]), (ssize_t) length);
+            ASSERT_EQ(memcmp(back.data(), data.data() + reads[r][0], length), 0);
+        }
+        ASSERT_EQ(fs_pread(fs, fd, back.data(), 10, size), 0);
+
+        // 2
+        std::atomic<int> matched(0);
+        vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                vector<uint8_t> mine(512 * 50);
+                for (int i = 0; i < 20; ++i) {
+                    const size_t at = ((t * 20 + i) * 4099) % (size - mine.size());
+                    if (fs_pread(fs, fd, mine.data(), mine.size(), at) == (ssize_t) mine.size() &&
+                        memcmp(mine.data(), data.data() + at, mine.size()) == 0) {
+                        ++matched;
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQ(matched, 80);
+    }
+    unsetenv("BLOCK_STORE_NO_URING");
+
+    // 3
+    ASSERT_EQ(fs_set_queue_depth(fs, 0), 0);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), size, 0), (ssize_t) size);
+    ASSERT_EQ(back, data);
+    ASSERT_EQ(fs_set_queue_depth(fs, 64), 0);
+    ASSERT_EQ(fs_pwrite(fs, fd, data.data() + 1, 1000, 512 * 305), 1000);
+    ASSERT_EQ(fs_pread(fs, fd, back.data(), 1000, 512 * 305), 1000);
+    ASSERT_EQ(memcmp(back.data(), data.data() + 1, 1000), 0);
+
+    // 4
+    ASSERT_LT(fs_set_queue_depth(fs, 4097), 0);
+    ASSERT_LT(fs_set_queue_depth(NULL, 8), 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     ::testing::AddGlobalTestEnvironment(new GradeEnvironment);